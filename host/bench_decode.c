@@ -0,0 +1,172 @@
+// Decode benchmark: converts each image given on the command line through
+// the app's pipeline on top of the storage shim, and reports per image the
+// host time, the storage traffic with its modelled card time and the peak
+// heap, first as a full decode and then as a hit in the on-card frame cache.
+//
+// The corpus made by mkcorpus.py covers every format at several sizes:
+//     make corpus && ./bench_decode corpus/*
+
+#define _GNU_SOURCE
+#include <furi.h>
+#include <storage/storage.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bench_probe.h"
+#include "convert.h"
+#include "diskcache.h"
+#include "worker.h"
+
+static void usage(void) {
+    fprintf(
+        stderr,
+        "usage: bench_decode [-n runs] [-c call_us] [-b byte_ns] [-d dither] IMAGE...\n"
+        "  -n runs     decodes per image, the fastest is reported (default 5)\n"
+        "  -c call_us  modelled card cost per storage call (default %d)\n"
+        "  -b byte_ns  modelled card cost per byte moved (default %d)\n"
+        "  -d dither   dithering mode, 0-%d\n",
+        HOST_STORAGE_CALL_US,
+        HOST_STORAGE_BYTE_NS,
+        ImageDitherCount - 1);
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    UNUSED(st);
+    UNUSED(flag);
+    UNUSED(ftw);
+    return remove(path);
+}
+
+// Fastest of `runs` conversions; false if the image does not convert
+static bool bench_convert(const char* path, int runs, BenchResult* best) {
+    uint8_t bitmap[IMAGE_FRAME_SIZE];
+    uint16_t width, height;
+    for(int run = 0; run < runs; run++) {
+        BenchProbe probe;
+        BenchResult result;
+        bench_probe_start(&probe);
+        ImageConverterResult status = image_convert_to_bitmap(path, bitmap, &width, &height, NULL);
+        bench_probe_stop(&probe, &result);
+        if(status != ImageConverterOK) return false;
+        if(run == 0 || result.cpu_ms < best->cpu_ms) *best = result;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    uint32_t call_us = HOST_STORAGE_CALL_US;
+    uint32_t byte_ns = HOST_STORAGE_BYTE_NS;
+    int runs = 5;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:c:b:d:h")) != -1) {
+        switch(opt) {
+        case 'n':
+            runs = MAX(1, atoi(optarg));
+            break;
+        case 'c':
+            call_us = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            byte_ns = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            image_convert_set_dither_mode(atoi(optarg));
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if(optind >= argc) {
+        usage();
+        return 2;
+    }
+    host_storage_set_latency(call_us, byte_ns);
+
+    // The frame cache goes to a scratch card, image paths are used as given
+    char root[] = "/tmp/bench_decode.XXXXXX";
+    if(!mkdtemp(root)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    host_storage_set_root(root);
+
+    printf(
+        "%-32s %7s | %9s %9s %6s %8s %8s | %9s %9s %6s\n",
+        "image",
+        "KB",
+        "decode ms",
+        "SD ms",
+        "calls",
+        "read KB",
+        "heap KB",
+        "cached ms",
+        "SD ms",
+        "calls");
+
+    BenchResult total = {0};
+    BenchResult total_cached = {0};
+    for(int i = optind; i < argc; i++) {
+        const char* path = argv[i];
+        const char* name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+        struct stat st;
+        if(stat(path, &st) != 0) {
+            printf("%-32s missing\n", name);
+            continue;
+        }
+
+        BenchResult decode;
+        BenchResult cached;
+        image_diskcache_set_budget(0);
+        if(!bench_convert(path, runs, &decode)) {
+            printf("%-32s %7.1f | unsupported\n", name, st.st_size / 1024.0);
+            continue;
+        }
+
+        // One conversion fills the cache, the timed ones hit it
+        uint8_t bitmap[IMAGE_FRAME_SIZE];
+        uint16_t width, height;
+        image_diskcache_set_budget(IMAGE_DISKCACHE_DEFAULT_BUDGET);
+        image_convert_to_bitmap(path, bitmap, &width, &height, NULL);
+        bench_convert(path, runs, &cached);
+
+        printf(
+            "%-32s %7.1f | %9.2f %9.1f %6llu %8.1f %8.1f | %9.3f %9.1f %6llu\n",
+            name,
+            st.st_size / 1024.0,
+            decode.cpu_ms,
+            decode.sd_ms,
+            (unsigned long long)decode.storage.calls,
+            decode.storage.read_bytes / 1024.0,
+            decode.peak_heap / 1024.0,
+            cached.cpu_ms,
+            cached.sd_ms,
+            (unsigned long long)cached.storage.calls);
+
+        total.cpu_ms += decode.cpu_ms;
+        total.sd_ms += decode.sd_ms;
+        total.storage.calls += decode.storage.calls;
+        total.storage.read_bytes += decode.storage.read_bytes;
+        total.peak_heap = MAX(total.peak_heap, decode.peak_heap);
+        total_cached.cpu_ms += cached.cpu_ms;
+        total_cached.sd_ms += cached.sd_ms;
+        total_cached.storage.calls += cached.storage.calls;
+    }
+
+    printf(
+        "%-32s %7s | %9.2f %9.1f %6llu %8.1f %8.1f | %9.3f %9.1f %6llu\n",
+        "total (heap: max)",
+        "",
+        total.cpu_ms,
+        total.sd_ms,
+        (unsigned long long)total.storage.calls,
+        total.storage.read_bytes / 1024.0,
+        total.peak_heap / 1024.0,
+        total_cached.cpu_ms,
+        total_cached.sd_ms,
+        (unsigned long long)total_cached.storage.calls);
+
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return 0;
+}
@@ -0,0 +1,84 @@
+// Micro-benchmark for the 1-bit row packers: checks every variant against the
+// bytewise reference, then times a full 64 row frame with each.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pack.h"
+
+#define FRAMES 200000
+
+typedef struct {
+    const char* name;
+    ImagePackRowFn pack;
+    int supported;
+} PackVariant;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(void) {
+    static uint8_t lines[IMAGE_OUT_HEIGHT][IMAGE_OUT_WIDTH];
+    static uint8_t expect[IMAGE_OUT_HEIGHT * IMAGE_OUT_WIDTH / 8];
+    static uint8_t bitmap[IMAGE_OUT_HEIGHT * IMAGE_OUT_WIDTH / 8];
+
+    srand(1);
+    for(int y = 0; y < IMAGE_OUT_HEIGHT; y++) {
+        for(int x = 0; x < IMAGE_OUT_WIDTH; x++) {
+            lines[y][x] = (rand() & 1) ? 255 : 0;
+        }
+        image_pack_row_bytewise(lines[y], expect + y * IMAGE_OUT_WIDTH / 8);
+    }
+
+#if IMAGE_PACK_X86
+    __builtin_cpu_init();
+#endif
+    PackVariant variants[] = {
+        {"bytewise", image_pack_row_bytewise, 1},
+        {"swar", image_pack_row_swar, 1},
+#if IMAGE_PACK_X86
+        {"sse2", image_pack_row_sse2, __builtin_cpu_supports("sse2")},
+        {"avx2", image_pack_row_avx2, __builtin_cpu_supports("avx2")},
+#endif
+        {"dispatch", image_pack_row, 1},
+    };
+
+    int failed = 0;
+    for(size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        const PackVariant* variant = &variants[v];
+        if(!variant->supported) {
+            printf("%-10s unsupported on this CPU\n", variant->name);
+            continue;
+        }
+
+        memset(bitmap, 0xAA, sizeof(bitmap));
+        for(int y = 0; y < IMAGE_OUT_HEIGHT; y++) {
+            variant->pack(lines[y], bitmap + y * IMAGE_OUT_WIDTH / 8);
+        }
+        if(memcmp(bitmap, expect, sizeof(bitmap)) != 0) {
+            printf("%-10s MISMATCH\n", variant->name);
+            failed = 1;
+            continue;
+        }
+
+        double start = now_ns();
+        for(int frame = 0; frame < FRAMES; frame++) {
+            for(int y = 0; y < IMAGE_OUT_HEIGHT; y++) {
+                variant->pack(lines[y], bitmap + y * IMAGE_OUT_WIDTH / 8);
+            }
+            __asm__ volatile("" : : "r"(bitmap) : "memory");
+        }
+        double elapsed = now_ns() - start;
+        printf(
+            "%-10s %8.1f ns/frame %6.2f ns/row\n",
+            variant->name,
+            elapsed / FRAMES,
+            elapsed / FRAMES / IMAGE_OUT_HEIGHT);
+    }
+
+    return failed;
+}
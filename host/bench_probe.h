@@ -0,0 +1,42 @@
+// Measures one section of host benchmark code: wall time, traffic through
+// the storage shim with its modelled card latency, and heap use on top of
+// what was allocated when the section started.
+
+#pragma once
+
+#include <furi.h>
+#include <storage/storage.h>
+#include <time.h>
+
+typedef struct {
+    double start;
+    size_t heap_base;
+} BenchProbe;
+
+typedef struct {
+    double cpu_ms; // Host wall time
+    double sd_ms; // Modelled card time
+    HostStorageStats storage;
+    size_t peak_heap;
+} BenchResult;
+
+static inline double bench_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static inline void bench_probe_start(BenchProbe* probe) {
+    host_storage_reset_stats();
+    host_heap_reset_peak();
+    probe->heap_base = host_heap_get_used();
+    probe->start = bench_now_ms();
+}
+
+static inline void bench_probe_stop(const BenchProbe* probe, BenchResult* result) {
+    result->cpu_ms = bench_now_ms() - probe->start;
+    host_storage_get_stats(&result->storage);
+    result->sd_ms = result->storage.latency_us / 1e3;
+    result->peak_heap = host_heap_get_peak() - probe->heap_base;
+}
+
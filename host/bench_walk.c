@@ -0,0 +1,176 @@
+// Directory benchmark: fills a scratch card with directories of empty image
+// files and reports what browsing them costs through the storage shim:
+// the first step into a directory (listing or index build), the following
+// steps, reopening it later (index reuse) and a recursive scan.
+//
+//     ./bench_walk 100 1000 10000
+
+#define _GNU_SOURCE
+#include <furi.h>
+#include <storage/storage.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bench_probe.h"
+#include "extwalk.h"
+
+#define PATH_SIZE 256
+
+static void usage(void) {
+    fprintf(
+        stderr,
+        "usage: bench_walk [-c call_us] [-b byte_ns] [COUNT...]\n"
+        "  COUNT       images per directory, one run each (default 100 1000 5000)\n"
+        "  -c call_us  modelled card cost per storage call (default %d)\n"
+        "  -b byte_ns  modelled card cost per byte moved (default %d)\n",
+        HOST_STORAGE_CALL_US,
+        HOST_STORAGE_BYTE_NS);
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    UNUSED(st);
+    UNUSED(flag);
+    UNUSED(ftw);
+    return remove(path);
+}
+
+static void print_result(const char* what, const BenchResult* result, uint32_t steps) {
+    steps = MAX(steps, 1U);
+    printf(
+        "  %-22s %9.3f %9.1f %8.1f %8.1f\n",
+        what,
+        result->cpu_ms / steps,
+        result->sd_ms / steps,
+        (double)result->storage.calls / steps,
+        result->peak_heap / 1024.0);
+}
+
+static void found_callback(const char* filename, void* context) {
+    UNUSED(filename);
+    (*(uint32_t*)context)++;
+}
+
+// Directory of `count` images named like a camera roll, plus some files
+// the walk has to skip
+static void make_dir(const char* root, uint32_t count, char* first) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/walk%lu", root, (unsigned long)count);
+    mkdir(path, 0777);
+    for(uint32_t i = 0; i < count + count / 10; i++) {
+        bool image = i < count;
+        snprintf(
+            path,
+            sizeof(path),
+            "%s/walk%lu/%s%lu.%s",
+            root,
+            (unsigned long)count,
+            image ? "IMG_" : "notes",
+            (unsigned long)(i * 7919 % (count + count / 10)),
+            image ? "jpg" : "txt");
+        int fd = open(path, O_CREAT | O_WRONLY, 0666);
+        if(fd >= 0) close(fd);
+    }
+    snprintf(first, PATH_SIZE, "/ext/walk%lu/IMG_%lu.jpg", (unsigned long)count, 0UL);
+}
+
+static void bench_dir(const char* root, uint32_t count) {
+    char current[PATH_SIZE], prev[PATH_SIZE], next[PATH_SIZE];
+    BenchProbe probe;
+    BenchResult result;
+
+    make_dir(root, count, current);
+    printf("%lu images\n", (unsigned long)count);
+
+    bench_probe_start(&probe);
+    extwalk_get_neighbours(current, prev, next, PATH_SIZE);
+    bench_probe_stop(&probe, &result);
+    print_result("open directory", &result, 1);
+
+    // Walk to the end and back, one neighbour lookup per step as the app does
+    uint32_t steps = 0;
+    bench_probe_start(&probe);
+    while(next[0] && steps < 2 * count) {
+        strlcpy(current, next, sizeof(current));
+        extwalk_get_neighbours(current, prev, next, PATH_SIZE);
+        steps++;
+    }
+    bench_probe_stop(&probe, &result);
+    print_result("step forward", &result, steps);
+
+    steps = 0;
+    bench_probe_start(&probe);
+    while(extwalk_get_prev_image(current, prev, PATH_SIZE) && steps < 2 * count) {
+        strlcpy(current, prev, sizeof(current));
+        steps++;
+    }
+    bench_probe_stop(&probe, &result);
+    print_result("step back", &result, steps);
+
+    // Coming back to a directory after the app was closed
+    extwalk_deinit();
+    bench_probe_start(&probe);
+    extwalk_get_neighbours(current, prev, next, PATH_SIZE);
+    bench_probe_stop(&probe, &result);
+    print_result("reopen directory", &result, 1);
+    extwalk_deinit();
+
+    char dir[PATH_SIZE];
+    uint32_t found = 0;
+    snprintf(dir, sizeof(dir), "/ext/walk%lu", (unsigned long)count);
+    Storage* storage = furi_record_open(RECORD_STORAGE);
+    bench_probe_start(&probe);
+    ExtwalkScan* scan = extwalk_scan_alloc(storage, dir);
+    while(extwalk_scan_step(scan, found_callback, &found, 32)) {
+    }
+    extwalk_scan_free(scan);
+    bench_probe_stop(&probe, &result);
+    furi_record_close(RECORD_STORAGE);
+    print_result("recursive scan", &result, 1);
+
+    if(found != count) printf("  scan found %lu images\n", (unsigned long)found);
+}
+
+int main(int argc, char** argv) {
+    uint32_t call_us = HOST_STORAGE_CALL_US;
+    uint32_t byte_ns = HOST_STORAGE_BYTE_NS;
+    int opt;
+
+    while((opt = getopt(argc, argv, "c:b:h")) != -1) {
+        switch(opt) {
+        case 'c':
+            call_us = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            byte_ns = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    host_storage_set_latency(call_us, byte_ns);
+
+    char root[] = "/tmp/bench_walk.XXXXXX";
+    if(!mkdtemp(root)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    host_storage_set_root(root);
+
+    printf("%-24s %9s %9s %8s %8s\n", "per step", "host ms", "SD ms", "calls", "heap KB");
+    if(optind < argc) {
+        for(int i = optind; i < argc; i++) {
+            bench_dir(root, strtoul(argv[i], NULL, 10));
+        }
+    } else {
+        const uint32_t counts[] = {100, 1000, 5000};
+        for(size_t i = 0; i < COUNT_OF(counts); i++) {
+            bench_dir(root, counts[i]);
+        }
+    }
+
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return 0;
+}
@@ -0,0 +1,297 @@
+// Batch converter: runs the app's own decode, scale and dither pipeline over
+// a copy of the SD card on a workstation, so large galleries can be baked in
+// advance instead of converted one at a time on the Flipper.
+//
+// SDROOT stands in for /ext, and the walk and the conversion code are the
+// ones the device runs, so the frames come out bit-identical. Files are
+// spread over per-thread deques in walk order; a thread works its own deque
+// from the front and, once it runs dry, steals from the back of the fullest
+// one. Input files are mmap'd by the storage shim and decoded in place.
+
+#include <furi.h>
+#include <storage/storage.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "convert.h"
+#include "diskcache.h"
+#include "extwalk.h"
+#include "pack.h"
+#include "worker.h"
+
+#define SCAN_BATCH 256
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t head; // Next job of the owner
+    size_t tail; // One past the job a thief takes next
+} JobDeque;
+
+typedef struct {
+    char** paths;
+    size_t count;
+    size_t capacity;
+
+    JobDeque* deques;
+    int threads;
+    const char* out_dir; // Raw frames, mirroring the tree; NULL for none
+    bool bake_cache; // Entries in the app's on-card cache format
+
+    atomic_size_t converted;
+    atomic_size_t unsupported;
+    atomic_size_t failed;
+    atomic_size_t stolen;
+    atomic_size_t baked_bytes;
+} Batch;
+
+typedef struct {
+    Batch* batch;
+    int index;
+} BatchThread;
+
+static void usage(void) {
+    fprintf(
+        stderr,
+        "usage: ivconvert [-j threads] [-d dither] [-o outdir] [-c] [-v] SDROOT [DIR]\n"
+        "\n"
+        "Converts every image under SDROOT/DIR, SDROOT standing in for /ext.\n"
+        "  -j threads  worker threads (default: one per CPU)\n"
+        "  -d dither   dithering mode, 0-%d (default: %d, %s)\n"
+        "  -o outdir   write each frame as outdir/<path>.bin, 1024 bytes in XBM order\n"
+        "  -c          bake entries into SDROOT%s; copy the sources with their\n"
+        "              times preserved (cp -p, rsync -t) so the device accepts them\n"
+        "  -v          log what the decoders log on the device\n",
+        ImageDitherCount - 1,
+        image_convert_get_dither_mode(),
+        image_convert_get_dither_name(image_convert_get_dither_mode()),
+        IMAGE_DISKCACHE_BAKED_DIR + 4);
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void file_found_callback(const char* filename, void* context) {
+    Batch* batch = context;
+    if(batch->count == batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 256;
+        batch->paths = realloc(batch->paths, batch->capacity * sizeof(char*));
+        if(!batch->paths) abort();
+    }
+    size_t size = strlen(filename) + 1;
+    char* path = malloc(size);
+    if(!path) abort();
+    memcpy(path, filename, size);
+    batch->paths[batch->count++] = path;
+}
+
+static bool write_frame(const char* out_dir, const char* path, const uint8_t* bitmap) {
+    // path is /ext/..., mirrored below out_dir
+    char out[PATH_MAX];
+    snprintf(out, sizeof(out), "%s%s.bin", out_dir, path + 4);
+    for(char* p = out + strlen(out_dir) + 1; *p; p++) {
+        if(*p != '/') continue;
+        *p = '\0';
+        if(mkdir(out, 0777) != 0 && errno != EEXIST) return false;
+        *p = '/';
+    }
+
+    FILE* file = fopen(out, "wb");
+    if(!file) return false;
+    bool ok = fwrite(bitmap, 1, IMAGE_FRAME_SIZE, file) == IMAGE_FRAME_SIZE;
+    return fclose(file) == 0 && ok;
+}
+
+static void convert_one(Batch* batch, Storage* storage, const char* path) {
+    uint8_t bitmap[IMAGE_FRAME_SIZE];
+    uint16_t width, height;
+
+    ImageConverterResult result = image_convert_to_bitmap(path, bitmap, &width, &height, NULL);
+    if(result == ImageConverterUnsupported) {
+        atomic_fetch_add(&batch->unsupported, 1);
+        return;
+    }
+
+    bool ok = result == ImageConverterOK;
+    if(ok && batch->out_dir) ok = write_frame(batch->out_dir, path, bitmap);
+    if(ok && batch->bake_cache) {
+        ImageCacheKey key;
+        size_t written = 0;
+        ok = image_cache_key_init(&key, storage, path, image_convert_get_dither_mode()) &&
+             (written = image_diskcache_bake(storage, &key, bitmap)) > 0;
+        atomic_fetch_add(&batch->baked_bytes, written);
+    }
+
+    if(ok) {
+        atomic_fetch_add(&batch->converted, 1);
+    } else {
+        atomic_fetch_add(&batch->failed, 1);
+        fprintf(stderr, "ivconvert: %s failed\n", path);
+    }
+}
+
+// Next job for thread `index`: its own deque first, then the back of the
+// fullest other one. SIZE_MAX once every deque is empty.
+static size_t next_job(Batch* batch, int index) {
+    JobDeque* own = &batch->deques[index];
+    pthread_mutex_lock(&own->lock);
+    size_t job = own->head < own->tail ? own->head++ : SIZE_MAX;
+    pthread_mutex_unlock(&own->lock);
+    if(job != SIZE_MAX) return job;
+
+    while(true) {
+        int victim = -1;
+        size_t most = 0;
+        for(int i = 0; i < batch->threads; i++) {
+            if(i == index) continue;
+            JobDeque* deque = &batch->deques[i];
+            pthread_mutex_lock(&deque->lock);
+            size_t left = deque->tail - deque->head;
+            pthread_mutex_unlock(&deque->lock);
+            if(left > most) {
+                victim = i;
+                most = left;
+            }
+        }
+        if(victim < 0) return SIZE_MAX;
+
+        JobDeque* deque = &batch->deques[victim];
+        pthread_mutex_lock(&deque->lock);
+        if(deque->head < deque->tail) job = --deque->tail;
+        pthread_mutex_unlock(&deque->lock);
+        if(job != SIZE_MAX) {
+            atomic_fetch_add(&batch->stolen, 1);
+            return job;
+        }
+    }
+}
+
+static void* batch_thread(void* context) {
+    BatchThread* thread = context;
+    Batch* batch = thread->batch;
+    Storage* storage = furi_record_open(RECORD_STORAGE);
+
+    for(size_t job; (job = next_job(batch, thread->index)) != SIZE_MAX;) {
+        convert_one(batch, storage, batch->paths[job]);
+    }
+
+    furi_record_close(RECORD_STORAGE);
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    Batch batch = {0};
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while((opt = getopt(argc, argv, "j:d:o:cvh")) != -1) {
+        switch(opt) {
+        case 'j':
+            threads = strtol(optarg, NULL, 10);
+            break;
+        case 'd':
+            image_convert_set_dither_mode(strtol(optarg, NULL, 10));
+            break;
+        case 'o':
+            batch.out_dir = optarg;
+            break;
+        case 'c':
+            batch.bake_cache = true;
+            break;
+        case 'v':
+            host_log_level = HostLogDebug;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if(optind >= argc || argc - optind > 2 || threads < 1 ||
+       (!batch.out_dir && !batch.bake_cache)) {
+        usage();
+        return 2;
+    }
+    batch.threads = threads;
+
+    host_storage_set_root(argv[optind]);
+    char root[PATH_MAX];
+    snprintf(root, sizeof(root), "/ext/%s", optind + 1 < argc ? argv[optind + 1] : "");
+    size_t root_len = strlen(root);
+    while(root_len > 4 && root[root_len - 1] == '/') root[--root_len] = '\0';
+
+    // The tool writes cache entries itself; the device side cache stays off
+    uint32_t budget = image_diskcache_get_budget();
+    image_diskcache_set_budget(0);
+    host_storage_set_zero_copy(true);
+    if(batch.out_dir) mkdir(batch.out_dir, 0777);
+
+    // Resolve the row packer before the threads race to do it
+    uint8_t line[IMAGE_OUT_WIDTH] = {0};
+    uint8_t packed[IMAGE_OUT_WIDTH / 8];
+    image_pack_row(line, packed);
+
+    double start = now_s();
+    Storage* storage = furi_record_open(RECORD_STORAGE);
+    ExtwalkScan* scan = extwalk_scan_alloc(storage, root);
+    while(extwalk_scan_step(scan, file_found_callback, &batch, SCAN_BATCH)) {
+    }
+    extwalk_scan_free(scan);
+    double walked = now_s();
+
+    batch.deques = calloc(batch.threads, sizeof(JobDeque));
+    BatchThread* contexts = calloc(batch.threads, sizeof(BatchThread));
+    pthread_t* handles = calloc(batch.threads, sizeof(pthread_t));
+    for(int i = 0; i < batch.threads; i++) {
+        pthread_mutex_init(&batch.deques[i].lock, NULL);
+        batch.deques[i].head = batch.count * i / batch.threads;
+        batch.deques[i].tail = batch.count * (i + 1) / batch.threads;
+        contexts[i] = (BatchThread){.batch = &batch, .index = i};
+    }
+    for(int i = 0; i < batch.threads; i++) {
+        pthread_create(&handles[i], NULL, batch_thread, &contexts[i]);
+    }
+    for(int i = 0; i < batch.threads; i++) {
+        pthread_join(handles[i], NULL);
+    }
+    double done = now_s();
+
+    printf(
+        "%zu images in %.2f s (walk %.2f s, %.1f images/s, %d threads, %zu stolen): "
+        "%zu converted, %zu unsupported, %zu failed\n",
+        batch.count,
+        done - start,
+        walked - start,
+        batch.count / MAX(done - walked, 1e-9),
+        batch.threads,
+        (size_t)batch.stolen,
+        (size_t)batch.converted,
+        (size_t)batch.unsupported,
+        (size_t)batch.failed);
+    // Baked entries are kept apart from the budget, so nothing reclaims them
+    if(batch.baked_bytes > budget) {
+        fprintf(
+            stderr,
+            "ivconvert: warning: baked %zu KB, over the device's %lu KB cache budget; "
+            "baked entries are never evicted, delete SDROOT%s to free the space\n",
+            (size_t)batch.baked_bytes / 1024,
+            (unsigned long)budget / 1024,
+            IMAGE_DISKCACHE_BAKED_DIR + 4);
+    }
+
+    for(size_t i = 0; i < batch.count; i++) {
+        free(batch.paths[i]);
+    }
+    free(batch.paths);
+    free(handles);
+    free(contexts);
+    free(batch.deques);
+    furi_record_close(RECORD_STORAGE);
+
+    return batch.failed ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""Generate the benchmark corpus: one synthetic photo per size, saved in
+every format and pixel layout the decoders handle. Needs Pillow.
+
+usage: mkcorpus.py OUTDIR
+"""
+
+import os
+import random
+import sys
+
+from PIL import Image, ImageDraw, ImageFilter
+
+SIZES = [(128, 64), (320, 240), (1024, 768), (1920, 1080)]
+
+# name -> (extension, mode, save options)
+FORMATS = {
+    "bmp_1bit": ("bmp", "1", {}),
+    "bmp_8bit": ("bmp", "P", {}),
+    "bmp_24bit": ("bmp", "RGB", {}),
+    "png_gray": ("png", "L", {}),
+    "png_palette": ("png", "P", {}),
+    "png_rgb": ("png", "RGB", {}),
+    "png_rgba": ("png", "RGBA", {}),
+    "jpg_gray": ("jpg", "L", {"quality": 85}),
+    "jpg_420": ("jpg", "RGB", {"quality": 85, "subsampling": 2}),
+    "jpg_444": ("jpg", "RGB", {"quality": 85, "subsampling": 0}),
+    "jpg_progressive": ("jpg", "RGB", {"quality": 85, "progressive": True}),
+    "gif": ("gif", "P", {"interlace": False}),
+    "gif_interlaced": ("gif", "P", {"interlace": True}),
+}
+
+
+def photo(width, height):
+    """Soft shapes over a gradient with a little grain, so the files
+    compress roughly like real pictures."""
+    rng = random.Random(width * 7919 + height)
+    image = Image.linear_gradient("L").resize((width, height)).convert("RGB")
+    draw = ImageDraw.Draw(image)
+    for _ in range(24):
+        x, y = rng.randrange(width), rng.randrange(height)
+        r = rng.randrange(max(width, height) // 16 + 1, max(width, height) // 4 + 2)
+        colour = tuple(rng.randrange(256) for _ in range(3))
+        draw.ellipse((x - r, y - r, x + r, y + r), fill=colour)
+    image = image.filter(ImageFilter.GaussianBlur(max(1, width // 200)))
+    grain = Image.effect_noise((width, height), 12).convert("RGB")
+    return Image.blend(image, grain, 0.08)
+
+
+def convert(image, mode):
+    if mode == "P":
+        return image.convert("P", palette=Image.Palette.ADAPTIVE, colors=256)
+    if mode == "RGBA":
+        alpha = Image.linear_gradient("L").rotate(90).resize(image.size)
+        rgba = image.convert("RGBA")
+        rgba.putalpha(alpha)
+        return rgba
+    return image.convert(mode)
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    out = sys.argv[1]
+    os.makedirs(out, exist_ok=True)
+    for width, height in SIZES:
+        image = photo(width, height)
+        for name, (ext, mode, options) in FORMATS.items():
+            path = os.path.join(out, f"{name}_{width}x{height}.{ext}")
+            convert(image, mode).save(path, **options)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,132 @@
+// Host stand-in for the subset of the Furi core API used by the converter
+// sources. Only what src/ needs is declared here.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNUSED(x) (void)(x)
+#define COUNT_OF(x) (sizeof(x) / sizeof(x[0]))
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#define CLAMP(x, upper, lower) (MIN(upper, MAX(x, lower)))
+#define FURI_ALWAYS_INLINE inline __attribute__((always_inline))
+#define FURI_PACKED __attribute__((packed))
+
+#define furi_assert(x) ((void)0)
+#define furi_check(x)     \
+    do {                  \
+        if(!(x)) abort(); \
+    } while(0)
+
+// Logging goes to stderr, filtered by host_log_level (default: warnings)
+typedef enum {
+    HostLogError,
+    HostLogWarn,
+    HostLogInfo,
+    HostLogDebug,
+} HostLogLevel;
+
+extern HostLogLevel host_log_level;
+
+#define HOST_LOG(level, letter, tag, fmt, ...)                                 \
+    do {                                                                       \
+        if(host_log_level >= (level))                                          \
+            fprintf(stderr, "[" letter "][%s] " fmt "\n", tag, ##__VA_ARGS__); \
+    } while(0)
+
+#define FURI_LOG_E(tag, fmt, ...) HOST_LOG(HostLogError, "E", tag, fmt, ##__VA_ARGS__)
+#define FURI_LOG_W(tag, fmt, ...) HOST_LOG(HostLogWarn, "W", tag, fmt, ##__VA_ARGS__)
+#define FURI_LOG_I(tag, fmt, ...) HOST_LOG(HostLogInfo, "I", tag, fmt, ##__VA_ARGS__)
+#define FURI_LOG_D(tag, fmt, ...) HOST_LOG(HostLogDebug, "D", tag, fmt, ##__VA_ARGS__)
+#define FURI_LOG_T(tag, fmt, ...) ((void)0)
+
+#define RECORD_STORAGE "storage"
+
+void* furi_record_open(const char* name);
+void furi_record_close(const char* name);
+
+uint32_t furi_get_tick(void);
+void furi_delay_ms(uint32_t ms);
+
+// Reports a fixed figure typical of the app running on a Flipper, so heap
+// dependent decisions (PNG window size, cache budgets) match the device
+size_t memmgr_get_free_heap(void);
+
+typedef enum {
+    FuriStatusOk = 0,
+    FuriStatusError = -1,
+} FuriStatus;
+
+#define FuriWaitForever 0xFFFFFFFFU
+
+typedef enum {
+    FuriMutexTypeNormal,
+    FuriMutexTypeRecursive,
+} FuriMutexType;
+
+typedef struct FuriMutex FuriMutex;
+
+FuriMutex* furi_mutex_alloc(FuriMutexType type);
+void furi_mutex_free(FuriMutex* mutex);
+FuriStatus furi_mutex_acquire(FuriMutex* mutex, uint32_t timeout);
+FuriStatus furi_mutex_release(FuriMutex* mutex);
+
+// Threads are identified by their pthread; none of them has a name
+typedef void* FuriThreadId;
+
+FuriThreadId furi_thread_get_current_id(void);
+const char* furi_thread_get_name(FuriThreadId thread_id);
+
+// Threads run on pthreads; the stack size is left to the C library
+typedef int32_t (*FuriThreadCallback)(void* context);
+typedef struct FuriThread FuriThread;
+
+FuriThread* furi_thread_alloc_ex(
+    const char* name,
+    uint32_t stack_size,
+    FuriThreadCallback callback,
+    void* context);
+void furi_thread_free(FuriThread* thread);
+void furi_thread_start(FuriThread* thread);
+bool furi_thread_join(FuriThread* thread);
+
+typedef struct FuriSemaphore FuriSemaphore;
+
+FuriSemaphore* furi_semaphore_alloc(uint32_t max_count, uint32_t initial_count);
+void furi_semaphore_free(FuriSemaphore* semaphore);
+FuriStatus furi_semaphore_acquire(FuriSemaphore* semaphore, uint32_t timeout);
+FuriStatus furi_semaphore_release(FuriSemaphore* semaphore);
+
+// Heap use of every file built against this header is tracked, so the
+// benchmarks can report peak heap like the Flipper's allocator would see it.
+// Blocks from the C library (strdup, getline) must not be freed through it.
+void* host_malloc(size_t size);
+void* host_calloc(size_t count, size_t size);
+void* host_realloc(void* ptr, size_t size);
+void host_free(void* ptr);
+
+// Bytes allocated now, and the most allocated since the last reset
+size_t host_heap_get_used(void);
+size_t host_heap_get_peak(void);
+void host_heap_reset_peak(void);
+
+#ifndef HOST_SHIM_INTERNAL
+#define malloc(size)         host_malloc(size)
+#define calloc(count, size)  host_calloc(count, size)
+#define realloc(ptr, size)   host_realloc(ptr, size)
+#define free(ptr)            host_free(ptr)
+#endif
+
+// newlib has strlcpy, glibc only from 2.38
+size_t host_strlcpy(char* dst, const char* src, size_t size);
+#define strlcpy host_strlcpy
@@ -0,0 +1,14 @@
+// Host stand-in for the cycle counter; ticks at the Flipper's 64 MHz so
+// logged cycle counts convert to the same units
+
+#pragma once
+
+#include <furi.h>
+
+typedef struct {
+    uint32_t start;
+    uint32_t value;
+} FuriHalCortexTimer;
+
+FuriHalCortexTimer furi_hal_cortex_timer_get(uint32_t timeout_us);
+uint32_t furi_hal_cortex_instructions_per_microsecond(void);
@@ -0,0 +1,566 @@
+#define _GNU_SOURCE
+#define HOST_SHIM_INTERNAL
+#include <furi.h>
+#include <furi_hal.h>
+#include <storage/storage.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HOST_FREE_HEAP (96 * 1024)
+
+HostLogLevel host_log_level = HostLogWarn;
+
+void* furi_record_open(const char* name) {
+    UNUSED(name);
+    // Storage is stateless here; any non-NULL handle will do
+    return (void*)1;
+}
+
+void furi_record_close(const char* name) {
+    UNUSED(name);
+}
+
+uint32_t furi_get_tick(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void furi_delay_ms(uint32_t ms) {
+    usleep(ms * 1000);
+}
+
+size_t memmgr_get_free_heap(void) {
+    return HOST_FREE_HEAP;
+}
+
+FuriHalCortexTimer furi_hal_cortex_timer_get(uint32_t timeout_us) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    FuriHalCortexTimer timer = {
+        .start = (uint32_t)(ts.tv_sec * 64000000ULL + ts.tv_nsec * 64 / 1000),
+        .value = timeout_us * 64,
+    };
+    return timer;
+}
+
+uint32_t furi_hal_cortex_instructions_per_microsecond(void) {
+    return 64;
+}
+
+struct FuriMutex {
+    pthread_mutex_t mutex;
+};
+
+FuriMutex* furi_mutex_alloc(FuriMutexType type) {
+    FuriMutex* mutex = malloc(sizeof(FuriMutex));
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    if(type == FuriMutexTypeRecursive) {
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    }
+    pthread_mutex_init(&mutex->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return mutex;
+}
+
+void furi_mutex_free(FuriMutex* mutex) {
+    pthread_mutex_destroy(&mutex->mutex);
+    free(mutex);
+}
+
+FuriStatus furi_mutex_acquire(FuriMutex* mutex, uint32_t timeout) {
+    UNUSED(timeout);
+    pthread_mutex_lock(&mutex->mutex);
+    return FuriStatusOk;
+}
+
+FuriStatus furi_mutex_release(FuriMutex* mutex) {
+    pthread_mutex_unlock(&mutex->mutex);
+    return FuriStatusOk;
+}
+
+FuriThreadId furi_thread_get_current_id(void) {
+    return (FuriThreadId)pthread_self();
+}
+
+const char* furi_thread_get_name(FuriThreadId thread_id) {
+    UNUSED(thread_id);
+    return NULL;
+}
+
+struct FuriThread {
+    pthread_t handle;
+    FuriThreadCallback callback;
+    void* context;
+};
+
+static void* furi_thread_body(void* context) {
+    FuriThread* thread = context;
+    thread->callback(thread->context);
+    return NULL;
+}
+
+FuriThread* furi_thread_alloc_ex(
+    const char* name,
+    uint32_t stack_size,
+    FuriThreadCallback callback,
+    void* context) {
+    UNUSED(name);
+    UNUSED(stack_size);
+    FuriThread* thread = malloc(sizeof(FuriThread));
+    thread->callback = callback;
+    thread->context = context;
+    return thread;
+}
+
+void furi_thread_free(FuriThread* thread) {
+    free(thread);
+}
+
+void furi_thread_start(FuriThread* thread) {
+    furi_check(pthread_create(&thread->handle, NULL, furi_thread_body, thread) == 0);
+}
+
+bool furi_thread_join(FuriThread* thread) {
+    return pthread_join(thread->handle, NULL) == 0;
+}
+
+// Counting semaphore on a mutex and condition variable; only waiting
+// forever is supported
+struct FuriSemaphore {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t count;
+    uint32_t max_count;
+};
+
+FuriSemaphore* furi_semaphore_alloc(uint32_t max_count, uint32_t initial_count) {
+    FuriSemaphore* semaphore = malloc(sizeof(FuriSemaphore));
+    pthread_mutex_init(&semaphore->mutex, NULL);
+    pthread_cond_init(&semaphore->cond, NULL);
+    semaphore->count = initial_count;
+    semaphore->max_count = max_count;
+    return semaphore;
+}
+
+void furi_semaphore_free(FuriSemaphore* semaphore) {
+    pthread_cond_destroy(&semaphore->cond);
+    pthread_mutex_destroy(&semaphore->mutex);
+    free(semaphore);
+}
+
+FuriStatus furi_semaphore_acquire(FuriSemaphore* semaphore, uint32_t timeout) {
+    UNUSED(timeout);
+    pthread_mutex_lock(&semaphore->mutex);
+    while(!semaphore->count) pthread_cond_wait(&semaphore->cond, &semaphore->mutex);
+    semaphore->count--;
+    pthread_mutex_unlock(&semaphore->mutex);
+    return FuriStatusOk;
+}
+
+FuriStatus furi_semaphore_release(FuriSemaphore* semaphore) {
+    FuriStatus status = FuriStatusError;
+    pthread_mutex_lock(&semaphore->mutex);
+    if(semaphore->count < semaphore->max_count) {
+        semaphore->count++;
+        status = FuriStatusOk;
+        pthread_cond_signal(&semaphore->cond);
+    }
+    pthread_mutex_unlock(&semaphore->mutex);
+    return status;
+}
+
+// Blocks carry their size in a header kept 16 byte aligned
+typedef struct {
+    size_t size;
+    size_t pad;
+} HostBlock;
+
+static size_t heap_used;
+static size_t heap_peak;
+
+static void heap_account(ptrdiff_t delta) {
+    size_t used = __atomic_add_fetch(&heap_used, delta, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+    while(used > peak &&
+          !__atomic_compare_exchange_n(
+              &heap_peak, &peak, used, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void* host_malloc(size_t size) {
+    HostBlock* block = malloc(sizeof(HostBlock) + size);
+    if(!block) return NULL;
+    block->size = size;
+    heap_account(size);
+    return block + 1;
+}
+
+void* host_calloc(size_t count, size_t size) {
+    if(size && count > SIZE_MAX / size) return NULL;
+    void* ptr = host_malloc(count * size);
+    if(ptr) memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void* host_realloc(void* ptr, size_t size) {
+    if(!ptr) return host_malloc(size);
+    HostBlock* block = (HostBlock*)ptr - 1;
+    size_t old = block->size;
+    block = realloc(block, sizeof(HostBlock) + size);
+    if(!block) return NULL;
+    block->size = size;
+    heap_account((ptrdiff_t)size - (ptrdiff_t)old);
+    return block + 1;
+}
+
+void host_free(void* ptr) {
+    if(!ptr) return;
+    HostBlock* block = (HostBlock*)ptr - 1;
+    heap_account(-(ptrdiff_t)block->size);
+    free(block);
+}
+
+size_t host_heap_get_used(void) {
+    return __atomic_load_n(&heap_used, __ATOMIC_RELAXED);
+}
+
+size_t host_heap_get_peak(void) {
+    return __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+}
+
+void host_heap_reset_peak(void) {
+    __atomic_store_n(&heap_peak, host_heap_get_used(), __ATOMIC_RELAXED);
+}
+
+size_t host_strlcpy(char* dst, const char* src, size_t size) {
+    size_t length = strlen(src);
+    if(size) {
+        size_t copy = MIN(length, size - 1);
+        memcpy(dst, src, copy);
+        dst[copy] = '\0';
+    }
+    return length;
+}
+
+static char storage_root[PATH_MAX] = ".";
+
+struct File {
+    // Read only files: the whole file mapped, or NULL when empty
+    const uint8_t* map;
+    size_t size;
+    size_t position;
+    bool mapped;
+    // Writable files
+    FILE* stream;
+    DIR* dir;
+    char path[PATH_MAX];
+};
+
+static HostStorageStats storage_stats;
+static uint32_t storage_call_us = HOST_STORAGE_CALL_US;
+static uint32_t storage_byte_ns = HOST_STORAGE_BYTE_NS;
+static bool storage_zero_copy;
+
+#define STORAGE_COUNT(field, value) \
+    __atomic_fetch_add(&storage_stats.field, (uint64_t)(value), __ATOMIC_RELAXED)
+
+static void storage_count_call(void) {
+    STORAGE_COUNT(calls, 1);
+    STORAGE_COUNT(latency_us, storage_call_us);
+}
+
+static void storage_count_bytes(size_t bytes) {
+    STORAGE_COUNT(latency_us, (uint64_t)bytes * storage_byte_ns / 1000);
+}
+
+void host_storage_set_latency(uint32_t call_us, uint32_t byte_ns) {
+    storage_call_us = call_us;
+    storage_byte_ns = byte_ns;
+}
+
+void host_storage_get_stats(HostStorageStats* stats) {
+    uint64_t* out = (uint64_t*)stats;
+    uint64_t* in = (uint64_t*)&storage_stats;
+    for(size_t i = 0; i < sizeof(HostStorageStats) / sizeof(uint64_t); i++) {
+        out[i] = __atomic_load_n(&in[i], __ATOMIC_RELAXED);
+    }
+}
+
+void host_storage_reset_stats(void) {
+    uint64_t* fields = (uint64_t*)&storage_stats;
+    for(size_t i = 0; i < sizeof(HostStorageStats) / sizeof(uint64_t); i++) {
+        __atomic_store_n(&fields[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+void host_storage_set_zero_copy(bool zero_copy) {
+    storage_zero_copy = zero_copy;
+}
+
+void host_storage_set_root(const char* root) {
+    strlcpy(storage_root, root, sizeof(storage_root));
+}
+
+void host_storage_map(const char* path, char* out, size_t size) {
+    if(strncmp(path, "/ext", 4) == 0 && (path[4] == '/' || path[4] == '\0')) {
+        snprintf(out, size, "%s%s", storage_root, path + 4);
+    } else {
+        strlcpy(out, path, size);
+    }
+}
+
+File* storage_file_alloc(Storage* storage) {
+    UNUSED(storage);
+    File* file = malloc(sizeof(File));
+    memset(file, 0, sizeof(File));
+    return file;
+}
+
+void storage_file_free(File* file) {
+    storage_file_close(file);
+    storage_dir_close(file);
+    free(file);
+}
+
+static bool storage_file_map(File* file) {
+    int fd = open(file->path, O_RDONLY);
+    if(fd < 0) return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    file->size = st.st_size;
+    file->position = 0;
+    file->map = NULL;
+    if(file->size) {
+        void* map = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        // Decoders stream front to back
+        madvise(map, file->size, MADV_SEQUENTIAL);
+        file->map = map;
+    }
+    close(fd);
+    file->mapped = true;
+    return true;
+}
+
+bool storage_file_open(
+    File* file,
+    const char* path,
+    FS_AccessMode access_mode,
+    FS_OpenMode open_mode) {
+    storage_count_call();
+    STORAGE_COUNT(opens, 1);
+    host_storage_map(path, file->path, sizeof(file->path));
+    if(access_mode == FSAM_READ) return storage_file_map(file);
+
+    const char* mode = "r+b";
+    if(open_mode & FSOM_CREATE_ALWAYS) {
+        mode = access_mode & FSAM_READ ? "w+b" : "wb";
+    } else if(open_mode & FSOM_OPEN_APPEND) {
+        mode = "ab";
+    } else if(open_mode & (FSOM_OPEN_ALWAYS | FSOM_CREATE_NEW)) {
+        FILE* touch = fopen(file->path, "ab");
+        if(touch) fclose(touch);
+    }
+    file->stream = fopen(file->path, mode);
+    return file->stream != NULL;
+}
+
+bool storage_file_close(File* file) {
+    if(storage_file_is_open(file)) storage_count_call();
+    if(file->mapped && file->map) munmap((void*)file->map, file->size);
+    file->mapped = false;
+    file->map = NULL;
+    if(file->stream) fclose(file->stream);
+    file->stream = NULL;
+    return true;
+}
+
+const uint8_t* host_storage_file_peek(File* file, size_t* size) {
+    if(!storage_zero_copy || !file->mapped || !file->map) return NULL;
+    *size = file->size;
+    return file->map;
+}
+
+bool storage_file_is_open(File* file) {
+    return file->mapped || file->stream;
+}
+
+size_t storage_file_read(File* file, void* buff, size_t bytes_to_read) {
+    storage_count_call();
+    STORAGE_COUNT(reads, 1);
+
+    size_t count = 0;
+    if(file->stream) {
+        count = fread(buff, 1, bytes_to_read, file->stream);
+    } else if(file->mapped) {
+        count = MIN(bytes_to_read, file->size - file->position);
+        memcpy(buff, file->map + file->position, count);
+        file->position += count;
+    }
+    STORAGE_COUNT(read_bytes, count);
+    storage_count_bytes(count);
+    return count;
+}
+
+size_t storage_file_write(File* file, const void* buff, size_t bytes_to_write) {
+    storage_count_call();
+    STORAGE_COUNT(writes, 1);
+
+    size_t count = file->stream ? fwrite(buff, 1, bytes_to_write, file->stream) : 0;
+    STORAGE_COUNT(write_bytes, count);
+    storage_count_bytes(count);
+    return count;
+}
+
+bool storage_file_seek(File* file, uint32_t offset, bool from_start) {
+    storage_count_call();
+    STORAGE_COUNT(seeks, 1);
+    if(file->stream) return fseek(file->stream, offset, from_start ? SEEK_SET : SEEK_CUR) == 0;
+    if(!file->mapped) return false;
+    // Like the SD driver, seeking past the end stops at the end
+    size_t target = from_start ? offset : file->position + offset;
+    file->position = MIN(target, file->size);
+    return target <= file->size;
+}
+
+uint64_t storage_file_tell(File* file) {
+    storage_count_call();
+    return file->stream ? (uint64_t)ftell(file->stream) : file->position;
+}
+
+uint64_t storage_file_size(File* file) {
+    storage_count_call();
+    if(!file->stream) return file->size;
+    struct stat st;
+    fflush(file->stream);
+    return fstat(fileno(file->stream), &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+bool storage_file_eof(File* file) {
+    storage_count_call();
+    return file->stream ? feof(file->stream) != 0 : file->position >= file->size;
+}
+
+bool storage_file_truncate(File* file) {
+    storage_count_call();
+    if(!file->stream) return false;
+    fflush(file->stream);
+    return ftruncate(fileno(file->stream), ftell(file->stream)) == 0;
+}
+
+bool storage_dir_open(File* file, const char* path) {
+    storage_count_call();
+    STORAGE_COUNT(opens, 1);
+    host_storage_map(path, file->path, sizeof(file->path));
+    file->dir = opendir(file->path);
+    return file->dir != NULL;
+}
+
+bool storage_dir_close(File* file) {
+    if(file->dir) closedir(file->dir);
+    file->dir = NULL;
+    return true;
+}
+
+bool storage_dir_read(File* file, FileInfo* fileinfo, char* name, uint16_t name_length) {
+    storage_count_call();
+    STORAGE_COUNT(dir_reads, 1);
+    if(!file->dir) return false;
+
+    struct dirent* entry;
+    do {
+        entry = readdir(file->dir);
+    } while(entry && (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0));
+    if(!entry) return false;
+
+    if(name) strlcpy(name, entry->d_name, name_length);
+    if(fileinfo) {
+        char path[PATH_MAX];
+        struct stat st;
+        memset(fileinfo, 0, sizeof(FileInfo));
+        if(snprintf(path, sizeof(path), "%s/%s", file->path, entry->d_name) < (int)sizeof(path) &&
+           stat(path, &st) == 0) {
+            fileinfo->flags = S_ISDIR(st.st_mode) ? FSF_DIRECTORY : 0;
+            fileinfo->size = st.st_size;
+        }
+    }
+    return true;
+}
+
+FS_Error storage_common_stat(Storage* storage, const char* path, FileInfo* fileinfo) {
+    UNUSED(storage);
+    storage_count_call();
+    char host_path[PATH_MAX];
+    struct stat st;
+    host_storage_map(path, host_path, sizeof(host_path));
+    if(stat(host_path, &st) != 0) return FSE_NOT_EXIST;
+    if(fileinfo) {
+        fileinfo->flags = S_ISDIR(st.st_mode) ? FSF_DIRECTORY : 0;
+        fileinfo->size = st.st_size;
+    }
+    return FSE_OK;
+}
+
+// FAT keeps local time at two second resolution and the Flipper reads it back
+// as if it were UTC. Reporting the same value lets a cache baked here match
+// once the files are copied with their times preserved (cp -p, rsync -t).
+FS_Error storage_common_timestamp(Storage* storage, const char* path, uint32_t* timestamp) {
+    UNUSED(storage);
+    storage_count_call();
+    char host_path[PATH_MAX];
+    struct stat st;
+    struct tm local;
+    host_storage_map(path, host_path, sizeof(host_path));
+    if(stat(host_path, &st) != 0) return FSE_NOT_EXIST;
+    localtime_r(&st.st_mtime, &local);
+    *timestamp = (uint32_t)timegm(&local) & ~1U;
+    return FSE_OK;
+}
+
+FS_Error storage_common_remove(Storage* storage, const char* path) {
+    UNUSED(storage);
+    storage_count_call();
+    char host_path[PATH_MAX];
+    host_storage_map(path, host_path, sizeof(host_path));
+    if(remove(host_path) == 0) return FSE_OK;
+    return errno == ENOENT ? FSE_NOT_EXIST : FSE_DENIED;
+}
+
+FS_Error storage_common_rename(Storage* storage, const char* old_path, const char* new_path) {
+    UNUSED(storage);
+    storage_count_call();
+    char from[PATH_MAX], to[PATH_MAX];
+    host_storage_map(old_path, from, sizeof(from));
+    host_storage_map(new_path, to, sizeof(to));
+    return rename(from, to) == 0 ? FSE_OK : FSE_INTERNAL;
+}
+
+bool storage_simply_mkdir(Storage* storage, const char* path) {
+    UNUSED(storage);
+    storage_count_call();
+    char host_path[PATH_MAX];
+    host_storage_map(path, host_path, sizeof(host_path));
+    for(char* p = host_path + 1; *p; p++) {
+        if(*p != '/') continue;
+        *p = '\0';
+        mkdir(host_path, 0777);
+        *p = '/';
+    }
+    return mkdir(host_path, 0777) == 0 || errno == EEXIST;
+}
@@ -0,0 +1,120 @@
+// Host stand-in for the Flipper storage API. Paths under /ext are mapped to
+// a directory set with host_storage_set_root, other paths are used as is.
+// Files opened read only are mmap'd and reads copy straight out of the
+// mapping, or with zero copy on are decoded from it in place; files opened
+// for writing go through stdio. Every call is counted
+// and charged against a simple card latency model.
+
+#pragma once
+
+#include <furi.h>
+
+typedef struct Storage Storage;
+typedef struct File File;
+
+typedef enum {
+    FSAM_READ = (1 << 0),
+    FSAM_WRITE = (1 << 1),
+    FSAM_READ_WRITE = FSAM_READ | FSAM_WRITE,
+} FS_AccessMode;
+
+typedef enum {
+    FSOM_OPEN_EXISTING = 1,
+    FSOM_OPEN_ALWAYS = 2,
+    FSOM_OPEN_APPEND = 4,
+    FSOM_CREATE_NEW = 8,
+    FSOM_CREATE_ALWAYS = 16,
+} FS_OpenMode;
+
+typedef enum {
+    FSE_OK,
+    FSE_NOT_READY,
+    FSE_EXIST,
+    FSE_NOT_EXIST,
+    FSE_INVALID_PARAMETER,
+    FSE_DENIED,
+    FSE_INVALID_NAME,
+    FSE_INTERNAL,
+    FSE_NOT_IMPLEMENTED,
+    FSE_ALREADY_OPEN,
+} FS_Error;
+
+typedef enum {
+    FSF_DIRECTORY = (1 << 0),
+} FS_Flags;
+
+typedef struct {
+    uint8_t flags;
+    uint64_t size;
+} FileInfo;
+
+static inline bool file_info_is_dir(const FileInfo* fileinfo) {
+    return fileinfo->flags & FSF_DIRECTORY;
+}
+
+#define EXT_PATH(path)      "/ext/" path
+#define APP_DATA_PATH(path) "/ext/apps_data/imageviewer/" path
+
+// Directory standing in for the SD card root
+void host_storage_set_root(const char* root);
+
+// Traffic through the storage API since the last reset
+typedef struct {
+    uint64_t calls; // Every storage_* call
+    uint64_t opens;
+    uint64_t reads;
+    uint64_t read_bytes;
+    uint64_t writes;
+    uint64_t write_bytes;
+    uint64_t seeks;
+    uint64_t dir_reads;
+    uint64_t latency_us; // Time the calls would have taken on the modelled card
+} HostStorageStats;
+
+// Latency model of the simulated card: a fixed cost per call plus a cost per
+// byte moved. Nothing sleeps; the modelled time is only reported, so runs
+// stay fast and repeatable. Defaults are rough figures for the Flipper's
+// SD card on SPI.
+#define HOST_STORAGE_CALL_US 150
+#define HOST_STORAGE_BYTE_NS 600
+
+void host_storage_set_latency(uint32_t call_us, uint32_t byte_ns);
+void host_storage_get_stats(HostStorageStats* stats);
+void host_storage_reset_stats(void);
+
+// Map a Flipper path to a host path
+void host_storage_map(const char* path, char* out, size_t size);
+
+// With zero copy on, ImageReader takes the whole mapping of a file opened
+// read only as its buffer instead of reading it in blocks, and those bytes
+// are neither counted nor charged. Off by default so the benchmarks model
+// the card; set before any thread opens files.
+#define HOST_STORAGE_ZERO_COPY
+void host_storage_set_zero_copy(bool zero_copy);
+
+// The mapping of a file opened read only and its size; NULL if zero copy is
+// off or the file is empty
+const uint8_t* host_storage_file_peek(File* file, size_t* size);
+
+File* storage_file_alloc(Storage* storage);
+void storage_file_free(File* file);
+bool storage_file_open(File* file, const char* path, FS_AccessMode access_mode, FS_OpenMode open_mode);
+bool storage_file_close(File* file);
+bool storage_file_is_open(File* file);
+size_t storage_file_read(File* file, void* buff, size_t bytes_to_read);
+size_t storage_file_write(File* file, const void* buff, size_t bytes_to_write);
+bool storage_file_seek(File* file, uint32_t offset, bool from_start);
+uint64_t storage_file_tell(File* file);
+uint64_t storage_file_size(File* file);
+bool storage_file_eof(File* file);
+bool storage_file_truncate(File* file);
+
+bool storage_dir_open(File* file, const char* path);
+bool storage_dir_close(File* file);
+bool storage_dir_read(File* file, FileInfo* fileinfo, char* name, uint16_t name_length);
+
+FS_Error storage_common_stat(Storage* storage, const char* path, FileInfo* fileinfo);
+FS_Error storage_common_timestamp(Storage* storage, const char* path, uint32_t* timestamp);
+FS_Error storage_common_remove(Storage* storage, const char* path);
+FS_Error storage_common_rename(Storage* storage, const char* old_path, const char* new_path);
+bool storage_simply_mkdir(Storage* storage, const char* path);
@@ -2,29 +2,70 @@
 #include <furi_hal.h>
 #include <gui/gui.h>
 #include <gui/view.h>
-#include <gui/view_port.h>
-#include <gui/modules/dialog_ex.h>
-#include <input/input.h>
+#include <gui/view_dispatcher.h>
 #include <storage/storage.h>
 #include "src/gui.h"
 #include "src/extwalk.h"
-#include "src/gui_helper.h"
+#include "src/trace.h"
 
-// Event flags for button input
-#define EVENT_MASK_BUTTONS (1U << 0U)
+// The only view
+#define VIEW_IMAGE 0
 
-// Event types
+// Custom events of the view dispatcher
 typedef enum {
-    EventTypeKey,
-    EventTypeBack
+    EventScan, // Walk the next batch of the card
 } EventType;
 
-// Main input queue
-static FuriMessageQueue* event_queue;
+// Directory entries the background scan reads per event, so input queued
+// meanwhile waits for at most one batch
+#define SCAN_BATCH 32
 
-static void file_selected_callback(const char* filename, void* context) {
-    ImageViewer* app = context;
-    image_viewer_set_file(app, filename);
+typedef struct {
+    ImageViewer* app;
+    ViewDispatcher* view_dispatcher;
+    ExtwalkScan* scan;
+} ScanContext;
+
+static void file_found_callback(const char* path, void* context) {
+    ScanContext* scan_context = context;
+
+    // Only the first image is decoded; the scan indexes the rest
+    if(!scan_context->app->current_file[0]) {
+        image_viewer_set_file(scan_context->app, path);
+    }
+}
+
+static void scan_finish(ScanContext* scan_context) {
+    if(scan_context->scan) {
+        extwalk_scan_free(scan_context->scan);
+        scan_context->scan = NULL;
+    }
+}
+
+// Each batch re-posts the event, so the scan runs whenever the event loop
+// has nothing else to do
+static bool custom_event_callback(void* context, uint32_t event) {
+    ScanContext* scan_context = context;
+    if(event != EventScan || !scan_context->scan) return false;
+
+    if(extwalk_scan_step(scan_context->scan, file_found_callback, scan_context, SCAN_BATCH)) {
+        view_dispatcher_send_custom_event(scan_context->view_dispatcher, EventScan);
+    } else {
+        FURI_LOG_I(
+            "ImageViewer",
+            "Scan done: %lu images in %lu folders, %lu indexed",
+            (unsigned long)extwalk_scan_get_found(scan_context->scan),
+            (unsigned long)extwalk_scan_get_dirs(scan_context->scan),
+            (unsigned long)extwalk_scan_get_indexed(scan_context->scan));
+        scan_finish(scan_context);
+    }
+    return true;
+}
+
+// Back that the view leaves unhandled exits the app
+static bool navigation_event_callback(void* context) {
+    UNUSED(context);
+    return false;
 }
 
 int32_t imageviewer_app(void* p) {
@@ -36,42 +77,41 @@ int32_t imageviewer_app(void* p) {
 
     // Allocate viewer
     ImageViewer* app = image_viewer_alloc();
-    View* view = image_viewer_get_view(app);
-
-    // Create message queue
-    event_queue = furi_message_queue_alloc(8, sizeof(InputEvent));
 
     // Initialize file walker
     extwalk_init(storage);
 
-    // Register view with GUI
-    // Using the proper APIs from gui.h
-    gui_add_view(gui, view);
-
-    // Initial scan for images
-    extwalk_scan_dir("/ext", file_selected_callback, app);
-
-    // Main event loop
-    bool running = true;
-    while(running) {
-        InputEvent event;
-        if(furi_message_queue_get(event_queue, &event, 100) == FuriStatusOk) {
-            if(event.type == InputTypeShort) {
-                switch(event.key) {
-                case InputKeyBack:
-                    running = false;
-                    break;
-                default:
-                    break;
-                }
-            }
-        }
-    }
+    // Input, redraws, the scan and the slideshow timer all run on this
+    // thread's event loop, which sleeps while there is nothing to do
+    ViewDispatcher* view_dispatcher = view_dispatcher_alloc();
+    image_viewer_set_event_loop(app, view_dispatcher_get_event_loop(view_dispatcher));
+    view_dispatcher_add_view(view_dispatcher, VIEW_IMAGE, image_viewer_get_view(app));
+    view_dispatcher_attach_to_gui(view_dispatcher, gui, ViewDispatcherTypeFullscreen);
+    view_dispatcher_switch_to_view(view_dispatcher, VIEW_IMAGE);
+
+    // Walk the card in the background: the first image is shown as soon as
+    // it is found, and folders too large to list in RAM are indexed
+    ScanContext scan_context = {
+        .app = app,
+        .view_dispatcher = view_dispatcher,
+        .scan = extwalk_scan_alloc(storage, "/ext"),
+    };
+    extwalk_scan_set_indexing(scan_context.scan, true);
+    view_dispatcher_set_event_callback_context(view_dispatcher, &scan_context);
+    view_dispatcher_set_custom_event_callback(view_dispatcher, custom_event_callback);
+    view_dispatcher_set_navigation_event_callback(view_dispatcher, navigation_event_callback);
+    view_dispatcher_send_custom_event(view_dispatcher, EventScan);
+
+    view_dispatcher_run(view_dispatcher);
+
+    image_trace_flush();
 
-    // Cleanup
-    furi_message_queue_free(event_queue);
-    gui_remove_view(gui, view);
+    // Cleanup; an unfinished scan is simply dropped
+    scan_finish(&scan_context);
+    view_dispatcher_remove_view(view_dispatcher, VIEW_IMAGE);
     image_viewer_free(app);
+    view_dispatcher_free(view_dispatcher);
+    extwalk_deinit();
     furi_record_close(RECORD_GUI);
     furi_record_close(RECORD_STORAGE);
 
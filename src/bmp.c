@@ -0,0 +1,506 @@
+#include <furi.h>
+#include <storage/storage.h>
+#include "bmp.h"
+#include "reader.h"
+#include "scaler.h"
+
+#define TAG "ImageBmp"
+
+#define BMP_FILE_HEADER_SIZE 14
+#define BMP_CORE_HEADER_SIZE 12
+#define BMP_INFO_HEADER_SIZE 40
+#define BMP_MAX_DIMENSION    16384
+
+// Multiple of 2, 3 and 4 so chunks always start on a pixel boundary; rows
+// are converted a chunk at a time straight out of the reader's block
+#define BMP_CHUNK_SIZE 768
+
+typedef enum {
+    BmpCompressionRgb = 0,
+    BmpCompressionRle8 = 1,
+    BmpCompressionRle4 = 2,
+    BmpCompressionBitfields = 3,
+    BmpCompressionAlphaBitfields = 6,
+} BmpCompression;
+
+typedef struct {
+    uint8_t shift;
+    uint8_t bits;
+    uint32_t mask;
+    uint32_t mul; // 16.16 factor that stretches the channel to 0..255
+} BmpChannel;
+
+typedef struct {
+    ImageReader* reader;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t data_offset;
+    uint16_t bpp;
+    uint32_t compression;
+    bool top_down;
+    bool use_masks;
+    BmpChannel channels[3]; // R, G, B
+    uint8_t palette[256]; // Palette already converted to luma
+    uint8_t* row; // One source row of luma (or palette indices for RLE)
+    bool native; // Stored rows go to the scaler straight from the reader
+    ImagePixelFormat format;
+    ImageScaler* scaler;
+} BmpDecoder;
+
+static inline uint16_t bmp_u16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t bmp_u32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void bmp_channel_init(BmpChannel* channel, uint32_t mask) {
+    channel->mask = mask;
+    channel->shift = 0;
+    channel->bits = 0;
+    channel->mul = 0;
+    if(!mask) return;
+
+    while(!(mask & 1)) {
+        mask >>= 1;
+        channel->shift++;
+    }
+    while(mask & 1) {
+        mask >>= 1;
+        channel->bits++;
+    }
+    // Wide channels are cut down to their top 8 bits before scaling
+    if(channel->bits > 8) {
+        channel->shift += channel->bits - 8;
+        channel->bits = 8;
+    }
+    channel->mul = (255U << 16) / ((1U << channel->bits) - 1);
+}
+
+static inline uint8_t bmp_channel_get(const BmpChannel* channel, uint32_t pixel) {
+    uint32_t value = ((pixel & channel->mask) >> channel->shift) & ((1U << channel->bits) - 1);
+    return (value * channel->mul) >> 16;
+}
+
+static inline uint8_t bmp_masked_luma(const BmpDecoder* bmp, uint32_t pixel) {
+    return image_luma(
+        bmp_channel_get(&bmp->channels[0], pixel),
+        bmp_channel_get(&bmp->channels[1], pixel),
+        bmp_channel_get(&bmp->channels[2], pixel));
+}
+
+static bool bmp_read_at(ImageReader* reader, uint32_t offset, void* data, size_t size) {
+    if(!image_reader_seek(reader, offset)) return false;
+    return image_reader_read(reader, data, size) == size;
+}
+
+static ImageConverterResult bmp_read_headers(BmpDecoder* bmp) {
+    uint8_t header[BMP_FILE_HEADER_SIZE + 56];
+
+    if(!bmp_read_at(bmp->reader, 0, header, BMP_FILE_HEADER_SIZE + 4)) return ImageConverterError;
+    if(header[0] != 'B' || header[1] != 'M') return ImageConverterError;
+    bmp->data_offset = bmp_u32(header + 10);
+
+    uint32_t dib_size = bmp_u32(header + BMP_FILE_HEADER_SIZE);
+    uint8_t* dib = header + BMP_FILE_HEADER_SIZE;
+    int32_t height;
+    uint16_t planes;
+
+    if(dib_size == BMP_CORE_HEADER_SIZE) {
+        // OS/2 BITMAPCOREHEADER: 16-bit dimensions, RGB triples in the palette
+        if(image_reader_read(bmp->reader, dib + 4, 8) != 8) return ImageConverterError;
+        bmp->width = bmp_u16(dib + 4);
+        height = (int16_t)bmp_u16(dib + 6);
+        planes = bmp_u16(dib + 8);
+        bmp->bpp = bmp_u16(dib + 10);
+        bmp->compression = BmpCompressionRgb;
+    } else if(dib_size >= BMP_INFO_HEADER_SIZE) {
+        // INFO, V2/V3 (masks), V4 and V5 share the same leading 56 bytes
+        size_t extra = MIN(dib_size, 56U) - 4;
+        if(image_reader_read(bmp->reader, dib + 4, extra) != extra) return ImageConverterError;
+        bmp->width = bmp_u32(dib + 4);
+        height = (int32_t)bmp_u32(dib + 8);
+        planes = bmp_u16(dib + 12);
+        bmp->bpp = bmp_u16(dib + 14);
+        bmp->compression = bmp_u32(dib + 16);
+    } else {
+        return ImageConverterUnsupported;
+    }
+
+    if(planes != 1 || bmp->width == 0 || height == 0) return ImageConverterError;
+
+    bmp->top_down = height < 0;
+    bmp->height = bmp->top_down ? (uint32_t)(-height) : (uint32_t)height;
+    if(bmp->width > BMP_MAX_DIMENSION || bmp->height > BMP_MAX_DIMENSION) {
+        return ImageConverterUnsupported;
+    }
+
+    switch(bmp->bpp) {
+    case 1:
+    case 4:
+    case 8:
+    case 16:
+    case 24:
+    case 32:
+        break;
+    default:
+        return ImageConverterUnsupported;
+    }
+
+    switch(bmp->compression) {
+    case BmpCompressionRgb:
+        break;
+    case BmpCompressionRle8:
+        if(bmp->bpp != 8 || bmp->top_down) return ImageConverterUnsupported;
+        break;
+    case BmpCompressionRle4:
+        if(bmp->bpp != 4 || bmp->top_down) return ImageConverterUnsupported;
+        break;
+    case BmpCompressionBitfields:
+    case BmpCompressionAlphaBitfields:
+        if(bmp->bpp != 16 && bmp->bpp != 32) return ImageConverterUnsupported;
+        break;
+    default:
+        // Embedded JPEG/PNG payloads are not supported
+        return ImageConverterUnsupported;
+    }
+
+    // Channel masks: explicit for bitfields, implicit 5-5-5 for plain 16 bpp
+    uint32_t palette_offset = BMP_FILE_HEADER_SIZE + dib_size;
+    if(bmp->compression == BmpCompressionBitfields ||
+       bmp->compression == BmpCompressionAlphaBitfields) {
+        uint8_t masks[12];
+        if(dib_size >= 52) {
+            memcpy(masks, dib + 40, sizeof(masks));
+        } else {
+            // INFO header: masks follow the header and push the palette back
+            if(!bmp_read_at(bmp->reader, palette_offset, masks, sizeof(masks))) {
+                return ImageConverterError;
+            }
+            palette_offset +=
+                (bmp->compression == BmpCompressionAlphaBitfields) ? 16 : sizeof(masks);
+        }
+        for(size_t i = 0; i < 3; i++) {
+            bmp_channel_init(&bmp->channels[i], bmp_u32(masks + i * 4));
+        }
+        bmp->use_masks = true;
+    } else if(bmp->bpp == 16) {
+        bmp_channel_init(&bmp->channels[0], 0x7C00);
+        bmp_channel_init(&bmp->channels[1], 0x03E0);
+        bmp_channel_init(&bmp->channels[2], 0x001F);
+        bmp->use_masks = true;
+    }
+
+    // Palette is read once and kept as luma; missing entries stay black
+    memset(bmp->palette, 0, sizeof(bmp->palette));
+    if(bmp->bpp <= 8) {
+        uint32_t colors = (dib_size >= BMP_INFO_HEADER_SIZE) ? bmp_u32(dib + 32) : 0;
+        if(colors == 0 || colors > (1U << bmp->bpp)) colors = 1U << bmp->bpp;
+        size_t entry_size = (dib_size == BMP_CORE_HEADER_SIZE) ? 3 : 4;
+
+        if(!image_reader_seek(bmp->reader, palette_offset)) return ImageConverterError;
+        for(size_t i = 0; i < colors; i++) {
+            const uint8_t* entry = image_reader_peek(bmp->reader, entry_size);
+            if(!entry) break;
+            bmp->palette[i] = image_luma(entry[2], entry[1], entry[0]);
+            image_reader_skip(bmp->reader, entry_size);
+        }
+    }
+
+    bmp->stride = ((bmp->width * bmp->bpp + 31) / 32) * 4;
+    return ImageConverterOK;
+}
+
+// Uncompressed layouts the scaler converts itself, as long as a whole row
+// fits in one reader block
+static bool bmp_pixel_format(const BmpDecoder* bmp, ImagePixelFormat* format) {
+    if(bmp->compression != BmpCompressionRgb || bmp->stride > IMAGE_READER_BLOCK_SIZE) {
+        return false;
+    }
+    switch(bmp->bpp) {
+    case 8:
+        *format = ImagePixelIndexed;
+        return true;
+    case 24:
+        *format = ImagePixelBgr;
+        return true;
+    case 32:
+        *format = ImagePixelBgrx;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Convert the pixels held in one chunk of a stored row, starting at column x
+static uint32_t bmp_convert_chunk(BmpDecoder* bmp, const uint8_t* data, size_t size, uint32_t x) {
+    uint8_t* row = bmp->row;
+    uint32_t width = bmp->width;
+
+    switch(bmp->bpp) {
+    case 1:
+    case 4:
+    case 8: {
+        uint8_t bpp = bmp->bpp;
+        uint8_t index_mask = (1 << bpp) - 1;
+        for(size_t i = 0; i < size && x < width; i++) {
+            uint8_t byte = data[i];
+            for(int8_t shift = 8 - bpp; shift >= 0 && x < width; shift -= bpp) {
+                row[x++] = bmp->palette[(byte >> shift) & index_mask];
+            }
+        }
+        break;
+    }
+    case 16:
+        for(size_t i = 0; i + 1 < size && x < width; i += 2) {
+            row[x++] = bmp_masked_luma(bmp, bmp_u16(data + i));
+        }
+        break;
+    case 24:
+        for(size_t i = 0; i + 2 < size && x < width; i += 3) {
+            row[x++] = image_luma(data[i + 2], data[i + 1], data[i]);
+        }
+        break;
+    case 32:
+        for(size_t i = 0; i + 3 < size && x < width; i += 4) {
+            if(bmp->use_masks) {
+                row[x++] = bmp_masked_luma(bmp, bmp_u32(data + i));
+            } else {
+                row[x++] = image_luma(data[i + 2], data[i + 1], data[i]);
+            }
+        }
+        break;
+    }
+
+    return x;
+}
+
+// Stored row i in image coordinates
+static inline uint32_t bmp_row_y(const BmpDecoder* bmp, uint32_t i) {
+    return bmp->top_down ? i : bmp->height - 1 - i;
+}
+
+static inline bool bmp_wants_stored_row(const BmpDecoder* bmp, uint32_t i) {
+    return image_scaler_wants_row(bmp->scaler, bmp_row_y(bmp, i));
+}
+
+// Seek to stored row i and return it: as stored for native rows, valid
+// until the next read, and converted into bmp->row otherwise. Reads stop at
+// the end of the row when the next one needed is more than a block away.
+static const uint8_t* bmp_read_row(BmpDecoder* bmp, uint32_t i, uint32_t next) {
+    uint32_t offset = bmp->data_offset + i * bmp->stride;
+    bool far = (next - i - 1) * bmp->stride >= IMAGE_READER_BLOCK_SIZE;
+    image_reader_set_limit(bmp->reader, far ? offset + bmp->stride : UINT32_MAX);
+    if(!image_reader_seek(bmp->reader, offset)) return NULL;
+
+    if(bmp->native) {
+        const uint8_t* pixels = image_reader_peek(bmp->reader, bmp->stride);
+        if(pixels) image_reader_skip(bmp->reader, bmp->stride);
+        return pixels;
+    }
+
+    uint32_t x = 0;
+    uint32_t remaining = bmp->stride;
+    while(remaining) {
+        size_t size = MIN(remaining, (uint32_t)BMP_CHUNK_SIZE);
+        const uint8_t* chunk = image_reader_peek(bmp->reader, size);
+        if(!chunk) return NULL;
+        x = bmp_convert_chunk(bmp, chunk, size, x);
+        image_reader_skip(bmp->reader, size);
+        remaining -= size;
+    }
+    return bmp->row;
+}
+
+// True if the scaler reads every row auto levels sample, as it does for
+// images up to a few times the screen size
+static bool bmp_wants_sampled_rows(const BmpDecoder* bmp) {
+    for(uint32_t y = 0; y < bmp->height; y += bmp->scaler->levels->row_step) {
+        if(!image_scaler_wants_row(bmp->scaler, y)) return false;
+    }
+    return true;
+}
+
+// Auto levels need the tones of the whole image before its first row is
+// dithered. Rows they sample that would otherwise be skipped are read in a
+// pass of their own, which spares the scaler from holding its output back.
+// Being spread over the whole image, they also make the coarse preview shown
+// while the main pass fills in the real rows.
+static ImageConverterResult bmp_sample_levels(BmpDecoder* bmp) {
+    ImagePixelFormat format = bmp->native ? bmp->format : ImagePixelGray;
+    uint32_t step = bmp->scaler->levels->row_step;
+    uint8_t* sketch = NULL;
+    if(image_scaler_wants_preview(bmp->scaler)) {
+        sketch = malloc(IMAGE_OUT_WIDTH * IMAGE_OUT_HEIGHT);
+    }
+
+    // Sampled rows are every step-th one counted from the top of the image
+    uint32_t first = bmp->top_down ? 0 : (bmp->height - 1) % step;
+    for(uint32_t i = first; i < bmp->height; i += step) {
+        const uint8_t* pixels = bmp_read_row(bmp, i, i + step);
+        if(!pixels) {
+            free(sketch);
+            return ImageConverterError;
+        }
+        image_scaler_sample_row(bmp->scaler, pixels, bmp->width, format);
+        if(sketch) {
+            image_scaler_sketch_row(
+                bmp->scaler, sketch, bmp_row_y(bmp, i), step, pixels, format);
+        }
+    }
+    image_scaler_apply_levels(bmp->scaler);
+
+    if(sketch) {
+        image_scaler_preview(bmp->scaler, sketch);
+        free(sketch);
+    }
+    return ImageConverterOK;
+}
+
+static ImageConverterResult bmp_decode_rgb(BmpDecoder* bmp) {
+    if(bmp->scaler->levels && !bmp_wants_sampled_rows(bmp)) {
+        ImageConverterResult result = bmp_sample_levels(bmp);
+        if(result != ImageConverterOK) return result;
+    }
+
+    ImagePixelFormat format = bmp->native ? bmp->format : ImagePixelGray;
+    uint32_t next = 0;
+    while(next < bmp->height && !bmp_wants_stored_row(bmp, next)) next++;
+
+    while(next < bmp->height) {
+        uint32_t i = next;
+        for(next = i + 1; next < bmp->height && !bmp_wants_stored_row(bmp, next); next++) {
+        }
+
+        // Rows the scaler does not sample are skipped with a seek, not read,
+        // unless they are already buffered
+        const uint8_t* pixels = bmp_read_row(bmp, i, next);
+        if(!pixels) return ImageConverterError;
+        uint32_t y = bmp_row_y(bmp, i);
+        if(image_scaler_samples_row(bmp->scaler, y)) {
+            image_scaler_sample_row(bmp->scaler, pixels, bmp->width, format);
+        }
+        image_scaler_push_pixels(bmp->scaler, y, pixels, format);
+    }
+
+    return ImageConverterOK;
+}
+
+// Hand a finished RLE row (palette indices) to the scaler and start the next one
+static void bmp_rle_emit_row(BmpDecoder* bmp, uint32_t* row_index) {
+    if(*row_index < bmp->height) {
+        uint32_t y = bmp->height - 1 - *row_index;
+        bool sampled = image_scaler_samples_row(bmp->scaler, y);
+        if(sampled || image_scaler_wants_row(bmp->scaler, y)) {
+            for(uint32_t x = 0; x < bmp->width; x++) {
+                bmp->row[x] = bmp->palette[bmp->row[x]];
+            }
+            if(sampled) image_scaler_sample_row(bmp->scaler, bmp->row, bmp->width, ImagePixelGray);
+            image_scaler_push_row(bmp->scaler, y, bmp->row);
+        }
+    }
+    (*row_index)++;
+    memset(bmp->row, 0, bmp->width);
+}
+
+static ImageConverterResult bmp_decode_rle(BmpDecoder* bmp) {
+    bool rle4 = bmp->compression == BmpCompressionRle4;
+    uint32_t row_index = 0;
+    uint32_t x = 0;
+
+    if(!image_reader_seek(bmp->reader, bmp->data_offset)) return ImageConverterError;
+    memset(bmp->row, 0, bmp->width);
+
+    while(row_index < bmp->height) {
+        int32_t count = image_reader_byte(bmp->reader);
+        int32_t value = image_reader_byte(bmp->reader);
+        if(count < 0 || value < 0) return ImageConverterError;
+
+        if(count > 0) {
+            // Encoded run; RLE4 alternates the two nibbles
+            for(int32_t i = 0; i < count && x < bmp->width; i++, x++) {
+                if(rle4) {
+                    bmp->row[x] = (i & 1) ? (value & 0x0F) : (value >> 4);
+                } else {
+                    bmp->row[x] = value;
+                }
+            }
+        } else if(value == 0) {
+            // End of line
+            bmp_rle_emit_row(bmp, &row_index);
+            x = 0;
+        } else if(value == 1) {
+            // End of bitmap: the remaining rows keep the background index
+            while(row_index < bmp->height) {
+                bmp_rle_emit_row(bmp, &row_index);
+            }
+        } else if(value == 2) {
+            // Delta: move right and down, leaving skipped pixels as index 0
+            int32_t dx = image_reader_byte(bmp->reader);
+            int32_t dy = image_reader_byte(bmp->reader);
+            if(dx < 0 || dy < 0) return ImageConverterError;
+            for(int32_t i = 0; i < dy; i++) {
+                bmp_rle_emit_row(bmp, &row_index);
+            }
+            x += dx;
+        } else {
+            // Absolute run of literal indices, padded to a 16-bit boundary
+            int32_t bytes = rle4 ? (value + 1) / 2 : value;
+            for(int32_t i = 0; i < bytes; i++) {
+                int32_t byte = image_reader_byte(bmp->reader);
+                if(byte < 0) return ImageConverterError;
+                if(rle4) {
+                    if(x < bmp->width) bmp->row[x] = byte >> 4;
+                    x++;
+                    if(i * 2 + 1 < value) {
+                        if(x < bmp->width) bmp->row[x] = byte & 0x0F;
+                        x++;
+                    }
+                } else {
+                    if(x < bmp->width) bmp->row[x] = byte;
+                    x++;
+                }
+            }
+            if((bytes & 1) && image_reader_byte(bmp->reader) < 0) return ImageConverterError;
+        }
+    }
+
+    return ImageConverterOK;
+}
+
+ImageConverterResult image_bmp_decode(ImageReader* reader, ImageScaler* scaler) {
+    BmpDecoder* bmp = malloc(sizeof(BmpDecoder));
+    if(!bmp) return ImageConverterError;
+    memset(bmp, 0, sizeof(BmpDecoder));
+    bmp->reader = reader;
+    bmp->scaler = scaler;
+
+    ImageConverterResult result = bmp_read_headers(bmp);
+    if(result == ImageConverterOK) {
+        // The only per-image allocation: one row of luma/indices, unless
+        // rows are handed over as stored
+        bmp->native = bmp_pixel_format(bmp, &bmp->format);
+        if(!bmp->native) bmp->row = malloc(bmp->width);
+        if(!bmp->native && !bmp->row) {
+            result = ImageConverterError;
+        } else {
+            image_scaler_init(bmp->scaler, bmp->width, bmp->height);
+            image_scaler_set_palette(bmp->scaler, bmp->palette);
+            if(bmp->compression == BmpCompressionRle8 ||
+               bmp->compression == BmpCompressionRle4) {
+                result = bmp_decode_rle(bmp);
+            } else {
+                result = bmp_decode_rgb(bmp);
+            }
+            free(bmp->row);
+        }
+    }
+
+    if(result != ImageConverterOK) {
+        FURI_LOG_E(TAG, "Decode failed: %d", result);
+    }
+    free(bmp);
+    return result;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <storage/storage.h>
+#include "convert.h"
+#include "reader.h"
+#include "scaler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Decode a BMP (core/INFO/V2-V5 headers, 1/4/8/16/24/32 bpp, RLE4/RLE8,
+// bitfields, bottom-up or top-down) from the start of a file into the
+// scaler. Source rows are streamed, never the whole image.
+ImageConverterResult image_bmp_decode(ImageReader* reader, ImageScaler* scaler);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,247 @@
+#include <furi.h>
+#include <string.h>
+#include "cache.h"
+#include "worker.h"
+
+#define TAG "ImageCache"
+
+typedef struct ImageCacheEntry {
+    struct ImageCacheEntry* prev; // Towards most recently used
+    struct ImageCacheEntry* next;
+    uint32_t hash;
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t variant;
+    uint16_t length; // Bytes in data
+    bool raw; // data is the frame as is
+    char* path; // Points into data, after the frame bytes
+    uint8_t data[];
+} ImageCacheEntry;
+
+struct ImageCache {
+    ImageCacheEntry* head; // Most recently used
+    ImageCacheEntry* tail;
+    ImageCacheStats stats;
+    // Worst case PackBits output: one header per 128 literals
+    uint8_t packed[IMAGE_FRAME_SIZE + IMAGE_FRAME_SIZE / 128 + 1];
+};
+
+static uint32_t cache_hash(const char* path) {
+    uint32_t hash = 2166136261UL;
+    for(const char* p = path; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619UL;
+    }
+    return hash;
+}
+
+// PackBits: a header n < 128 is followed by n + 1 literal bytes, a header
+// n > 128 repeats the next byte 257 - n times
+static size_t cache_pack(const uint8_t* in, size_t size, uint8_t* out) {
+    size_t pos = 0;
+    size_t length = 0;
+
+    while(pos < size) {
+        size_t run = 1;
+        while(pos + run < size && run < 128 && in[pos + run] == in[pos]) run++;
+
+        if(run >= 3) {
+            out[length++] = 257 - run;
+            out[length++] = in[pos];
+            pos += run;
+            continue;
+        }
+
+        // Literals until the next run of three or the 128 byte limit
+        size_t start = pos;
+        size_t count = 0;
+        while(pos < size && count < 128) {
+            if(pos + 2 < size && in[pos] == in[pos + 1] && in[pos] == in[pos + 2]) break;
+            pos++;
+            count++;
+        }
+        out[length++] = count - 1;
+        memcpy(out + length, in + start, count);
+        length += count;
+    }
+    return length;
+}
+
+static bool cache_unpack(const uint8_t* in, size_t length, uint8_t* out, size_t size) {
+    size_t pos = 0;
+    size_t written = 0;
+
+    while(pos < length) {
+        uint8_t header = in[pos++];
+        if(header < 128) {
+            size_t count = header + 1;
+            if(pos + count > length || written + count > size) return false;
+            memcpy(out + written, in + pos, count);
+            pos += count;
+            written += count;
+        } else if(header > 128) {
+            size_t count = 257 - header;
+            if(pos >= length || written + count > size) return false;
+            memset(out + written, in[pos++], count);
+            written += count;
+        }
+    }
+    return written == size;
+}
+
+static size_t cache_entry_bytes(const ImageCacheEntry* entry) {
+    return sizeof(ImageCacheEntry) + entry->length + strlen(entry->path) + 1;
+}
+
+static void cache_unlink(ImageCache* cache, ImageCacheEntry* entry) {
+    if(entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if(entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+static void cache_push_front(ImageCache* cache, ImageCacheEntry* entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if(cache->head) cache->head->prev = entry;
+    cache->head = entry;
+    if(!cache->tail) cache->tail = entry;
+}
+
+static void cache_evict(ImageCache* cache, ImageCacheEntry* entry) {
+    cache_unlink(cache, entry);
+    cache->stats.entries--;
+    cache->stats.bytes -= cache_entry_bytes(entry);
+    cache->stats.frame_bytes -= IMAGE_FRAME_SIZE;
+    free(entry);
+}
+
+// What the cache may hold right now: half of the heap above the reserve
+static size_t cache_budget(void) {
+    size_t free_heap = memmgr_get_free_heap();
+    if(free_heap <= IMAGE_CACHE_HEAP_RESERVE) return 0;
+    return MIN((free_heap - IMAGE_CACHE_HEAP_RESERVE) / 2, (size_t)IMAGE_CACHE_MAX_BYTES);
+}
+
+bool image_cache_key_init(
+    ImageCacheKey* key,
+    Storage* storage,
+    const char* path,
+    uint32_t variant) {
+    FileInfo info;
+    key->path = path;
+    key->variant = variant;
+    if(storage_common_stat(storage, path, &info) != FSE_OK) return false;
+    key->size = (uint32_t)info.size;
+    return storage_common_timestamp(storage, path, &key->mtime) == FSE_OK;
+}
+
+ImageCache* image_cache_alloc(void) {
+    ImageCache* cache = malloc(sizeof(ImageCache));
+    memset(cache, 0, sizeof(ImageCache));
+    return cache;
+}
+
+void image_cache_free(ImageCache* cache) {
+    while(cache->tail) {
+        cache_evict(cache, cache->tail);
+    }
+    free(cache);
+}
+
+bool image_cache_lookup(ImageCache* cache, const ImageCacheKey* key, uint8_t* bitmap) {
+    uint32_t hash = cache_hash(key->path);
+
+    for(ImageCacheEntry* entry = cache->head; entry; entry = entry->next) {
+        if(entry->hash != hash || entry->size != key->size || entry->mtime != key->mtime ||
+           entry->variant != key->variant || strcmp(entry->path, key->path) != 0) {
+            continue;
+        }
+
+        bool ok = entry->raw ? (memcpy(bitmap, entry->data, IMAGE_FRAME_SIZE), true) :
+                               cache_unpack(entry->data, entry->length, bitmap, IMAGE_FRAME_SIZE);
+        if(!ok) {
+            cache_evict(cache, entry);
+            break;
+        }
+        cache_unlink(cache, entry);
+        cache_push_front(cache, entry);
+        cache->stats.hits++;
+        return true;
+    }
+
+    cache->stats.misses++;
+    return false;
+}
+
+void image_cache_insert(ImageCache* cache, const ImageCacheKey* key, const uint8_t* bitmap) {
+    uint32_t hash = cache_hash(key->path);
+
+    // A changed file or a repeated insert replaces the old frame
+    for(ImageCacheEntry* entry = cache->head; entry;) {
+        ImageCacheEntry* next = entry->next;
+        if(entry->hash == hash && entry->variant == key->variant &&
+           strcmp(entry->path, key->path) == 0) {
+            cache_evict(cache, entry);
+        }
+        entry = next;
+    }
+
+    size_t length = cache_pack(bitmap, IMAGE_FRAME_SIZE, cache->packed);
+    bool raw = length >= IMAGE_FRAME_SIZE;
+    if(raw) length = IMAGE_FRAME_SIZE;
+
+    size_t path_len = strlen(key->path) + 1;
+    size_t bytes = sizeof(ImageCacheEntry) + length + path_len;
+    size_t budget = cache_budget();
+    if(bytes > budget) return;
+    while(cache->tail && cache->stats.bytes + bytes > budget) {
+        cache_evict(cache, cache->tail);
+    }
+
+    ImageCacheEntry* entry = malloc(bytes);
+    if(!entry) return;
+    entry->hash = hash;
+    entry->size = key->size;
+    entry->mtime = key->mtime;
+    entry->variant = key->variant;
+    entry->length = length;
+    entry->raw = raw;
+    memcpy(entry->data, raw ? bitmap : cache->packed, length);
+    entry->path = (char*)entry->data + length;
+    memcpy(entry->path, key->path, path_len);
+    cache_push_front(cache, entry);
+
+    cache->stats.entries++;
+    cache->stats.bytes += bytes;
+    cache->stats.frame_bytes += IMAGE_FRAME_SIZE;
+    FURI_LOG_D(
+        TAG,
+        "%lu frames in %lu B (%lu B raw), budget %u B",
+        (unsigned long)cache->stats.entries,
+        (unsigned long)cache->stats.bytes,
+        (unsigned long)cache->stats.frame_bytes,
+        (unsigned)budget);
+}
+
+void image_cache_trim(ImageCache* cache, size_t heap_reserve) {
+    while(cache->tail && memmgr_get_free_heap() < heap_reserve) {
+        cache_evict(cache, cache->tail);
+    }
+}
+
+void image_cache_get_stats(const ImageCache* cache, ImageCacheStats* stats) {
+    *stats = cache->stats;
+}
+
+uint8_t image_cache_get_hit_rate(const ImageCache* cache) {
+    uint32_t lookups = cache->stats.hits + cache->stats.misses;
+    return lookups ? (uint8_t)(cache->stats.hits * 100 / lookups) : 0;
+}
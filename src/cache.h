@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <storage/storage.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Largest share of the heap the cache grows to, whatever is free
+#define IMAGE_CACHE_MAX_BYTES (32 * 1024)
+
+// Free heap kept clear for the decoders (a PNG with a 32 KB window needs
+// about 40 KB); the cache gives frames back to stay above it
+#define IMAGE_CACHE_HEAP_RESERVE (48 * 1024)
+
+// A frame is valid for one file content and one conversion setting
+typedef struct {
+    const char* path;
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t variant; // Conversion settings, e.g. the dithering mode
+} ImageCacheKey;
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t entries;
+    uint32_t bytes; // Heap held, headers and paths included
+    uint32_t frame_bytes; // Uncompressed size of the cached frames
+} ImageCacheStats;
+
+// Key `path` by its current size and timestamp. False when the file cannot
+// be stat'ed; such files are not cached.
+bool image_cache_key_init(
+    ImageCacheKey* key,
+    Storage* storage,
+    const char* path,
+    uint32_t variant);
+
+// LRU cache of converted 1-bit frames. Frames are PackBits compressed (raw
+// when that would not save anything) into one allocation per entry together
+// with the key. The budget follows memmgr_get_free_heap, so the cache holds
+// more history when memory is plentiful and less when it is not. Not thread
+// safe; the decode worker is its only user.
+typedef struct ImageCache ImageCache;
+
+ImageCache* image_cache_alloc(void);
+void image_cache_free(ImageCache* cache);
+
+// Decompress the frame for `key` into `bitmap` and mark it most recently used
+bool image_cache_lookup(ImageCache* cache, const ImageCacheKey* key, uint8_t* bitmap);
+
+// Store a frame, evicting least recently used ones to fit the budget. Older
+// versions of the same path and variant are dropped.
+void image_cache_insert(ImageCache* cache, const ImageCacheKey* key, const uint8_t* bitmap);
+
+// Evict until at least `heap_reserve` bytes of heap are free or nothing is left
+void image_cache_trim(ImageCache* cache, size_t heap_reserve);
+
+void image_cache_get_stats(const ImageCache* cache, ImageCacheStats* stats);
+
+// Hits as a percentage of lookups, 0 before the first lookup
+uint8_t image_cache_get_hit_rate(const ImageCache* cache);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,106 +1,257 @@
 #include <furi.h>
-#include <furi/core/core_defines.h>
-#include <furi/core/event_loop.h>
-#include <furi/core/event_loop_timer.h>
-#include <furi/core/event_flag.h>
-#include <furi/core/kernel.h>
-#include <furi/core/log.h>
-#include <furi/core/memmgr.h>
-#include <furi/core/memmgr_heap.h>
-#include <furi/core/message_queue.h>
-#include <furi/core/mutex.h>
-#include <furi/core/pubsub.h>
-#include <furi/core/record.h>
-#include <furi/core/semaphore.h>
-#include <furi/core/thread.h>
-#include <furi/core/thread_list.h>
-#include <furi/core/timer.h>
-#include <furi/core/string.h>
-#include <furi/core/stream_buffer.h>
 #include <furi_hal.h>
-#include <furi_hal_rtc.h>
-#include <lib/bit_lib/bit_lib.h>
-#include <lib/mlIB/m-array.h>
 #include <storage/storage.h>
 #include "convert.h"
+#include "bmp.h"
+#include "png.h"
+#include "jpeg.h"
+#include "gif.h"
+#include "reader.h"
+#include "scaler.h"
+#include "diskcache.h"
+#include "trace.h"
+
+#define TAG "ImageConvert"
 
 #define IMAGE_BUF_SIZE 1024 // 128x64 / 8 bits per byte
 
-// Nearest-neighbor resizer and threshold-to-monochrome
+static ImageDitherMode dither_mode = ImageDitherFloydSteinberg;
+
+static ImageConvertProgressCallback progress_callback;
+static void* progress_context;
+
+static const char* const dither_names[ImageDitherCount] = {
+    [ImageDitherThreshold] = "Threshold",
+    [ImageDitherFloydSteinberg] = "Floyd-Steinberg",
+    [ImageDitherAtkinson] = "Atkinson",
+    [ImageDitherSierraLite] = "Sierra Lite",
+    [ImageDitherBayer4x4] = "Bayer 4x4",
+    [ImageDitherBayer8x8] = "Bayer 8x8",
+};
+
+void image_convert_set_dither_mode(ImageDitherMode mode) {
+    if(mode < ImageDitherCount) dither_mode = mode;
+}
+
+ImageDitherMode image_convert_get_dither_mode(void) {
+    return dither_mode;
+}
+
+const char* image_convert_get_dither_name(ImageDitherMode mode) {
+    return mode < ImageDitherCount ? dither_names[mode] : "?";
+}
+
+void image_convert_set_progress_callback(ImageConvertProgressCallback callback, void* context) {
+    progress_callback = callback;
+    progress_context = context;
+}
+
+static inline uint32_t convert_cycles(void) {
+    return furi_hal_cortex_timer_get(0).start;
+}
+
+static inline uint32_t convert_cycles_to_us(uint32_t cycles) {
+    return cycles / furi_hal_cortex_instructions_per_microsecond();
+}
+
+static void image_convert_log_dither(const ImageScaler* scaler) {
+    FURI_LOG_I(
+        TAG,
+        "%s: %lu us per frame",
+        dither_names[scaler->dither.mode],
+        (unsigned long)(scaler->dither.cycles / furi_hal_cortex_instructions_per_microsecond()));
+}
+
+// Area-averaging resizer followed by the dithering stage
 void image_convert_to_bitmap128x64(
     const uint8_t* input_data,
     size_t input_width,
     size_t input_height,
     uint8_t* output_bitmap) {
-    memset(output_bitmap, 0, 1024);
-
-    for(size_t y = 0; y < 64; y++) {
-        for(size_t x = 0; x < 128; x++) {
-            // Compute nearest pixel in original image
-            size_t src_x = x * input_width / 128;
-            size_t src_y = y * input_height / 64;
-            size_t src_index = src_y * input_width + src_x;
-
-            // Assume 1 byte per pixel grayscale for simplicity
-            uint8_t pixel = input_data[src_index];
-
-            // Threshold: convert to 1-bit
-            uint8_t bit = (pixel > 128) ? 1 : 0;
-
-            // Set bit in output
-            size_t byte_index = (y * 128 + x) / 8;
-            size_t bit_index = x % 8;
-            if(bit) {
-                output_bitmap[byte_index] |= (1 << (7 - bit_index));
-            }
+    ImageScaler* scaler = malloc(sizeof(ImageScaler));
+    ImageLevels* levels = malloc(sizeof(ImageLevels));
+    image_scaler_setup(scaler, output_bitmap, dither_mode);
+    image_scaler_set_levels(scaler, levels);
+    image_scaler_init(scaler, input_width, input_height);
+
+    // Assume 1 byte per pixel grayscale for simplicity. The whole image is at
+    // hand, so the levels are known before the first row is pushed.
+    for(size_t y = 0; y < input_height; y++) {
+        if(image_scaler_samples_row(scaler, y)) {
+            image_scaler_sample_row(
+                scaler, input_data + y * input_width, input_width, ImagePixelGray);
         }
     }
+    image_scaler_apply_levels(scaler);
+    for(size_t y = 0; y < input_height; y++) {
+        image_scaler_push_row(scaler, y, input_data + y * input_width);
+    }
+
+    image_convert_log_dither(scaler);
+    free(levels);
+    free(scaler);
 }
 
-ImageConverterResult image_convert_to_bitmap(
+// Cache variant of a conversion: the dithering in the low byte, then the
+// tile. Whole frames are tile 0 of level 0, so their variant is the dithering.
+static uint32_t convert_variant(uint8_t zoom, uint16_t tile_x, uint16_t tile_y) {
+    return dither_mode | (uint32_t)zoom << 8 | (uint32_t)tile_x << 12 | (uint32_t)tile_y << 20;
+}
+
+static ImageConverterResult convert_file(
     const char* filename,
     uint8_t* bitmap,
-    uint16_t* width,
-    uint16_t* height) {
+    uint8_t zoom,
+    uint16_t tile_x,
+    uint16_t tile_y,
+    bool progressive,
+    ImageConvertStats* stats) {
+    image_trace_begin("convert");
+    uint32_t start = convert_cycles();
+    memset(stats, 0, sizeof(ImageConvertStats));
     Storage* storage = furi_record_open(RECORD_STORAGE);
+
+    // A frame converted before with the same settings is a 1 KB read away
+    ImageCacheKey key;
+    bool cacheable =
+        image_cache_key_init(&key, storage, filename, convert_variant(zoom, tile_x, tile_y));
+    if(cacheable && image_diskcache_load(storage, &key, bitmap)) {
+        furi_record_close(RECORD_STORAGE);
+        stats->source = ImageConvertDiskCache;
+        stats->bytes_read = IMAGE_BUF_SIZE;
+        stats->read_calls = 1;
+        stats->open_us = stats->total_us = convert_cycles_to_us(convert_cycles() - start);
+        image_trace_end("convert");
+        return ImageConverterOK;
+    }
+
     File* file = storage_file_alloc(storage);
-    bool success = false;
 
     // Open file
     if(!storage_file_open(file, filename, FSAM_READ, FSOM_OPEN_EXISTING)) {
         storage_file_free(file);
         furi_record_close(RECORD_STORAGE);
+        image_trace_end("convert");
         return ImageConverterError;
     }
 
-    // Read first bytes to detect format
-    uint8_t header[8];
-    if(storage_file_read(file, header, sizeof(header)) != sizeof(header)) {
+    // The first block comes in with the bytes that give the format away,
+    // and decoders start on it from the beginning of the file
+    ImageReaderStats reads = {0};
+    ImageReader* reader = image_reader_alloc(file, &reads);
+    const uint8_t* header = image_reader_peek(reader, 8);
+    if(!header) {
+        image_reader_free(reader);
         storage_file_close(file);
         storage_file_free(file);
         furi_record_close(RECORD_STORAGE);
+        image_trace_end("convert");
         return ImageConverterError;
     }
 
-    // Simple format detection
-    if(header[0] == 0x42 && header[1] == 0x4D) {
-        // BMP file
-        // Skip header
-        storage_file_seek(file, 54, false);
+    // Decoders stream rows into one shared scaler/dither stage
+    ImageScaler* scaler = malloc(sizeof(ImageScaler));
+    ImageLevels* levels = malloc(sizeof(ImageLevels));
+    image_scaler_setup(scaler, bitmap, dither_mode);
+    image_scaler_set_tile(scaler, zoom, tile_x, tile_y);
+    if(progressive && progress_callback) {
+        image_scaler_set_progress(scaler, progress_callback, progress_context);
+    }
 
-        // Read image data directly to bitmap buffer
-        // This assumes 1-bit BMP format - add proper BMP parsing for production
-        storage_file_read(file, bitmap, IMAGE_BUF_SIZE);
+    // Everything up to here counts as opening, the header read included
+    uint32_t decode_start = convert_cycles();
+    reads.cycles = 0;
+    image_trace_begin("decode");
 
-        *width = 128;
-        *height = 64;
-        success = true;
+    // Simple format detection. BMP seeks from row to row; the other formats
+    // stream the file, so the next block is read while one is decoded.
+    // Photographic formats get auto levels and progress.
+    ImageConverterResult result = ImageConverterUnsupported;
+    if(header[0] == 0x42 && header[1] == 0x4D) {
+        // BMP file, decoded row by row straight into the bitmap
+        image_scaler_set_levels(scaler, levels);
+        result = image_bmp_decode(reader, scaler);
+    } else if(
+        header[0] == 0x89 && header[1] == 'P' && header[2] == 'N' && header[3] == 'G' &&
+        header[4] == 0x0D && header[5] == 0x0A && header[6] == 0x1A && header[7] == 0x0A) {
+        // PNG file, IDAT is inflated and unfiltered one scanline at a time
+        image_reader_set_double_buffered(reader);
+        image_scaler_set_levels(scaler, levels);
+        result = image_png_decode(reader, scaler);
+    } else if(header[0] == 0xFF && header[1] == 0xD8 && header[2] == 0xFF) {
+        // JPEG file, luma only with a reduced-size IDCT
+        image_reader_set_double_buffered(reader);
+        image_scaler_set_levels(scaler, levels);
+        result = image_jpeg_decode(reader, scaler);
+    } else if(header[0] == 'G' && header[1] == 'I' && header[2] == 'F' && header[3] == '8') {
+        // GIF file, first frame only; playback is up to the worker. Its
+        // frames are dithered as they are, so the first one is too, and it
+        // is only dithered once complete.
+        image_scaler_set_progress(scaler, NULL, NULL);
+        image_reader_set_double_buffered(reader);
+        result = image_gif_decode(reader, scaler);
     }
     // Add more format detection and conversion here
 
+    // Rows still held back for the levels are dithered now
+    image_scaler_apply_levels(scaler);
+
+    // A read still in flight is waited for here
+    image_reader_free(reader);
+    uint32_t decode_cycles = convert_cycles() - decode_start;
+    image_trace_end("decode");
+
+    if(result == ImageConverterOK) image_convert_log_dither(scaler);
+
+    // Stages nest: reads and scaling happen inside the decoder, dithering
+    // inside the scaler
+    uint32_t scale_cycles = MIN(scaler->cycles, decode_cycles - reads.cycles);
+    stats->open_us = convert_cycles_to_us(decode_start - start);
+    stats->read_us = convert_cycles_to_us(reads.cycles);
+    stats->scale_us = convert_cycles_to_us(scale_cycles - scaler->dither.cycles);
+    stats->dither_us = convert_cycles_to_us(scaler->dither.cycles);
+    stats->decode_us = convert_cycles_to_us(decode_cycles - reads.cycles - scale_cycles);
+    stats->bytes_read = reads.bytes;
+    stats->read_calls = reads.calls;
+    free(levels);
+    free(scaler);
+
     storage_file_close(file);
     storage_file_free(file);
+
+    if(cacheable && result == ImageConverterOK) {
+        image_diskcache_store(storage, &key, bitmap);
+    }
     furi_record_close(RECORD_STORAGE);
+    stats->total_us = convert_cycles_to_us(convert_cycles() - start);
+    image_trace_end("convert");
+
+    return result;
+}
 
-    return success ? ImageConverterOK : ImageConverterError;
+ImageConverterResult image_convert_to_bitmap(
+    const char* filename,
+    uint8_t* bitmap,
+    uint16_t* width,
+    uint16_t* height,
+    ImageConvertStats* stats) {
+    ImageConvertStats unused;
+    ImageConverterResult result =
+        convert_file(filename, bitmap, 0, 0, 0, true, stats ? stats : &unused);
+    if(result == ImageConverterOK) {
+        *width = 128;
+        *height = 64;
+    }
+    return result;
+}
+
+ImageConverterResult image_convert_tile(
+    const char* filename,
+    uint8_t zoom,
+    uint16_t tile_x,
+    uint16_t tile_y,
+    uint8_t* bitmap) {
+    if(zoom > IMAGE_ZOOM_MAX || tile_x >> zoom || tile_y >> zoom) return ImageConverterError;
+    ImageConvertStats stats;
+    return convert_file(filename, bitmap, zoom, tile_x, tile_y, false, &stats);
 }
@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <storage/storage.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,14 +15,111 @@ typedef enum {
     ImageConverterUnsupported
 } ImageConverterResult;
 
-// Convert file to 1-bit bitmap for Flipper display
+// Every conversion targets the full Flipper screen
+#define IMAGE_OUT_WIDTH  128
+#define IMAGE_OUT_HEIGHT 64
+
+// Conversion is one pass per source row: a decoder pushes each row it has
+// decoded, in its stored layout where that is one of these, into the scaler
+// (scaler.h), which turns pixels into luma while box filtering them, then
+// dithers and packs each finished output row. Only the columns the output
+// samples are converted, and no buffer larger than a source row exists.
+typedef enum {
+    ImagePixelGray,
+    ImagePixelIndexed, // Through the 256 entry luma palette set on the scaler
+    ImagePixelGrayAlpha,
+    ImagePixelRgb,
+    ImagePixelRgba,
+    ImagePixelBgr, // BMP order
+    ImagePixelBgrx, // BMP order, the fourth byte unused
+} ImagePixelFormat;
+
+// BT.601 luma with weights summing to 256
+static inline uint8_t image_luma(uint8_t r, uint8_t g, uint8_t b) {
+    return (r * 77 + g * 150 + b * 29) >> 8;
+}
+
+// Blend over the white screen background; x * 257 >> 16 stands in for x / 255
+static inline uint8_t image_luma_over_white(uint8_t luma, uint8_t alpha) {
+    uint32_t ink = (255 - luma) * alpha;
+    return 255 - ((ink * 257 + 32768) >> 16);
+}
+
+// Stage that turns scaled luma into 1-bit pixels
+typedef enum {
+    ImageDitherThreshold,
+    ImageDitherFloydSteinberg,
+    ImageDitherAtkinson,
+    ImageDitherSierraLite,
+    ImageDitherBayer4x4,
+    ImageDitherBayer8x8,
+    ImageDitherCount,
+} ImageDitherMode;
+
+// Select the dithering used by subsequent conversions
+void image_convert_set_dither_mode(ImageDitherMode mode);
+ImageDitherMode image_convert_get_dither_mode(void);
+const char* image_convert_get_dither_name(ImageDitherMode mode);
+
+// Where a frame came from
+typedef enum {
+    ImageConvertDecoded,
+    ImageConvertDiskCache, // Frame file on the SD card
+    ImageConvertRamCache, // Decode worker's frame cache, set by the worker
+} ImageConvertSource;
+
+// Where one conversion spent its time, for the on-screen HUD. Read time is
+// storage calls made by the decoder and its waits for blocks read ahead;
+// total_us is the stages plus saving the frame to the SD cache.
+typedef struct {
+    uint32_t open_us; // Cache lookup, open and format detection
+    uint32_t read_us;
+    uint32_t decode_us; // Decoder work outside reads, scaling and dithering
+    uint32_t scale_us; // Box filtering and packing
+    uint32_t dither_us;
+    uint32_t total_us;
+    uint32_t bytes_read;
+    uint32_t read_calls; // Storage reads and seeks
+    ImageConvertSource source;
+} ImageConvertStats;
+
+// Called on the converting thread whenever the bitmap being converted by
+// image_convert_to_bitmap holds a coarse or partial frame worth showing
+typedef void (*ImageConvertProgressCallback)(void* context);
+
+// Have subsequent image_convert_to_bitmap calls of photographic formats show
+// progress: a coarse frame early on (the first Adam7 pass of an interlaced
+// PNG, rows spread over a large BMP) or the rows decoded so far, refined
+// every so often as the decode goes on. NULL turns it off; tiles never
+// report progress.
+void image_convert_set_progress_callback(ImageConvertProgressCallback callback, void* context);
+
+// Convert file to 1-bit bitmap for Flipper display. The bitmap is 128x64 in
+// XBM order (LSB first, set bit = dark pixel), ready for canvas_draw_xbm.
+// Where the time went is stored in `stats` unless it is NULL.
 ImageConverterResult image_convert_to_bitmap(
     const char* filename,
     uint8_t* bitmap,
     uint16_t* width,
-    uint16_t* height);
+    uint16_t* height,
+    ImageConvertStats* stats);
+
+// Zoom level z shows the image at 2^z times the screen size each way, cut
+// into 2^z x 2^z screen sized tiles; level 0 is the whole image on screen
+#define IMAGE_ZOOM_MAX 3
+
+// Convert tile (tile_x, tile_y) of zoom level `zoom` into a 128x64 bitmap.
+// Tiles are decoded from the source like whole frames, rows outside the tile
+// skipped where the format allows, and cached on the SD card next to them.
+ImageConverterResult image_convert_tile(
+    const char* filename,
+    uint8_t zoom,
+    uint16_t tile_x,
+    uint16_t tile_y,
+    uint8_t* bitmap);
 
-// Converts grayscale or RGB data to 1-bit 128x64 bitmap
+// Convert an 8-bit grayscale buffer already in memory to a 128x64 bitmap,
+// row by row through the same scaler the decoders feed
 void image_convert_to_bitmap128x64(
     const uint8_t* input_data,
     size_t input_width,
@@ -0,0 +1,250 @@
+#include <furi.h>
+#include <string.h>
+#include "diskcache.h"
+#include "worker.h"
+
+#define TAG "ImageDiskCache"
+
+#define DISKCACHE_MAGIC   0x43465649 // "IVFC"
+#define DISKCACHE_VERSION 2 // Bumped whenever conversions change their output
+
+#define DISKCACHE_NAME_MAX 24 // "%08lx%02lx.frm", tiles have longer variants
+#define DISKCACHE_PATH_MAX 64
+
+// Oldest entries collected per eviction pass over the directory, enough for
+// a quarter of the default budget so an eviction is usually one pass
+#define DISKCACHE_EVICT_BATCH 64
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t path_len;
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t variant;
+} DiskCacheHeader;
+
+typedef struct {
+    char name[DISKCACHE_NAME_MAX];
+    uint32_t mtime;
+    uint32_t size;
+} DiskCacheVictim;
+
+static uint32_t diskcache_budget = IMAGE_DISKCACHE_DEFAULT_BUDGET;
+static uint32_t diskcache_usage;
+static bool diskcache_counted;
+
+// Entries are named after the source path and variant; the header holds the
+// rest of the key and the path is stored to catch hash collisions
+static void
+    diskcache_entry_path(char* out, size_t size, const char* dir, const ImageCacheKey* key) {
+    uint32_t hash = 2166136261UL;
+    for(const char* p = key->path; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619UL;
+    }
+    snprintf(
+        out,
+        size,
+        "%s/%08lx%02lx.frm",
+        dir,
+        (unsigned long)hash,
+        (unsigned long)key->variant);
+}
+
+static size_t diskcache_entry_size(const ImageCacheKey* key) {
+    return sizeof(DiskCacheHeader) + IMAGE_FRAME_SIZE + strlen(key->path);
+}
+
+static void diskcache_count(Storage* storage) {
+    if(diskcache_counted) return;
+    diskcache_counted = true;
+    diskcache_usage = 0;
+
+    File* dir = storage_file_alloc(storage);
+    if(storage_dir_open(dir, IMAGE_DISKCACHE_DIR)) {
+        FileInfo info;
+        while(storage_dir_read(dir, &info, NULL, 0)) {
+            if(!(info.flags & FSF_DIRECTORY)) diskcache_usage += info.size;
+        }
+    }
+    storage_dir_close(dir);
+    storage_file_free(dir);
+    FURI_LOG_I(TAG, "%lu B in use", (unsigned long)diskcache_usage);
+}
+
+// Collect the oldest entries of the directory, newest last
+static size_t diskcache_find_oldest(Storage* storage, DiskCacheVictim* victims) {
+    size_t count = 0;
+    char name[DISKCACHE_NAME_MAX];
+    char path[DISKCACHE_PATH_MAX];
+    FileInfo info;
+
+    File* dir = storage_file_alloc(storage);
+    if(storage_dir_open(dir, IMAGE_DISKCACHE_DIR)) {
+        while(storage_dir_read(dir, &info, name, sizeof(name))) {
+            if(info.flags & FSF_DIRECTORY) continue;
+            uint32_t mtime = 0;
+            snprintf(path, sizeof(path), "%s/%s", IMAGE_DISKCACHE_DIR, name);
+            storage_common_timestamp(storage, path, &mtime);
+            if(count == DISKCACHE_EVICT_BATCH && mtime >= victims[count - 1].mtime) continue;
+
+            // Insertion into the sorted batch, dropping the newest when full
+            size_t i = count < DISKCACHE_EVICT_BATCH ? count++ : count - 1;
+            while(i > 0 && victims[i - 1].mtime > mtime) {
+                victims[i] = victims[i - 1];
+                i--;
+            }
+            strlcpy(victims[i].name, name, sizeof(victims[i].name));
+            victims[i].mtime = mtime;
+            victims[i].size = info.size;
+        }
+    }
+    storage_dir_close(dir);
+    storage_file_free(dir);
+    return count;
+}
+
+static void diskcache_evict(Storage* storage) {
+    uint32_t target = diskcache_budget / 4 * 3;
+    char path[DISKCACHE_PATH_MAX];
+    DiskCacheVictim* victims = malloc(sizeof(DiskCacheVictim) * DISKCACHE_EVICT_BATCH);
+    size_t removed = 0;
+
+    while(diskcache_usage > target) {
+        size_t count = diskcache_find_oldest(storage, victims);
+        if(count == 0) {
+            // Nothing left to delete, the count was off
+            diskcache_usage = 0;
+            break;
+        }
+        for(size_t i = 0; i < count && diskcache_usage > target; i++) {
+            snprintf(path, sizeof(path), "%s/%s", IMAGE_DISKCACHE_DIR, victims[i].name);
+            if(storage_common_remove(storage, path) != FSE_OK) continue;
+            diskcache_usage -= MIN(diskcache_usage, victims[i].size);
+            removed++;
+        }
+    }
+
+    free(victims);
+    FURI_LOG_I(
+        TAG,
+        "Evicted %u entries, %lu B in use",
+        (unsigned)removed,
+        (unsigned long)diskcache_usage);
+}
+
+static bool diskcache_read(
+    Storage* storage,
+    const char* dir,
+    const ImageCacheKey* key,
+    uint8_t* bitmap) {
+    char path[DISKCACHE_PATH_MAX];
+    diskcache_entry_path(path, sizeof(path), dir, key);
+    size_t path_len = strlen(key->path);
+
+    File* file = storage_file_alloc(storage);
+    bool hit = false;
+    do {
+        if(!storage_file_open(file, path, FSAM_READ, FSOM_OPEN_EXISTING)) break;
+        // A torn write leaves a short file
+        if(storage_file_size(file) != diskcache_entry_size(key)) break;
+
+        DiskCacheHeader header;
+        if(storage_file_read(file, &header, sizeof(header)) != sizeof(header)) break;
+        if(header.magic != DISKCACHE_MAGIC || header.version != DISKCACHE_VERSION ||
+           header.path_len != path_len || header.size != key->size ||
+           header.mtime != key->mtime || header.variant != key->variant) {
+            break;
+        }
+        if(storage_file_read(file, bitmap, IMAGE_FRAME_SIZE) != IMAGE_FRAME_SIZE) break;
+
+        // Compare the stored path a chunk at a time, the stack is small
+        char chunk[32];
+        size_t compared = 0;
+        while(compared < path_len) {
+            size_t length = MIN(sizeof(chunk), path_len - compared);
+            if(storage_file_read(file, chunk, length) != length) break;
+            if(memcmp(chunk, key->path + compared, length) != 0) break;
+            compared += length;
+        }
+        hit = compared == path_len;
+    } while(false);
+    storage_file_close(file);
+    storage_file_free(file);
+    return hit;
+}
+
+static size_t diskcache_write(
+    Storage* storage,
+    const char* dir,
+    const ImageCacheKey* key,
+    const uint8_t* bitmap) {
+    char path[DISKCACHE_PATH_MAX];
+    diskcache_entry_path(path, sizeof(path), dir, key);
+
+    DiskCacheHeader header = {
+        .magic = DISKCACHE_MAGIC,
+        .version = DISKCACHE_VERSION,
+        .path_len = strlen(key->path),
+        .size = key->size,
+        .mtime = key->mtime,
+        .variant = key->variant,
+    };
+
+    storage_simply_mkdir(storage, dir);
+    File* file = storage_file_alloc(storage);
+    bool ok = storage_file_open(file, path, FSAM_WRITE, FSOM_CREATE_ALWAYS) &&
+              storage_file_write(file, &header, sizeof(header)) == sizeof(header) &&
+              storage_file_write(file, bitmap, IMAGE_FRAME_SIZE) == IMAGE_FRAME_SIZE &&
+              storage_file_write(file, key->path, header.path_len) == header.path_len;
+    storage_file_close(file);
+    storage_file_free(file);
+
+    if(!ok) {
+        storage_common_remove(storage, path);
+        return 0;
+    }
+    return diskcache_entry_size(key);
+}
+
+bool image_diskcache_load(Storage* storage, const ImageCacheKey* key, uint8_t* bitmap) {
+    if(diskcache_budget == 0) return false;
+    // A baked entry costs one failed open more than one written here
+    return diskcache_read(storage, IMAGE_DISKCACHE_DIR, key, bitmap) ||
+           diskcache_read(storage, IMAGE_DISKCACHE_BAKED_DIR, key, bitmap);
+}
+
+size_t image_diskcache_bake(Storage* storage, const ImageCacheKey* key, const uint8_t* bitmap) {
+    return diskcache_write(storage, IMAGE_DISKCACHE_BAKED_DIR, key, bitmap);
+}
+
+void image_diskcache_store(Storage* storage, const ImageCacheKey* key, const uint8_t* bitmap) {
+    if(diskcache_budget == 0) return;
+    if(diskcache_entry_size(key) > diskcache_budget) return;
+
+    diskcache_count(storage);
+
+    // A stale entry for the same source is replaced
+    char path[DISKCACHE_PATH_MAX];
+    diskcache_entry_path(path, sizeof(path), IMAGE_DISKCACHE_DIR, key);
+    FileInfo info;
+    if(storage_common_stat(storage, path, &info) == FSE_OK) {
+        diskcache_usage -= MIN(diskcache_usage, (uint32_t)info.size);
+    }
+
+    diskcache_usage += diskcache_write(storage, IMAGE_DISKCACHE_DIR, key, bitmap);
+    if(diskcache_usage > diskcache_budget) diskcache_evict(storage);
+}
+
+void image_diskcache_set_budget(uint32_t budget) {
+    diskcache_budget = budget;
+}
+
+uint32_t image_diskcache_get_budget(void) {
+    return diskcache_budget;
+}
+
+uint32_t image_diskcache_get_usage(Storage* storage) {
+    diskcache_count(storage);
+    return diskcache_usage;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <storage/storage.h>
+#include "cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IMAGE_DISKCACHE_DIR       APP_DATA_PATH("frames")
+#define IMAGE_DISKCACHE_BAKED_DIR APP_DATA_PATH("baked")
+
+// Default limit on the bytes of converted frames kept on the card
+#define IMAGE_DISKCACHE_DEFAULT_BUDGET (256 * 1024)
+
+// Converted frames on the SD card, one file per source path and conversion
+// variant: a header with the key, the 1 KB bitmap and the source path. A
+// repeat view is one open, a 20 byte header read and a 1 KB bitmap read.
+// Entries whose source changed size or timestamp are rewritten in place.
+// The total size is counted on first use and kept up to date; when it goes
+// over the budget the oldest written entries are deleted until it is down
+// to three quarters of it. Meant for a single thread, the decode worker.
+//
+// Entries baked on a workstation go in a directory of their own that is
+// looked in after the main one. They are outside the budget and never
+// evicted, so a gallery baked in advance stays whole; a source changed
+// since gets a fresh entry in the main directory, which is found first.
+
+// Read the frame for `key`; false if there is none or it is stale. `bitmap`
+// may be overwritten either way.
+bool image_diskcache_load(Storage* storage, const ImageCacheKey* key, uint8_t* bitmap);
+
+// Save a converted frame, evicting older entries to stay within the budget
+void image_diskcache_store(Storage* storage, const ImageCacheKey* key, const uint8_t* bitmap);
+
+// Write the entry for `key` into the baked directory, for tools that
+// pre-bake a cache onto a card image. Returns the bytes written, 0 on
+// failure.
+size_t image_diskcache_bake(Storage* storage, const ImageCacheKey* key, const uint8_t* bitmap);
+
+// Budget in bytes of cache files; 0 disables the cache
+void image_diskcache_set_budget(uint32_t budget);
+uint32_t image_diskcache_get_budget(void);
+
+// Bytes of cache files under the budget, counting them if not done yet
+uint32_t image_diskcache_get_usage(Storage* storage);
+
+#ifdef __cplusplus
+}
+#endif
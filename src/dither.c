@@ -0,0 +1,147 @@
+#include <furi.h>
+#include <furi_hal.h>
+#include "dither.h"
+
+static const uint8_t dither_bayer4[4][4] = {
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5},
+};
+
+static const uint8_t dither_bayer8[8][8] = {
+    {0, 32, 8, 40, 2, 34, 10, 42},
+    {48, 16, 56, 24, 50, 18, 58, 26},
+    {12, 44, 4, 36, 14, 46, 6, 38},
+    {60, 28, 52, 20, 62, 30, 54, 22},
+    {3, 35, 11, 43, 1, 33, 9, 41},
+    {51, 19, 59, 27, 49, 17, 57, 25},
+    {15, 47, 7, 39, 13, 45, 5, 37},
+    {63, 31, 55, 23, 61, 29, 53, 21},
+};
+
+static inline uint32_t dither_cycles(void) {
+    return furi_hal_cortex_timer_get(0).start;
+}
+
+void image_dither_init(ImageDither* dither, ImageDitherMode mode) {
+    dither->mode = mode;
+    dither->rows_done = 0;
+    dither->cycles = 0;
+    memset(dither->error, 0, sizeof(dither->error));
+}
+
+// Quantize a pixel plus its accumulated error (1/16 units) and return the
+// residual, still in whole pixel units
+static inline int32_t dither_quantize(uint8_t* pixel, int16_t error) {
+    int32_t value = *pixel + ((error + 8) >> 4);
+    uint8_t out = value >= 128 ? 255 : 0;
+    *pixel = out;
+    return value - out;
+}
+
+static void dither_floyd_steinberg(ImageDither* dither, uint8_t* line) {
+    int16_t* cur = dither->error[dither->rows_done & 1] + IMAGE_DITHER_PAD;
+    int16_t* next = dither->error[(dither->rows_done + 1) & 1] + IMAGE_DITHER_PAD;
+
+    // Serpentine scan keeps the error from drifting towards one edge
+    if(dither->rows_done & 1) {
+        for(int32_t x = IMAGE_OUT_WIDTH - 1; x >= 0; x--) {
+            int32_t err = dither_quantize(&line[x], cur[x]);
+            cur[x - 1] += err * 7;
+            next[x + 1] += err * 3;
+            next[x] += err * 5;
+            next[x - 1] += err;
+        }
+    } else {
+        for(int32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+            int32_t err = dither_quantize(&line[x], cur[x]);
+            cur[x + 1] += err * 7;
+            next[x - 1] += err * 3;
+            next[x] += err * 5;
+            next[x + 1] += err;
+        }
+    }
+
+    memset(cur - IMAGE_DITHER_PAD, 0, sizeof(dither->error[0]));
+}
+
+static void dither_sierra_lite(ImageDither* dither, uint8_t* line) {
+    int16_t* cur = dither->error[dither->rows_done & 1] + IMAGE_DITHER_PAD;
+    int16_t* next = dither->error[(dither->rows_done + 1) & 1] + IMAGE_DITHER_PAD;
+
+    if(dither->rows_done & 1) {
+        for(int32_t x = IMAGE_OUT_WIDTH - 1; x >= 0; x--) {
+            int32_t err = dither_quantize(&line[x], cur[x]);
+            cur[x - 1] += err * 8;
+            next[x + 1] += err * 4;
+            next[x] += err * 4;
+        }
+    } else {
+        for(int32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+            int32_t err = dither_quantize(&line[x], cur[x]);
+            cur[x + 1] += err * 8;
+            next[x - 1] += err * 4;
+            next[x] += err * 4;
+        }
+    }
+
+    memset(cur - IMAGE_DITHER_PAD, 0, sizeof(dither->error[0]));
+}
+
+static void dither_atkinson(ImageDither* dither, uint8_t* line) {
+    int16_t* cur = dither->error[dither->rows_done % 3] + IMAGE_DITHER_PAD;
+    int16_t* next = dither->error[(dither->rows_done + 1) % 3] + IMAGE_DITHER_PAD;
+    int16_t* after = dither->error[(dither->rows_done + 2) % 3] + IMAGE_DITHER_PAD;
+
+    // Six taps of 1/8 each; the missing 2/8 is what keeps highlights clean
+    for(int32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+        int32_t err = dither_quantize(&line[x], cur[x]) * 2;
+        cur[x + 1] += err;
+        cur[x + 2] += err;
+        next[x - 1] += err;
+        next[x] += err;
+        next[x + 1] += err;
+        after[x] += err;
+    }
+
+    memset(cur - IMAGE_DITHER_PAD, 0, sizeof(dither->error[0]));
+}
+
+void image_dither_row(ImageDither* dither, uint32_t out_y, uint8_t* line) {
+    uint32_t start = dither_cycles();
+
+    switch(dither->mode) {
+    case ImageDitherFloydSteinberg:
+        dither_floyd_steinberg(dither, line);
+        break;
+    case ImageDitherAtkinson:
+        dither_atkinson(dither, line);
+        break;
+    case ImageDitherSierraLite:
+        dither_sierra_lite(dither, line);
+        break;
+    case ImageDitherBayer4x4: {
+        const uint8_t* pattern = dither_bayer4[out_y & 3];
+        for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+            line[x] = line[x] > pattern[x & 3] * 16 + 8 ? 255 : 0;
+        }
+        break;
+    }
+    case ImageDitherBayer8x8: {
+        const uint8_t* pattern = dither_bayer8[out_y & 7];
+        for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+            line[x] = line[x] > pattern[x & 7] * 4 + 2 ? 255 : 0;
+        }
+        break;
+    }
+    default:
+        for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+            line[x] = line[x] > 128 ? 255 : 0;
+        }
+        break;
+    }
+
+    dither->rows_done++;
+    dither->cycles += dither_cycles() - start;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include "convert.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Error rows are padded by two pixels on each side so kernels never branch
+// on the image edge
+#define IMAGE_DITHER_PAD 2
+
+// Row-streaming ditherer. Error diffusion runs in 1/16 pixel fixed point
+// over a ring of row error buffers (two for Floyd-Steinberg and Sierra Lite,
+// three for Atkinson, which reaches two rows down); no frame-sized state.
+typedef struct {
+    ImageDitherMode mode;
+    uint8_t rows_done;
+    int16_t error[3][IMAGE_OUT_WIDTH + 2 * IMAGE_DITHER_PAD];
+    uint32_t cycles; // CPU cycles spent since init
+} ImageDither;
+
+void image_dither_init(ImageDither* dither, ImageDitherMode mode);
+
+// Dither one 128 sample output row in place to 0/255. Rows must be passed in
+// the order they are produced; out_y only drives the ordered patterns.
+void image_dither_row(ImageDither* dither, uint32_t out_y, uint8_t* line);
+
+#ifdef __cplusplus
+}
+#endif
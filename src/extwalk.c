@@ -1,4 +1,6 @@
 #include "extwalk.h"
+#include "extwalk_index.h"
+#include "trace.h"
 #include <string.h>
 
 #include <furi.h>
@@ -18,18 +20,6 @@ typedef enum {
     EXTWALK_DIRECTORY,
 } ExtwalkType;
 
-typedef enum {
-    EXTWALK_SORT_NONE,
-    EXTWALK_SORT_NAME,
-    EXTWALK_SORT_SIZE,
-    EXTWALK_SORT_DATE,
-} ExtwalkSort;
-
-typedef enum {
-    EXTWALK_ASCENDING,
-    EXTWALK_DESCENDING,
-} ExtwalkOrder;
-
 typedef enum {
     EXTWALK_FILTER_NONE,
     EXTWALK_FILTER_IMAGE,
@@ -177,81 +167,501 @@ typedef struct {
 
 static Storage* storage_ptr;
 
+// Directory being browsed, as a listing when it fits in RAM or else through
+// its on-SD index, and where the last image handed out sits in it, so
+// stepping from that image needs no lookup at all
+static DirectoryList dir_list;
+static ExtwalkIndex* dir_index;
+static uint32_t dir_position;
+static char dir_last[256];
+static ExtwalkSort dir_sort = EXTWALK_SORT_NAME;
+static ExtwalkOrder dir_order = EXTWALK_ASCENDING;
+
+#define TAG "Extwalk"
+
 void extwalk_init(Storage* storage) {
     storage_ptr = storage;
 }
 
-static bool is_image_file(const char* filename) {
+void extwalk_deinit(void) {
+    extwalk_list_free(&dir_list);
+    extwalk_index_close(dir_index);
+    dir_index = NULL;
+    dir_last[0] = '\0';
+}
+
+bool extwalk_is_image_file(const char* filename) {
     const char* ext = strrchr(filename, '.');
     if(!ext) return false;
     return strstr(IMAGE_EXTENSIONS, ext) != NULL;
 }
 
-void extwalk_scan_dir(const char* path, FileFoundCallback callback, void* context) {
-    File* dir = storage_file_alloc(storage_ptr);
-    if(storage_dir_open(dir, path)) {
-        char filename[256];
-        while(storage_dir_read(dir, NULL, filename, sizeof(filename))) {
-            if(is_image_file(filename)) {
-                callback(filename, context);
-            }
-        }
+struct ExtwalkScan {
+    Storage* storage;
+    File* dir; // Deepest directory, NULL when suspended or not yet opened
+    uint8_t depth; // Levels in use, 0 once the walk is finished
+    uint16_t path_len[EXTWALK_SCAN_MAX_DEPTH]; // End of each level in path
+    uint32_t position[EXTWALK_SCAN_MAX_DEPTH]; // Entries read at each level
+    uint32_t list_bytes[EXTWALK_SCAN_MAX_DEPTH]; // Listing size of the images so far
+    bool indexing;
+    uint32_t found;
+    uint32_t dirs;
+    uint32_t indexed;
+    char path[256];
+    char name[256];
+};
+
+ExtwalkScan* extwalk_scan_alloc(Storage* storage, const char* root) {
+    ExtwalkScan* scan = malloc(sizeof(ExtwalkScan));
+    memset(scan, 0, sizeof(ExtwalkScan));
+    scan->storage = storage;
+    if(strlen(root) < sizeof(scan->path)) {
+        strlcpy(scan->path, root, sizeof(scan->path));
+        scan->path_len[0] = strlen(root);
+        scan->depth = 1;
+        scan->dirs = 1;
     }
-    storage_dir_close(dir);
-    storage_file_free(dir);
+    return scan;
 }
 
-bool extwalk_get_next_image(const char* current, char* next, size_t size) {
-    if(!current || !next) return false;
+void extwalk_scan_suspend(ExtwalkScan* scan) {
+    if(!scan->dir) return;
+    storage_dir_close(scan->dir);
+    storage_file_free(scan->dir);
+    scan->dir = NULL;
+}
 
-    // Get directory path
-    char dir_path[256];
-    strncpy(dir_path, current, sizeof(dir_path));
-    char* last_slash = strrchr(dir_path, '/');
-    if(last_slash) *last_slash = '\0';
+void extwalk_scan_free(ExtwalkScan* scan) {
+    extwalk_scan_suspend(scan);
+    free(scan);
+}
 
-    // Open directory
-    File* dir = storage_file_alloc(storage_ptr);
-    if(!storage_dir_open(dir, dir_path)) {
-        storage_file_free(dir);
-        return false;
-    }
+void extwalk_scan_set_indexing(ExtwalkScan* scan, bool indexing) {
+    scan->indexing = indexing;
+}
+
+uint32_t extwalk_scan_get_found(const ExtwalkScan* scan) {
+    return scan->found;
+}
 
-    char filename[256];
-    bool found_current = false;
-    bool found_next = false;
+uint32_t extwalk_scan_get_dirs(const ExtwalkScan* scan) {
+    return scan->dirs;
+}
 
-    // Scan directory
-    while(storage_dir_read(dir, NULL, filename, sizeof(filename))) {
-        if(!found_current) {
-            // Look for current file
-            if(strstr(current, filename)) {
-                found_current = true;
+uint32_t extwalk_scan_get_indexed(const ExtwalkScan* scan) {
+    return scan->indexed;
+}
+
+// Open the deepest directory and skip the entries it already produced
+static bool extwalk_scan_reopen(ExtwalkScan* scan) {
+    uint8_t level = scan->depth - 1;
+    scan->dir = storage_file_alloc(scan->storage);
+    if(!storage_dir_open(scan->dir, scan->path)) return false;
+
+    for(uint32_t i = 0; i < scan->position[level]; i++) {
+        if(!storage_dir_read(scan->dir, NULL, scan->name, sizeof(scan->name))) break;
+    }
+    return true;
+}
+
+bool extwalk_scan_step(
+    ExtwalkScan* scan,
+    FileFoundCallback callback,
+    void* context,
+    uint32_t budget) {
+    image_trace_begin("extwalk_scan_step");
+    while(scan->depth && budget) {
+        uint8_t level = scan->depth - 1;
+        size_t len = scan->path_len[level];
+        scan->path[len] = '\0';
+
+        FileInfo info;
+        bool opened = scan->dir || extwalk_scan_reopen(scan);
+        if(!opened || !storage_dir_read(scan->dir, &info, scan->name, sizeof(scan->name))) {
+            // Directory finished (or unreadable): back to the parent. Every
+            // entry has been read, so the index needs no count of its own.
+            extwalk_scan_suspend(scan);
+            if(opened && scan->indexing && scan->list_bytes[level] > EXTWALK_LIST_MAX_BYTES &&
+               extwalk_index_prepare(scan->storage, scan->path, scan->position[level])) {
+                scan->indexed++;
             }
+            scan->depth--;
+            continue;
+        }
+        scan->position[level]++;
+        budget--;
+
+        size_t name_len = strlen(scan->name);
+        if(scan->name[0] == '.' || len + 1 + name_len >= sizeof(scan->path)) continue;
+
+        bool is_dir = file_info_is_dir(&info);
+        if(is_dir ? scan->depth == EXTWALK_SCAN_MAX_DEPTH : !extwalk_is_image_file(scan->name)) {
+            continue;
+        }
+        scan->path[len] = '/';
+        memcpy(scan->path + len + 1, scan->name, name_len + 1);
+
+        if(is_dir) {
+            extwalk_scan_suspend(scan);
+            scan->path_len[scan->depth] = strlen(scan->path);
+            scan->position[scan->depth] = 0;
+            scan->list_bytes[scan->depth] = 0;
+            scan->depth++;
+            scan->dirs++;
         } else {
-            // Look for next image file
-            if(is_image_file(filename)) {
-                snprintf(next, size, "%s/%s", dir_path, filename);
-                found_next = true;
-                break;
+            scan->found++;
+            scan->list_bytes[level] += sizeof(DirectoryEntry) + name_len + 1;
+            callback(scan->path, context);
+        }
+    }
+    image_trace_end("extwalk_scan_step");
+    return scan->depth > 0;
+}
+
+static inline bool extwalk_is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static inline char extwalk_lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+int extwalk_name_compare(const char* a, const char* b) {
+    const char* pa = a;
+    const char* pb = b;
+
+    while(*pa && *pb) {
+        if(extwalk_is_digit(*pa) && extwalk_is_digit(*pb)) {
+            // Digit runs compare as numbers: longer (without leading zeros)
+            // is larger, equal lengths compare digit by digit
+            while(*pa == '0') pa++;
+            while(*pb == '0') pb++;
+            const char* ea = pa;
+            const char* eb = pb;
+            while(extwalk_is_digit(*ea)) ea++;
+            while(extwalk_is_digit(*eb)) eb++;
+            if(ea - pa != eb - pb) return (ea - pa) < (eb - pb) ? -1 : 1;
+            for(; pa < ea; pa++, pb++) {
+                if(*pa != *pb) return *pa < *pb ? -1 : 1;
             }
+        } else {
+            char ca = extwalk_lower(*pa++);
+            char cb = extwalk_lower(*pb++);
+            if(ca != cb) return (uint8_t)ca < (uint8_t)cb ? -1 : 1;
         }
     }
+    if(*pa || *pb) return *pa ? 1 : -1;
+
+    // Names equal up to case and zero padding still need a strict order
+    return strcmp(a, b);
+}
+
+// qsort has no context argument; listings are only sorted from one thread
+static const DirectoryList* sort_list;
+
+static int extwalk_list_compare(const void* a, const void* b) {
+    const DirectoryEntry* ea = a;
+    const DirectoryEntry* eb = b;
+    int order = 0;
+
+    switch(sort_list->sort) {
+    case EXTWALK_SORT_SIZE:
+        order = (ea->size > eb->size) - (ea->size < eb->size);
+        break;
+    case EXTWALK_SORT_DATE:
+        order = (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+        break;
+    default:
+        break;
+    }
+    if(order == 0) {
+        order = extwalk_name_compare(sort_list->arena + ea->name, sort_list->arena + eb->name);
+    }
+    return sort_list->order == EXTWALK_DESCENDING ? -order : order;
+}
+
+// FileInfo carries no timestamp, so dates cost one stat per entry and are
+// only fetched the first time a listing is sorted by date
+static void extwalk_list_fetch_mtimes(DirectoryList* list) {
+    char* path = malloc(512);
+    for(size_t i = 0; i < list->count; i++) {
+        DirectoryEntry* entry = &list->entries[i];
+        snprintf(path, 512, "%s/%s", list->path, list->arena + entry->name);
+        entry->mtime = 0;
+        storage_common_timestamp(storage_ptr, path, &entry->mtime);
+    }
+    free(path);
+    list->have_mtime = true;
+}
+
+void extwalk_list_sort(DirectoryList* list, ExtwalkSort sort, ExtwalkOrder order) {
+    // Keep the cursor on the same image across the re-sort
+    uint32_t cursor_name = list->count ? list->entries[list->cursor].name : 0;
+
+    list->sort = sort;
+    list->order = order;
+    if(sort == EXTWALK_SORT_NONE) return;
+    if(sort == EXTWALK_SORT_DATE && !list->have_mtime) extwalk_list_fetch_mtimes(list);
 
+    sort_list = list;
+    qsort(list->entries, list->count, sizeof(DirectoryEntry), extwalk_list_compare);
+    sort_list = NULL;
+
+    for(size_t i = 0; i < list->count; i++) {
+        if(list->entries[i].name == cursor_name) list->cursor = i;
+    }
+}
+
+static size_t extwalk_list_grown(size_t capacity, size_t needed, size_t initial) {
+    size_t grown = capacity ? capacity : initial;
+    while(grown < needed) grown *= 2;
+    return grown;
+}
+
+// Make room for `entries` entries and `arena` name bytes, doubling both
+// buffers but staying within EXTWALK_LIST_MAX_BYTES
+static bool extwalk_list_reserve(DirectoryList* list, size_t entries, size_t arena) {
+    size_t capacity = extwalk_list_grown(list->capacity, entries, 32);
+    size_t arena_capacity = extwalk_list_grown(list->arena_capacity, arena, 512);
+
+    if(capacity * sizeof(DirectoryEntry) + arena_capacity > EXTWALK_LIST_MAX_BYTES) {
+        // Near the budget, grow only as far as needed
+        capacity = MAX(list->capacity, entries);
+        arena_capacity = MAX(list->arena_capacity, arena);
+        if(capacity * sizeof(DirectoryEntry) + arena_capacity > EXTWALK_LIST_MAX_BYTES) {
+            return false;
+        }
+    }
+
+    if(capacity != list->capacity) {
+        DirectoryEntry* resized = realloc(list->entries, capacity * sizeof(DirectoryEntry));
+        if(!resized) return false;
+        list->entries = resized;
+        list->capacity = capacity;
+    }
+    if(arena_capacity != list->arena_capacity) {
+        char* resized = realloc(list->arena, arena_capacity);
+        if(!resized) return false;
+        list->arena = resized;
+        list->arena_capacity = arena_capacity;
+    }
+    return true;
+}
+
+bool extwalk_list_load(
+    DirectoryList* list,
+    const char* path,
+    ExtwalkSort sort,
+    ExtwalkOrder order) {
+    memset(list, 0, sizeof(DirectoryList));
+    if(strlen(path) >= sizeof(list->path)) return false;
+    strlcpy(list->path, path, sizeof(list->path));
+
+    File* dir = storage_file_alloc(storage_ptr);
+    char* name = malloc(256);
+    bool ok = storage_dir_open(dir, path);
+
+    FileInfo info;
+    while(ok && storage_dir_read(dir, &info, name, 256)) {
+        if(file_info_is_dir(&info) || !extwalk_is_image_file(name)) continue;
+
+        size_t length = strlen(name) + 1;
+        ok = extwalk_list_reserve(list, list->count + 1, list->arena_used + length);
+        if(!ok) break;
+
+        DirectoryEntry* entry = &list->entries[list->count++];
+        entry->name = list->arena_used;
+        entry->size = info.size;
+        entry->mtime = 0;
+        memcpy(list->arena + list->arena_used, name, length);
+        list->arena_used += length;
+    }
     storage_dir_close(dir);
     storage_file_free(dir);
+    free(name);
+
+    if(!ok) {
+        extwalk_list_free(list);
+        return false;
+    }
+
+    // Give the doubling slack back; the listing does not grow after this
+    if(list->count) {
+        DirectoryEntry* entries = realloc(list->entries, list->count * sizeof(DirectoryEntry));
+        if(entries) {
+            list->entries = entries;
+            list->capacity = list->count;
+        }
+        char* arena = realloc(list->arena, list->arena_used);
+        if(arena) {
+            list->arena = arena;
+            list->arena_capacity = list->arena_used;
+        }
+    }
 
-    return found_next;
+    extwalk_list_sort(list, sort, order);
+
+    size_t per_entry = extwalk_list_bytes_per_entry(list);
+    FURI_LOG_I(
+        TAG,
+        "%s: %u images, %u B/entry, ~%u would fit in free heap",
+        path,
+        (unsigned)list->count,
+        (unsigned)per_entry,
+        (unsigned)(per_entry ? memmgr_get_free_heap() / per_entry : 0));
+    return true;
 }
 
-bool extwalk_get_prev_image(const char* current, char* prev, size_t size) {
-    UNUSED(current);
-    UNUSED(prev);
-    UNUSED(size);
-    // TODO: Implement finding previous image
+void extwalk_list_free(DirectoryList* list) {
+    free(list->entries);
+    free(list->arena);
+    memset(list, 0, sizeof(DirectoryList));
+}
+
+const char* extwalk_list_get_name(const DirectoryList* list, size_t index) {
+    if(index >= list->count) return NULL;
+    return list->arena + list->entries[index].name;
+}
+
+bool extwalk_list_seek(DirectoryList* list, const char* name) {
+    for(size_t i = 0; i < list->count; i++) {
+        if(strcmp(list->arena + list->entries[i].name, name) == 0) {
+            list->cursor = i;
+            return true;
+        }
+    }
     return false;
 }
 
+const char* extwalk_list_next(DirectoryList* list) {
+    if(list->cursor + 1 >= list->count) return NULL;
+    return extwalk_list_get_name(list, ++list->cursor);
+}
+
+const char* extwalk_list_prev(DirectoryList* list) {
+    if(list->cursor == 0 || list->cursor >= list->count) return NULL;
+    return extwalk_list_get_name(list, --list->cursor);
+}
+
+size_t extwalk_list_bytes_per_entry(const DirectoryList* list) {
+    if(!list->count) return 0;
+    size_t bytes = list->capacity * sizeof(DirectoryEntry) + list->arena_capacity;
+    return (bytes + list->count - 1) / list->count;
+}
+
+void extwalk_set_sort(ExtwalkSort sort, ExtwalkOrder order) {
+    dir_sort = sort;
+    dir_order = order;
+    if(dir_list.path[0]) {
+        extwalk_list_sort(&dir_list, sort, order);
+    } else if(dir_index && sort != EXTWALK_SORT_NAME) {
+        FURI_LOG_W(TAG, "Directory too large to sort in RAM, keeping name order");
+    }
+}
+
+static bool extwalk_open_dir(const char* current, size_t dir_len) {
+    const char* open_dir = dir_list.path[0] ? dir_list.path :
+                           dir_index        ? extwalk_index_get_dir(dir_index) :
+                                              NULL;
+    if(open_dir && strlen(open_dir) == dir_len && strncmp(open_dir, current, dir_len) == 0) {
+        return true;
+    }
+    extwalk_deinit();
+
+    // Off the stack: the index build below runs deep on the caller's
+    if(dir_len >= sizeof(dir_last)) return false;
+    char* dir_path = malloc(dir_len + 1);
+    memcpy(dir_path, current, dir_len);
+    dir_path[dir_len] = '\0';
+
+    image_trace_begin("extwalk_open_dir");
+    bool opened = extwalk_list_load(&dir_list, dir_path, dir_sort, dir_order);
+    if(!opened) {
+        dir_index = extwalk_index_open(storage_ptr, dir_path);
+        opened = dir_index != NULL;
+    }
+    image_trace_end("extwalk_open_dir");
+    free(dir_path);
+    return opened;
+}
+
+// Point the cursor of the open listing or index at `current`
+static bool extwalk_locate(const char* current, size_t* dir_len) {
+    if(!current) return false;
+
+    const char* slash = strrchr(current, '/');
+    if(!slash) return false;
+    *dir_len = slash - current;
+
+    if(!extwalk_open_dir(current, *dir_len)) return false;
+    if(strcmp(current, dir_last) == 0) return true;
+
+    bool found = dir_list.path[0] ? extwalk_list_seek(&dir_list, slash + 1) :
+                                    extwalk_index_find(dir_index, slash + 1, &dir_position);
+    if(found) strlcpy(dir_last, current, sizeof(dir_last));
+    return found;
+}
+
+// Name `offset` entries away from the cursor, without moving it
+static const char* extwalk_peek(int32_t offset) {
+    int64_t position = (int64_t)(dir_list.path[0] ? dir_list.cursor : dir_position) + offset;
+    if(position < 0) return NULL;
+    return dir_list.path[0] ? extwalk_list_get_name(&dir_list, position) :
+                              extwalk_index_get_name(dir_index, position);
+}
+
+static bool extwalk_step_image(const char* current, int32_t offset, char* out, size_t size) {
+    size_t dir_len;
+    if(!out || !extwalk_locate(current, &dir_len)) return false;
+
+    const char* target = extwalk_peek(offset);
+    if(!target) return false;
+
+    if(dir_list.path[0]) {
+        dir_list.cursor += offset;
+    } else {
+        dir_position += offset;
+    }
+    // Built in dir_last first, so `out` may be `current`
+    snprintf(dir_last, sizeof(dir_last), "%.*s/%s", (int)dir_len, current, target);
+    strlcpy(out, dir_last, size);
+    return true;
+}
+
+bool extwalk_get_next_image(const char* current, char* next, size_t size) {
+    image_trace_begin("extwalk_step");
+    bool found = extwalk_step_image(current, 1, next, size);
+    image_trace_end("extwalk_step");
+    return found;
+}
+
+bool extwalk_get_prev_image(const char* current, char* prev, size_t size) {
+    image_trace_begin("extwalk_step");
+    bool found = extwalk_step_image(current, -1, prev, size);
+    image_trace_end("extwalk_step");
+    return found;
+}
+
+static bool extwalk_find_neighbours(const char* current, char* prev, char* next, size_t size) {
+    size_t dir_len;
+    prev[0] = '\0';
+    next[0] = '\0';
+    if(!extwalk_locate(current, &dir_len)) return false;
+
+    const char* name = extwalk_peek(-1);
+    if(name) snprintf(prev, size, "%.*s/%s", (int)dir_len, current, name);
+    name = extwalk_peek(1);
+    if(name) snprintf(next, size, "%.*s/%s", (int)dir_len, current, name);
+    return true;
+}
+
+bool extwalk_get_neighbours(const char* current, char* prev, char* next, size_t size) {
+    image_trace_begin("extwalk_neighbours");
+    bool found = extwalk_find_neighbours(current, prev, next, size);
+    image_trace_end("extwalk_neighbours");
+    return found;
+}
+
 const char* extwalk_get_extension(const char* filename) {
     const char* ext = strrchr(filename, '.');
     if(ext && ext != filename) {
@@ -3,19 +3,123 @@
 #include <storage/storage.h>
 
 // Supported file extensions
-#define IMAGE_EXTENSIONS ".bmp.png.jpg.jpeg"
+#define IMAGE_EXTENSIONS ".bmp.png.jpg.jpeg.gif"
 
-// Directory info struct
+typedef enum {
+    EXTWALK_SORT_NONE,
+    EXTWALK_SORT_NAME,
+    EXTWALK_SORT_SIZE,
+    EXTWALK_SORT_DATE,
+} ExtwalkSort;
+
+typedef enum {
+    EXTWALK_ASCENDING,
+    EXTWALK_DESCENDING,
+} ExtwalkOrder;
+
+// Largest listing kept in RAM (entries plus names); bigger directories are
+// browsed through the on-SD index in name order
+#define EXTWALK_LIST_MAX_BYTES (16 * 1024)
+
+// One image of a listing; the name lives in the listing's arena
+typedef struct {
+    uint32_t name; // Arena offset of the NUL-terminated name
+    uint32_t size;
+    uint32_t mtime; // Only filled once the listing has been sorted by date
+} DirectoryEntry;
+
+// Images of one directory from a single storage_dir_read pass. Names are
+// packed back to back in one arena instead of being allocated one by one.
 typedef struct {
+    char path[256];
     size_t count;
     size_t capacity;
-    char** items;
+    DirectoryEntry* entries;
+    char* arena;
+    size_t arena_used;
+    size_t arena_capacity;
+    size_t cursor;
+    ExtwalkSort sort;
+    ExtwalkOrder order;
+    bool have_mtime;
 } DirectoryList;
 
+// Receives the full path of each image; the string is only valid during the call
 typedef void (*FileFoundCallback)(const char* filename, void* context);
 
+// Deepest directory level the recursive walk descends to
+#define EXTWALK_SCAN_MAX_DEPTH 8
+
+// Iterative recursive walk over a directory tree. It keeps the current path
+// and, per level, how many entries were already read, so memory is fixed
+// and the walk can be stopped between steps and picked up again. Only the
+// deepest directory is held open; a parent is reopened and fast-forwarded
+// to its saved position when the walk returns to it. Hidden entries are
+// skipped.
+//
+// With indexing on, each directory whose images are too many for a listing
+// in RAM gets its on-SD index built or refreshed once the walk is through
+// it, so browsing there later starts at once.
+typedef struct ExtwalkScan ExtwalkScan;
+
 // File walker API
 void extwalk_init(Storage* storage);
-void extwalk_scan_dir(const char* path, FileFoundCallback callback, void* context);
+void extwalk_deinit(void);
+bool extwalk_is_image_file(const char* filename);
+const char* extwalk_get_extension(const char* filename);
+const char* extwalk_get_mime_type(const char* filename); // NULL if not an image
+
+ExtwalkScan* extwalk_scan_alloc(Storage* storage, const char* root);
+void extwalk_scan_free(ExtwalkScan* scan);
+
+// Off after alloc
+void extwalk_scan_set_indexing(ExtwalkScan* scan, bool indexing);
+
+// Read up to `budget` directory entries, reporting images through the
+// callback. Returns false once the whole tree has been walked.
+bool extwalk_scan_step(
+    ExtwalkScan* scan,
+    FileFoundCallback callback,
+    void* context,
+    uint32_t budget);
+
+// Release the open directory handle, e.g. while a decode needs the card;
+// the next step reopens it where the walk left off
+void extwalk_scan_suspend(ExtwalkScan* scan);
+
+uint32_t extwalk_scan_get_found(const ExtwalkScan* scan);
+uint32_t extwalk_scan_get_dirs(const ExtwalkScan* scan);
+uint32_t extwalk_scan_get_indexed(const ExtwalkScan* scan); // Indexes brought up to date
+
+// Listing API. load fails if the directory does not fit in
+// EXTWALK_LIST_MAX_BYTES or the heap; entries sort by natural name order
+// (img2 before img10), size or date, with ties going by name.
+bool extwalk_list_load(
+    DirectoryList* list,
+    const char* path,
+    ExtwalkSort sort,
+    ExtwalkOrder order);
+void extwalk_list_free(DirectoryList* list);
+void extwalk_list_sort(DirectoryList* list, ExtwalkSort sort, ExtwalkOrder order);
+const char* extwalk_list_get_name(const DirectoryList* list, size_t index);
+bool extwalk_list_seek(DirectoryList* list, const char* name);
+const char* extwalk_list_next(DirectoryList* list);
+const char* extwalk_list_prev(DirectoryList* list);
+size_t extwalk_list_bytes_per_entry(const DirectoryList* list);
+
+// Natural, case-insensitive name order shared by the listing and the index
+int extwalk_name_compare(const char* a, const char* b);
+
+// Order used when browsing; re-sorts the listing of the current directory
+void extwalk_set_sort(ExtwalkSort sort, ExtwalkOrder order);
+
+// Neighbours of `current` (a full path) in its directory, in sorted order.
+// Backed by an in-memory listing, or by the persistent per-directory index
+// (see extwalk_index.h) when the directory is too large for one. The result
+// may be written over `current`; it is left alone when there is none.
 bool extwalk_get_next_image(const char* current, char* next, size_t size);
 bool extwalk_get_prev_image(const char* current, char* prev, size_t size);
+
+// Both neighbours at once, leaving `current` as the position the next step
+// starts from; a missing neighbour comes back as an empty string
+bool extwalk_get_neighbours(const char* current, char* prev, char* next, size_t size);
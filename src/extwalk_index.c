@@ -0,0 +1,801 @@
+#include <furi.h>
+#include <stdlib.h>
+#include <string.h>
+#include <storage/storage.h>
+#include "extwalk.h"
+#include "extwalk_index.h"
+#include "trace.h"
+
+#define TAG "ExtwalkIndex"
+
+#define INDEX_DIR     APP_DATA_PATH("index")
+#define INDEX_MAGIC   0x58495649 // "IVIX"
+#define INDEX_VERSION 2
+
+#define INDEX_NAME_MAX 256
+#define INDEX_PATH_MAX 64
+
+// Names are sorted in memory this many at a time, each batch becoming a run
+#define INDEX_BATCH_NAMES 64
+#define INDEX_BATCH_BYTES 2048
+
+// Runs waiting to be merged, at most; equal sized ones are merged as soon
+// as they meet, so this covers 2^24 batches
+#define INDEX_MAX_RUNS 24
+
+// Merges read and write both files through buffers this large, so a name
+// costs a fraction of a storage call rather than several
+#define INDEX_BLOCK_SIZE 256
+
+// A refresh holds a hash of every old name in RAM, and is only tried with
+// this much heap left over besides; otherwise the index is rebuilt
+#define INDEX_HEAP_RESERVE (16 * 1024)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t path_len;
+    uint32_t count;
+    uint32_t dir_entries; // Every entry of the directory, images or not
+    uint32_t dir_mtime;
+} IndexHeader;
+
+struct ExtwalkIndex {
+    File* idx;
+    File* nam;
+    IndexHeader header;
+    uint32_t offsets_at; // Offset table position in the .idx file
+    char dir[INDEX_NAME_MAX];
+    char name[INDEX_NAME_MAX]; // Scratch for get_name
+};
+
+// Buffered sequential access to one file of an index being merged
+typedef struct {
+    File* file;
+    uint32_t size; // Bytes in data; a write buffer is flushed when full
+    uint32_t position;
+    uint8_t data[INDEX_BLOCK_SIZE];
+} IndexStream;
+
+typedef struct {
+    IndexStream idx;
+    IndexStream nam;
+    IndexHeader header;
+    uint32_t offset;
+} IndexWriter;
+
+// Names of a stale index as sorted hashes, and which of them were found in
+// the directory again
+typedef struct {
+    uint32_t* hashes;
+    uint8_t* present; // Bitset over hashes
+    uint32_t count;
+    bool clash; // Two directory names share a hash
+} IndexKnown;
+
+// One side of a merge: an index read front to back, or a sorted array of
+// names. A source with neither is empty.
+typedef struct {
+    IndexStream idx;
+    IndexStream nam;
+    const IndexKnown* known; // Names not present in it are dropped; NULL keeps all
+    const char** names;
+    uint32_t count;
+    uint32_t position;
+    uint32_t offset; // End of the last name read from nam
+    bool failed;
+    const char* current;
+    char name[INDEX_NAME_MAX];
+} IndexSource;
+
+// Sorted runs written so far, oldest first, and their sizes in batches
+typedef struct {
+    uint32_t batches[INDEX_MAX_RUNS];
+    uint8_t count;
+    uint8_t written; // Run files created, to be removed at the end
+} IndexRuns;
+
+// Names read from the directory and not yet written out as a run
+typedef struct {
+    const char* names[INDEX_BATCH_NAMES];
+    char arena[INDEX_BATCH_BYTES];
+    uint32_t count;
+    uint32_t used;
+} IndexBatch;
+
+int extwalk_index_compare(const char* a, const char* b) {
+    return extwalk_name_compare(a, b);
+}
+
+static int index_compare_sort(const void* a, const void* b) {
+    return extwalk_index_compare(*(const char* const*)a, *(const char* const*)b);
+}
+
+static int index_compare_hash(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// FNV-1a
+static uint32_t index_hash(const char* text) {
+    uint32_t hash = 2166136261UL;
+    for(const char* p = text; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619UL;
+    }
+    return hash;
+}
+
+// Index files are named after a hash of the directory path; the full path is
+// stored in the header to catch collisions
+static void index_base_path(char* out, size_t size, const char* dir, const char* tag) {
+    snprintf(out, size, "%s/%08lx%s", INDEX_DIR, (unsigned long)index_hash(dir), tag);
+}
+
+static void index_file_path(char* out, size_t size, const char* base, const char* ext) {
+    snprintf(out, size, "%s%s", base, ext);
+}
+
+static bool index_replace(Storage* storage, const char* from, const char* to) {
+    static const char* const exts[] = {".idx", ".nam"};
+    char src[INDEX_PATH_MAX];
+    char dst[INDEX_PATH_MAX];
+
+    for(size_t i = 0; i < COUNT_OF(exts); i++) {
+        index_file_path(src, sizeof(src), from, exts[i]);
+        index_file_path(dst, sizeof(dst), to, exts[i]);
+        storage_common_remove(storage, dst);
+        if(storage_common_rename(storage, src, dst) != FSE_OK) return false;
+    }
+    return true;
+}
+
+static void index_remove(Storage* storage, const char* base) {
+    char path[INDEX_PATH_MAX];
+    index_file_path(path, sizeof(path), base, ".idx");
+    storage_common_remove(storage, path);
+    index_file_path(path, sizeof(path), base, ".nam");
+    storage_common_remove(storage, path);
+}
+
+static ExtwalkIndex* index_load(Storage* storage, const char* base) {
+    ExtwalkIndex* index = malloc(sizeof(ExtwalkIndex));
+    index->idx = storage_file_alloc(storage);
+    index->nam = storage_file_alloc(storage);
+
+    char path[INDEX_PATH_MAX];
+    bool ok = false;
+    do {
+        index_file_path(path, sizeof(path), base, ".idx");
+        if(!storage_file_open(index->idx, path, FSAM_READ, FSOM_OPEN_EXISTING)) break;
+        index_file_path(path, sizeof(path), base, ".nam");
+        if(!storage_file_open(index->nam, path, FSAM_READ, FSOM_OPEN_EXISTING)) break;
+
+        IndexHeader* header = &index->header;
+        if(storage_file_read(index->idx, header, sizeof(IndexHeader)) != sizeof(IndexHeader)) {
+            break;
+        }
+        if(header->magic != INDEX_MAGIC || header->version != INDEX_VERSION) break;
+        if(header->path_len >= sizeof(index->dir)) break;
+        if(storage_file_read(index->idx, index->dir, header->path_len) != header->path_len) {
+            break;
+        }
+        index->dir[header->path_len] = '\0';
+        index->offsets_at = sizeof(IndexHeader) + header->path_len;
+        ok = true;
+    } while(false);
+
+    if(!ok) {
+        extwalk_index_close(index);
+        return NULL;
+    }
+    return index;
+}
+
+void extwalk_index_close(ExtwalkIndex* index) {
+    if(!index) return;
+    storage_file_close(index->idx);
+    storage_file_close(index->nam);
+    storage_file_free(index->idx);
+    storage_file_free(index->nam);
+    free(index);
+}
+
+const char* extwalk_index_get_dir(const ExtwalkIndex* index) {
+    return index->dir;
+}
+
+uint32_t extwalk_index_get_count(const ExtwalkIndex* index) {
+    return index->header.count;
+}
+
+const char* extwalk_index_get_name(ExtwalkIndex* index, uint32_t position) {
+    if(position >= index->header.count) return NULL;
+
+    // Offsets i and i + 1 bound the name; the table ends with a sentinel
+    uint32_t range[2];
+    if(!storage_file_seek(index->idx, index->offsets_at + position * sizeof(uint32_t), true) ||
+       storage_file_read(index->idx, range, sizeof(range)) != sizeof(range)) {
+        return NULL;
+    }
+
+    uint32_t length = range[1] - range[0];
+    if(range[1] < range[0] || length >= sizeof(index->name)) return NULL;
+    if(!storage_file_seek(index->nam, range[0], true) ||
+       storage_file_read(index->nam, index->name, length) != length) {
+        return NULL;
+    }
+    index->name[length] = '\0';
+    return index->name;
+}
+
+bool extwalk_index_find(ExtwalkIndex* index, const char* name, uint32_t* position) {
+    uint32_t lo = 0;
+    uint32_t hi = index->header.count;
+
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const char* probe = extwalk_index_get_name(index, mid);
+        if(!probe) return false;
+
+        int order = extwalk_index_compare(probe, name);
+        if(order == 0) {
+            *position = mid;
+            return true;
+        } else if(order < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+static bool index_stream_flush(IndexStream* stream) {
+    uint32_t size = stream->position;
+    stream->position = 0;
+    return storage_file_write(stream->file, stream->data, size) == size;
+}
+
+static bool index_stream_write(IndexStream* stream, const void* data, uint32_t size) {
+    const uint8_t* bytes = data;
+    while(size) {
+        if(stream->position == INDEX_BLOCK_SIZE && !index_stream_flush(stream)) return false;
+        uint32_t chunk = MIN(size, INDEX_BLOCK_SIZE - stream->position);
+        memcpy(stream->data + stream->position, bytes, chunk);
+        stream->position += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+static bool index_stream_read(IndexStream* stream, void* data, uint32_t size) {
+    uint8_t* bytes = data;
+    while(size) {
+        if(stream->position == stream->size) {
+            stream->size = storage_file_read(stream->file, stream->data, INDEX_BLOCK_SIZE);
+            stream->position = 0;
+            if(!stream->size) return false;
+        }
+        uint32_t chunk = MIN(size, stream->size - stream->position);
+        memcpy(bytes, stream->data + stream->position, chunk);
+        stream->position += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+static bool index_writer_open(
+    IndexWriter* writer,
+    Storage* storage,
+    const char* base,
+    const char* dir,
+    const IndexHeader* header) {
+    char path[INDEX_PATH_MAX];
+    memset(writer, 0, sizeof(IndexWriter));
+    writer->idx.file = storage_file_alloc(storage);
+    writer->nam.file = storage_file_alloc(storage);
+    writer->header.magic = INDEX_MAGIC;
+    writer->header.version = INDEX_VERSION;
+    writer->header.path_len = strlen(dir);
+    writer->header.dir_entries = header->dir_entries;
+    writer->header.dir_mtime = header->dir_mtime;
+
+    index_file_path(path, sizeof(path), base, ".idx");
+    if(!storage_file_open(writer->idx.file, path, FSAM_WRITE, FSOM_CREATE_ALWAYS)) return false;
+    index_file_path(path, sizeof(path), base, ".nam");
+    if(!storage_file_open(writer->nam.file, path, FSAM_WRITE, FSOM_CREATE_ALWAYS)) return false;
+
+    // The header is rewritten with the final count once all names are in
+    return index_stream_write(&writer->idx, &writer->header, sizeof(IndexHeader)) &&
+           index_stream_write(&writer->idx, dir, writer->header.path_len);
+}
+
+static bool index_writer_add(IndexWriter* writer, const char* name) {
+    uint32_t length = strlen(name);
+    if(!index_stream_write(&writer->idx, &writer->offset, sizeof(uint32_t)) ||
+       !index_stream_write(&writer->nam, name, length)) {
+        return false;
+    }
+    writer->offset += length;
+    writer->header.count++;
+    return true;
+}
+
+static bool index_writer_finish(IndexWriter* writer, bool ok) {
+    if(ok) {
+        ok = index_stream_write(&writer->idx, &writer->offset, sizeof(uint32_t)) &&
+             index_stream_flush(&writer->idx) && index_stream_flush(&writer->nam) &&
+             storage_file_seek(writer->idx.file, 0, true) &&
+             storage_file_write(writer->idx.file, &writer->header, sizeof(IndexHeader)) ==
+                 sizeof(IndexHeader);
+    }
+    storage_file_close(writer->idx.file);
+    storage_file_close(writer->nam.file);
+    storage_file_free(writer->idx.file);
+    storage_file_free(writer->nam.file);
+    return ok;
+}
+
+// Read the index at `base` front to back as a merge source
+static bool index_source_open(IndexSource* source, Storage* storage, const char* base) {
+    char path[INDEX_PATH_MAX];
+    memset(source, 0, sizeof(IndexSource));
+    source->idx.file = storage_file_alloc(storage);
+    source->nam.file = storage_file_alloc(storage);
+
+    IndexHeader header;
+    index_file_path(path, sizeof(path), base, ".idx");
+    if(!storage_file_open(source->idx.file, path, FSAM_READ, FSOM_OPEN_EXISTING)) return false;
+    index_file_path(path, sizeof(path), base, ".nam");
+    if(!storage_file_open(source->nam.file, path, FSAM_READ, FSOM_OPEN_EXISTING)) return false;
+    if(!index_stream_read(&source->idx, &header, sizeof(IndexHeader)) ||
+       header.magic != INDEX_MAGIC || header.path_len >= sizeof(source->name) ||
+       !index_stream_read(&source->idx, source->name, header.path_len) ||
+       !index_stream_read(&source->idx, &source->offset, sizeof(uint32_t))) {
+        return false;
+    }
+    source->count = header.count;
+    return true;
+}
+
+static void index_source_close(IndexSource* source) {
+    if(!source->idx.file) return;
+    storage_file_close(source->idx.file);
+    storage_file_close(source->nam.file);
+    storage_file_free(source->idx.file);
+    storage_file_free(source->nam.file);
+}
+
+// Slot of `name` among the known hashes, or -1
+static int32_t index_known_find(const IndexKnown* known, const char* name) {
+    uint32_t hash = index_hash(name);
+    const uint32_t* found =
+        bsearch(&hash, known->hashes, known->count, sizeof(uint32_t), index_compare_hash);
+    return found ? found - known->hashes : -1;
+}
+
+// Mark a directory name as present; false if it is not a known one
+static bool index_known_mark(IndexKnown* known, const char* name) {
+    int32_t slot = index_known_find(known, name);
+    if(slot < 0) return false;
+
+    // Names in a directory differ, so a slot marked twice is two of them
+    // sharing a hash, one of which may be new
+    uint8_t bit = 1 << (slot & 7);
+    if(known->present[slot >> 3] & bit) known->clash = true;
+    known->present[slot >> 3] |= bit;
+    return true;
+}
+
+static bool index_known_present(const IndexKnown* known, const char* name) {
+    int32_t slot = index_known_find(known, name);
+    return slot >= 0 && (known->present[slot >> 3] & (1 << (slot & 7)));
+}
+
+static void index_known_free(IndexKnown* known) {
+    free(known->hashes);
+    free(known->present);
+    memset(known, 0, sizeof(IndexKnown));
+}
+
+static void index_source_next(IndexSource* source) {
+    source->current = NULL;
+    while(source->position < source->count) {
+        if(source->names) {
+            source->current = source->names[source->position++];
+            return;
+        }
+
+        // Offsets i and i + 1 bound name i; the table ends with a sentinel
+        uint32_t end;
+        if(!index_stream_read(&source->idx, &end, sizeof(uint32_t)) || end < source->offset ||
+           end - source->offset >= sizeof(source->name) ||
+           !index_stream_read(&source->nam, source->name, end - source->offset)) {
+            source->failed = true;
+            return;
+        }
+        source->name[end - source->offset] = '\0';
+        source->offset = end;
+        source->position++;
+
+        // Names that left the directory are dropped on a refresh
+        if(source->known && !index_known_present(source->known, source->name)) continue;
+        source->current = source->name;
+        return;
+    }
+}
+
+// Hash every name of the index at `base`. False, with nothing held, if the
+// index cannot be read, the heap has no room for the hashes or two names
+// share one.
+static bool index_known_load(IndexKnown* known, Storage* storage, const char* base) {
+    memset(known, 0, sizeof(IndexKnown));
+    IndexSource* source = malloc(sizeof(IndexSource));
+    bool ok = index_source_open(source, storage, base);
+
+    size_t hashes_size = (source->count + 1) * sizeof(uint32_t);
+    size_t present_size = source->count / 8 + 1;
+    if(ok && hashes_size + present_size + INDEX_HEAP_RESERVE < memmgr_get_free_heap()) {
+        known->hashes = malloc(hashes_size);
+        known->present = malloc(present_size);
+        memset(known->present, 0, present_size);
+        for(index_source_next(source); source->current; index_source_next(source)) {
+            known->hashes[known->count++] = index_hash(source->current);
+        }
+        ok = !source->failed && known->count == source->count;
+    } else {
+        ok = false;
+    }
+    index_source_close(source);
+    free(source);
+
+    if(ok) {
+        qsort(known->hashes, known->count, sizeof(uint32_t), index_compare_hash);
+        for(uint32_t i = 1; ok && i < known->count; i++) {
+            ok = known->hashes[i] != known->hashes[i - 1];
+        }
+    }
+    if(!ok) index_known_free(known);
+    return ok;
+}
+
+// Write the ordered union of two sources as a new index
+static bool index_merge(
+    Storage* storage,
+    IndexSource* a,
+    IndexSource* b,
+    const char* base,
+    const char* dir,
+    const IndexHeader* header) {
+    IndexWriter* writer = malloc(sizeof(IndexWriter));
+    bool ok = index_writer_open(writer, storage, base, dir, header);
+
+    index_source_next(a);
+    index_source_next(b);
+    while(ok && (a->current || b->current)) {
+        IndexSource* next;
+        if(!b->current) {
+            next = a;
+        } else if(!a->current) {
+            next = b;
+        } else {
+            next = extwalk_index_compare(a->current, b->current) <= 0 ? a : b;
+        }
+        ok = index_writer_add(writer, next->current);
+        index_source_next(next);
+    }
+    ok = ok && !a->failed && !b->failed;
+
+    ok = index_writer_finish(writer, ok);
+    free(writer);
+    return ok;
+}
+
+// Sort the batch and write it out as an index of its own
+static bool index_write_batch(
+    Storage* storage,
+    IndexBatch* batch,
+    const char* base,
+    const char* dir,
+    const IndexHeader* header) {
+    qsort(batch->names, batch->count, sizeof(const char*), index_compare_sort);
+    IndexSource* sources = malloc(sizeof(IndexSource) * 2);
+    memset(sources, 0, sizeof(IndexSource) * 2);
+    sources[0].names = batch->names;
+    sources[0].count = batch->count;
+
+    bool ok = index_merge(storage, &sources[0], &sources[1], base, dir, header);
+    batch->count = 0;
+    batch->used = 0;
+    free(sources);
+    return ok;
+}
+
+static void index_run_base(char* out, size_t size, const char* dir, uint8_t run) {
+    char tag[8];
+    snprintf(tag, sizeof(tag), ".r%u", run);
+    index_base_path(out, size, dir, tag);
+}
+
+// Merge run `first` with the one after it, or copy it alone when `pair` is
+// false, into a new index at `base`
+static bool index_merge_runs(
+    Storage* storage,
+    const char* dir,
+    uint8_t first,
+    bool pair,
+    const char* base,
+    const IndexHeader* header) {
+    char run_base[INDEX_PATH_MAX];
+    IndexSource* sources = malloc(sizeof(IndexSource) * 2);
+    memset(&sources[1], 0, sizeof(IndexSource));
+
+    index_run_base(run_base, sizeof(run_base), dir, first);
+    bool ok = index_source_open(&sources[0], storage, run_base);
+    if(pair) {
+        index_run_base(run_base, sizeof(run_base), dir, first + 1);
+        ok = index_source_open(&sources[1], storage, run_base) && ok;
+    }
+    ok = ok && index_merge(storage, &sources[0], &sources[1], base, dir, header);
+
+    index_source_close(&sources[0]);
+    index_source_close(&sources[1]);
+    free(sources);
+    return ok;
+}
+
+// Write the batch out as the newest run, then merge the newest two runs for
+// as long as they are the same size. Every name is rewritten once per
+// doubling of its run, O(log n) times in all.
+static bool index_push_run(
+    Storage* storage,
+    IndexBatch* batch,
+    IndexRuns* runs,
+    const char* dir,
+    const char* tmp_base) {
+    if(runs->count == INDEX_MAX_RUNS) return false;
+
+    char run_base[INDEX_PATH_MAX];
+    IndexHeader header = {0};
+    index_run_base(run_base, sizeof(run_base), dir, runs->count);
+    bool ok = index_write_batch(storage, batch, run_base, dir, &header);
+    runs->batches[runs->count++] = 1;
+    runs->written = MAX(runs->written, runs->count);
+
+    while(ok && runs->count >= 2 &&
+          runs->batches[runs->count - 1] == runs->batches[runs->count - 2]) {
+        uint8_t first = runs->count - 2;
+        index_run_base(run_base, sizeof(run_base), dir, first);
+        ok = index_merge_runs(storage, dir, first, true, tmp_base, &header) &&
+             index_replace(storage, tmp_base, run_base);
+        runs->batches[first] *= 2;
+        runs->count--;
+    }
+    return ok;
+}
+
+// Merge the newest runs pairwise until `keep` are left, smallest first
+static bool index_fold_runs(
+    Storage* storage,
+    IndexRuns* runs,
+    const char* dir,
+    const char* tmp_base,
+    uint8_t keep) {
+    char run_base[INDEX_PATH_MAX];
+    IndexHeader header = {0};
+    bool ok = true;
+    while(ok && runs->count > keep) {
+        uint8_t first = runs->count - 2;
+        index_run_base(run_base, sizeof(run_base), dir, first);
+        ok = index_merge_runs(storage, dir, first, true, tmp_base, &header) &&
+             index_replace(storage, tmp_base, run_base);
+        runs->batches[first] += runs->batches[first + 1];
+        runs->count--;
+    }
+    return ok;
+}
+
+// Write the old index at `base`, less the names no longer present, merged
+// with the new names: run 0 if there is one, else those left in the batch
+static bool index_merge_refresh(
+    Storage* storage,
+    const char* dir,
+    const char* base,
+    const IndexKnown* known,
+    IndexBatch* batch,
+    bool from_run,
+    const char* tmp_base,
+    const IndexHeader* header) {
+    char run_base[INDEX_PATH_MAX];
+    IndexSource* sources = malloc(sizeof(IndexSource) * 2);
+    memset(&sources[1], 0, sizeof(IndexSource));
+
+    bool ok = index_source_open(&sources[0], storage, base);
+    sources[0].known = known;
+    if(from_run) {
+        index_run_base(run_base, sizeof(run_base), dir, 0);
+        ok = index_source_open(&sources[1], storage, run_base) && ok;
+    } else {
+        qsort(batch->names, batch->count, sizeof(const char*), index_compare_sort);
+        sources[1].names = batch->names;
+        sources[1].count = batch->count;
+    }
+    ok = ok && index_merge(storage, &sources[0], &sources[1], tmp_base, dir, header);
+
+    index_source_close(&sources[0]);
+    index_source_close(&sources[1]);
+    free(sources);
+    return ok;
+}
+
+// Build the index at `base` from the directory. Names are sorted a batch at
+// a time into runs on the card and the runs merged pairwise, so the listing
+// is never held in RAM and building stays O(n log n) in storage calls.
+//
+// A refresh only runs the names missing from the old index through that,
+// and merges the result with the old index in one pass. Old names are
+// matched by hash, in RAM; it fails, leaving the old index as it was, if
+// they do not fit or two directory names share a hash. A new name sharing
+// a hash with a removed one would be taken for it, about one refresh in
+// 2^32 / (added * removed); the next change to the directory fixes that.
+static bool index_build(
+    Storage* storage,
+    const char* dir,
+    const char* base,
+    uint32_t dir_mtime,
+    bool refresh) {
+    IndexKnown known;
+    if(refresh && !index_known_load(&known, storage, base)) return false;
+
+    char tmp_base[INDEX_PATH_MAX];
+    index_base_path(tmp_base, sizeof(tmp_base), dir, ".tmp");
+
+    IndexBatch* batch = malloc(sizeof(IndexBatch));
+    IndexRuns* runs = malloc(sizeof(IndexRuns));
+    char* name = malloc(INDEX_NAME_MAX);
+    batch->count = 0;
+    batch->used = 0;
+    memset(runs, 0, sizeof(IndexRuns));
+
+    IndexHeader header = {.dir_entries = 0, .dir_mtime = dir_mtime};
+    bool ok = true;
+
+    File* dir_file = storage_file_alloc(storage);
+    if(!storage_dir_open(dir_file, dir)) ok = false;
+
+    FileInfo info;
+    while(ok && storage_dir_read(dir_file, &info, name, INDEX_NAME_MAX)) {
+        header.dir_entries++;
+        if(file_info_is_dir(&info) || !extwalk_is_image_file(name)) continue;
+        if(refresh && index_known_mark(&known, name)) continue;
+
+        size_t length = strlen(name) + 1;
+        if(batch->count == INDEX_BATCH_NAMES || batch->used + length > INDEX_BATCH_BYTES) {
+            ok = index_push_run(storage, batch, runs, dir, tmp_base);
+        }
+        memcpy(batch->arena + batch->used, name, length);
+        batch->names[batch->count++] = batch->arena + batch->used;
+        batch->used += length;
+    }
+    storage_dir_close(dir_file);
+    storage_file_free(dir_file);
+
+    if(refresh) {
+        ok = ok && !known.clash;
+        if(ok && runs->count && batch->count) {
+            ok = index_push_run(storage, batch, runs, dir, tmp_base);
+        }
+        ok = ok && index_fold_runs(storage, runs, dir, tmp_base, 1) &&
+             index_merge_refresh(
+                 storage, dir, base, &known, batch, runs->count, tmp_base, &header);
+        index_known_free(&known);
+    } else if(ok && !runs->count) {
+        // Directories of up to one batch are written out directly
+        ok = index_write_batch(storage, batch, tmp_base, dir, &header);
+    } else if(ok) {
+        if(batch->count) ok = index_push_run(storage, batch, runs, dir, tmp_base);
+
+        // The last merge writes the index itself
+        ok = ok && index_fold_runs(storage, runs, dir, tmp_base, 2) &&
+             index_merge_runs(storage, dir, 0, runs->count == 2, tmp_base, &header);
+    }
+    FURI_LOG_I(
+        TAG,
+        "%s: %lu entries%s",
+        dir,
+        (unsigned long)header.dir_entries,
+        refresh ? ", refreshed" : "");
+
+    ok = ok && index_replace(storage, tmp_base, base);
+    index_remove(storage, tmp_base);
+    for(uint8_t run = 0; run < runs->written; run++) {
+        char run_base[INDEX_PATH_MAX];
+        index_run_base(run_base, sizeof(run_base), dir, run);
+        index_remove(storage, run_base);
+    }
+
+    free(name);
+    free(runs);
+    free(batch);
+    return ok;
+}
+
+static uint32_t index_count_entries(Storage* storage, const char* dir, bool* ok) {
+    File* dir_file = storage_file_alloc(storage);
+    char* name = malloc(INDEX_NAME_MAX);
+    uint32_t entries = 0;
+
+    *ok = storage_dir_open(dir_file, dir);
+    if(*ok) {
+        while(storage_dir_read(dir_file, NULL, name, INDEX_NAME_MAX)) {
+            entries++;
+        }
+    }
+    storage_dir_close(dir_file);
+    storage_file_free(dir_file);
+    free(name);
+    return entries;
+}
+
+// Open the index of a directory with `entries` entries, bringing it up to date
+static ExtwalkIndex* index_open(Storage* storage, const char* dir_path, uint32_t entries) {
+    // FAT only bumps a directory's timestamp on some changes, hence the count
+    uint32_t mtime = 0;
+    storage_common_timestamp(storage, dir_path, &mtime);
+
+    char base[INDEX_PATH_MAX];
+    index_base_path(base, sizeof(base), dir_path, "");
+    storage_simply_mkdir(storage, INDEX_DIR);
+
+    ExtwalkIndex* index = index_load(storage, base);
+    if(index && strcmp(index->dir, dir_path) != 0) {
+        // Hash collision with another directory: start over
+        extwalk_index_close(index);
+        index = NULL;
+    }
+    if(index && index->header.dir_mtime == mtime && index->header.dir_entries == entries) {
+        return index;
+    }
+    bool stale = index != NULL;
+    extwalk_index_close(index);
+
+    // A stale index is refreshed if it can be, rebuilt otherwise
+    bool built = false;
+    if(stale) {
+        image_trace_begin("extwalk_index_refresh");
+        built = index_build(storage, dir_path, base, mtime, true);
+        image_trace_end("extwalk_index_refresh");
+    }
+    if(!built) {
+        image_trace_begin("extwalk_index_build");
+        built = index_build(storage, dir_path, base, mtime, false);
+        image_trace_end("extwalk_index_build");
+    }
+    if(!built) {
+        FURI_LOG_E(TAG, "Failed to build index for %s", dir_path);
+        index_remove(storage, base);
+        return NULL;
+    }
+    return index_load(storage, base);
+}
+
+ExtwalkIndex* extwalk_index_open(Storage* storage, const char* dir_path) {
+    if(strlen(dir_path) >= INDEX_NAME_MAX) return NULL;
+
+    bool dir_ok;
+    image_trace_begin("extwalk_index_count");
+    uint32_t entries = index_count_entries(storage, dir_path, &dir_ok);
+    image_trace_end("extwalk_index_count");
+    if(!dir_ok) return NULL;
+    return index_open(storage, dir_path, entries);
+}
+
+bool extwalk_index_prepare(Storage* storage, const char* dir_path, uint32_t dir_entries) {
+    if(strlen(dir_path) >= INDEX_NAME_MAX) return false;
+    ExtwalkIndex* index = index_open(storage, dir_path, dir_entries);
+    extwalk_index_close(index);
+    return index != NULL;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <storage/storage.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Persistent, sorted index of the image files in one directory, kept in the
+// app data folder as a pair of files: <hash>.idx (header, directory path and
+// a table of name offsets) and <hash>.nam (the names back to back). Entry i
+// is two seeks away, and lookups by name are a binary search over the table.
+//
+// The index records the directory timestamp and its total entry count. When
+// either differs on open, it is refreshed: names not in it yet are sorted
+// and merged with the old entries in one pass, dropping those that are gone.
+// A first build sorts the names in fixed size batches, each written out as
+// a run, and merges runs of equal size, so the whole listing is never held
+// in RAM and each name is rewritten O(log n) times.
+typedef struct ExtwalkIndex ExtwalkIndex;
+
+// Open the index for a directory, building or refreshing it as needed.
+// Returns NULL if the directory cannot be read or the index cannot be written.
+ExtwalkIndex* extwalk_index_open(Storage* storage, const char* dir_path);
+
+void extwalk_index_close(ExtwalkIndex* index);
+
+// Bring the index of a directory up to date without keeping it open, for a
+// walk that has just read all `dir_entries` entries of it. A current index
+// costs a header read and a timestamp, no pass over the directory.
+bool extwalk_index_prepare(Storage* storage, const char* dir_path, uint32_t dir_entries);
+
+// Directory the index describes
+const char* extwalk_index_get_dir(const ExtwalkIndex* index);
+
+uint32_t extwalk_index_get_count(const ExtwalkIndex* index);
+
+// Name of entry `position` in sorted order; the string is owned by the index
+// and valid until the next call. NULL when out of range or on read errors.
+const char* extwalk_index_get_name(ExtwalkIndex* index, uint32_t position);
+
+// Position of `name` in the index
+bool extwalk_index_find(ExtwalkIndex* index, const char* name, uint32_t* position);
+
+// Order of the index: natural name order, as extwalk_name_compare
+int extwalk_index_compare(const char* a, const char* b);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,625 @@
+#include <furi.h>
+#include <storage/storage.h>
+#include <string.h>
+#include "gif.h"
+#include "reader.h"
+
+#define TAG "ImageGif"
+
+#define GIF_HEADER_SIZE     13
+#define GIF_DESCRIPTOR_SIZE 9
+#define GIF_MAX_CODE_BITS   12
+#define GIF_MAX_CODES       (1 << GIF_MAX_CODE_BITS)
+
+// Canvas luma where no frame has drawn; transparency shows the white screen
+#define GIF_BACKGROUND 255
+
+// Delays this short (in 1/100 s) are taken as "as fast as possible" by
+// encoders; they are shown for 100 ms instead
+#define GIF_MIN_DELAY_CS 2
+#define GIF_SLOW_DELAY_CS 10
+
+typedef enum {
+    GifBlockImage,
+    GifBlockTrailer,
+    GifBlockError,
+} GifBlock;
+
+typedef enum {
+    GifDisposeNone = 0,
+    GifDisposeKeep = 1,
+    GifDisposeBackground = 2,
+    GifDisposePrevious = 3,
+} GifDispose;
+
+// Canvas cells a frame covers, inclusive; empty when x0 > x1
+typedef struct {
+    uint8_t x0;
+    uint8_t x1;
+    uint8_t y0;
+    uint8_t y1;
+} GifRect;
+
+// The image being decoded, in screen pixels and clipped to the screen
+typedef struct {
+    uint32_t left;
+    uint32_t top;
+    uint32_t clip_left; // First screen column on the canvas
+    uint32_t right;
+    uint32_t bottom;
+    uint16_t width;
+    uint16_t height;
+    bool interlaced;
+    uint8_t pass;
+    uint16_t row; // Image row receiving pixels
+    uint16_t rows_done;
+    uint16_t x; // Image column of the next pixel
+    uint8_t cell; // Canvas column of the next pixel when downscaling
+    uint16_t cell_end;
+    const uint8_t* palette;
+    int16_t transparent; // Palette index, -1 for none
+    GifRect rect;
+} GifImage;
+
+struct ImageGif {
+    ImageReader* reader;
+    Storage* storage; // Set when opened for playback, which owns the reader
+    ImageScaler* scaler; // Renders the canvas; owned when opened for playback
+
+    uint16_t screen_width;
+    uint16_t screen_height;
+    uint32_t out_width; // The screen scaled to this; the canvas is a window of it
+    uint32_t out_height;
+    uint32_t window_x;
+    uint32_t window_y;
+    bool screen_ready; // Cell edges laid out, done on the first image
+    bool downscale_x; // Screen at least as wide as the canvas
+    uint16_t col_start[IMAGE_OUT_WIDTH + 1];
+    uint16_t row_start[IMAGE_OUT_HEIGHT + 1];
+    uint8_t global_luma[256];
+    uint8_t local_luma[256];
+    uint32_t first_block; // Offset just past the global palette
+    int32_t loops_left; // Plays after this one, -1 forever
+    bool loop_seen;
+    uint32_t frame; // Frames decoded in this play
+
+    // Graphic control extension for the next image
+    uint8_t dispose;
+    int16_t transparent;
+    uint16_t delay_cs;
+
+    // Owed by the frame on the canvas before the next one is drawn
+    uint8_t pending_dispose;
+    GifRect pending_rect;
+
+    GifImage image;
+    uint32_t row_sum[IMAGE_OUT_WIDTH];
+    uint16_t row_count[IMAGE_OUT_WIDTH];
+    uint16_t band_rows[IMAGE_OUT_HEIGHT]; // Source rows in each canvas row so far
+    uint8_t canvas[IMAGE_OUT_WIDTH * IMAGE_OUT_HEIGHT];
+    uint8_t* saved; // Canvas under a restore-to-previous frame
+
+    // LZW state; codes only ever point at lower codes, so strings are
+    // unwound onto the stack and emitted in reverse
+    uint32_t bits;
+    uint8_t bit_count;
+    uint8_t block_left;
+    bool data_end;
+    uint16_t prefix[GIF_MAX_CODES];
+    uint8_t suffix[GIF_MAX_CODES];
+    uint8_t stack[GIF_MAX_CODES];
+};
+
+static const uint8_t gif_pass_start[4] = {0, 4, 2, 1};
+static const uint8_t gif_pass_step[4] = {8, 8, 4, 2};
+
+static inline uint16_t gif_u16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static inline int gif_byte(ImageGif* gif) {
+    return image_reader_byte(gif->reader);
+}
+
+static inline bool gif_read(ImageGif* gif, uint8_t* data, size_t size) {
+    return image_reader_read(gif->reader, data, size) == size;
+}
+
+static inline bool gif_seek(ImageGif* gif, uint32_t offset) {
+    return image_reader_seek(gif->reader, offset);
+}
+
+static inline bool gif_skip(ImageGif* gif, uint32_t count) {
+    return image_reader_skip(gif->reader, count);
+}
+
+static inline uint32_t gif_offset(const ImageGif* gif) {
+    return image_reader_tell(gif->reader);
+}
+
+static bool gif_read_palette(ImageGif* gif, uint8_t* luma, uint32_t count) {
+    uint8_t rgb[3];
+    for(uint32_t i = 0; i < count; i++) {
+        if(!gif_read(gif, rgb, sizeof(rgb))) return false;
+        luma[i] = image_luma(rgb[0], rgb[1], rgb[2]);
+    }
+    return true;
+}
+
+// Read one data sub-block, keeping up to `size` bytes of it. Returns its
+// length, 0 for the terminator and -1 on read errors.
+static int gif_read_block(ImageGif* gif, uint8_t* data, size_t size) {
+    int length = gif_byte(gif);
+    if(length <= 0) return length;
+    size_t kept = MIN((size_t)length, size);
+    if(!gif_read(gif, data, kept) || !gif_skip(gif, length - kept)) return -1;
+    return length;
+}
+
+static bool gif_skip_blocks(ImageGif* gif) {
+    int length;
+    while((length = gif_read_block(gif, NULL, 0)) > 0) {
+    }
+    return length == 0;
+}
+
+static void gif_clear_canvas(ImageGif* gif) {
+    memset(gif->canvas, GIF_BACKGROUND, sizeof(gif->canvas));
+    gif->pending_dispose = GifDisposeNone;
+}
+
+static bool gif_read_header(ImageGif* gif) {
+    uint8_t header[GIF_HEADER_SIZE];
+    if(!gif_read(gif, header, sizeof(header))) return false;
+    if(memcmp(header, "GIF87a", 6) != 0 && memcmp(header, "GIF89a", 6) != 0) return false;
+
+    gif->screen_width = gif_u16(header + 6);
+    gif->screen_height = gif_u16(header + 8);
+    if(header[10] & 0x80) {
+        if(!gif_read_palette(gif, gif->global_luma, 2U << (header[10] & 7))) return false;
+    } else {
+        // No palette at all: show indices as a gray ramp
+        for(uint32_t i = 0; i < 256; i++) {
+            gif->global_luma[i] = i;
+        }
+    }
+
+    gif->first_block = gif_offset(gif);
+    gif->transparent = -1;
+    gif_clear_canvas(gif);
+    return true;
+}
+
+// Spread the screen over the canvas once the first image is known, growing
+// it to fit that image as some encoders write a smaller screen
+static void gif_setup_screen(ImageGif* gif, uint32_t right, uint32_t bottom) {
+    uint32_t width = MIN(MAX(gif->screen_width, right), 0xFFFFU);
+    uint32_t height = MIN(MAX(gif->screen_height, bottom), 0xFFFFU);
+    gif->screen_width = width;
+    gif->screen_height = height;
+    for(uint32_t x = 0; x <= IMAGE_OUT_WIDTH; x++) {
+        gif->col_start[x] = (gif->window_x + x) * width / gif->out_width;
+    }
+    for(uint32_t y = 0; y <= IMAGE_OUT_HEIGHT; y++) {
+        gif->row_start[y] = (gif->window_y + y) * height / gif->out_height;
+    }
+    gif->downscale_x = width >= gif->out_width;
+    gif->screen_ready = true;
+}
+
+// Screen pixels cell `i` samples: its span when downscaling, otherwise the
+// one pixel it replicates
+static inline uint32_t gif_cell_end(const uint16_t* start, uint32_t i) {
+    return MAX(start[i + 1], start[i] + 1U);
+}
+
+// Cells whose pixels overlap [begin, end); first > last when none do
+static void gif_cover(
+    const uint16_t* start,
+    uint32_t count,
+    uint32_t begin,
+    uint32_t end,
+    uint8_t* first,
+    uint8_t* last) {
+    *first = 1;
+    *last = 0;
+    bool found = false;
+    for(uint32_t i = 0; i < count; i++) {
+        if(start[i] >= end || gif_cell_end(start, i) <= begin) continue;
+        if(!found) *first = i;
+        *last = i;
+        found = true;
+    }
+}
+
+static void gif_dispose(ImageGif* gif) {
+    const GifRect* rect = &gif->pending_rect;
+    if(gif->pending_dispose == GifDisposeBackground ||
+       (gif->pending_dispose == GifDisposePrevious && gif->saved)) {
+        for(uint32_t y = rect->y0; y <= rect->y1 && rect->x0 <= rect->x1; y++) {
+            uint8_t* line = gif->canvas + y * IMAGE_OUT_WIDTH + rect->x0;
+            size_t size = rect->x1 - rect->x0 + 1;
+            if(gif->pending_dispose == GifDisposeBackground) {
+                memset(line, GIF_BACKGROUND, size);
+            } else {
+                memcpy(line, gif->saved + (line - gif->canvas), size);
+            }
+        }
+    }
+    gif->pending_dispose = GifDisposeNone;
+}
+
+static void gif_start_row(ImageGif* gif) {
+    GifImage* image = &gif->image;
+    image->x = 0;
+    image->cell = image->rect.x0;
+    image->cell_end = gif_cell_end(gif->col_start, image->rect.x0);
+}
+
+// Average the finished source row into the canvas rows it falls on
+static void gif_end_row(ImageGif* gif) {
+    GifImage* image = &gif->image;
+    const GifRect* rect = &image->rect;
+    uint32_t screen_y = image->top + image->row;
+
+    for(uint32_t y = rect->y0; y <= rect->y1 && screen_y < image->bottom; y++) {
+        if(screen_y < gif->row_start[y] || screen_y >= gif_cell_end(gif->row_start, y)) continue;
+        uint32_t rows = gif->band_rows[y]++;
+        uint8_t* line = gif->canvas + y * IMAGE_OUT_WIDTH;
+
+        for(uint32_t x = rect->x0; x <= rect->x1; x++) {
+            uint32_t start = gif->col_start[x];
+            uint32_t slot = gif->downscale_x ? x : start - gif->col_start[0];
+            uint32_t count = gif->row_count[slot];
+            if(!count) continue;
+
+            // Pixels the frame leaves out or makes transparent show the
+            // canvas, so partly covered cells are blended by area
+            uint32_t span = gif_cell_end(gif->col_start, x) - start;
+            uint32_t value = (gif->row_sum[slot] + line[x] * (span - count) + span / 2) / span;
+            line[x] = (line[x] * rows + value + rows / 2) / (rows + 1);
+        }
+    }
+    memset(gif->row_sum, 0, sizeof(gif->row_sum));
+    memset(gif->row_count, 0, sizeof(gif->row_count));
+
+    image->rows_done++;
+    if(image->interlaced) {
+        image->row += gif_pass_step[image->pass];
+        while(image->row >= image->height && image->pass < 3) {
+            image->pass++;
+            image->row = gif_pass_start[image->pass];
+        }
+    } else {
+        image->row++;
+    }
+    gif_start_row(gif);
+}
+
+static inline void gif_put_pixel(ImageGif* gif, uint8_t index) {
+    GifImage* image = &gif->image;
+    if(image->rows_done >= image->height) return;
+
+    uint32_t screen_x = image->left + image->x;
+    if(screen_x >= image->clip_left && screen_x < image->right &&
+       index != image->transparent) {
+        uint32_t slot = gif->downscale_x ? image->cell : screen_x - gif->col_start[0];
+        gif->row_sum[slot] += image->palette[index];
+        gif->row_count[slot]++;
+    }
+    if(gif->downscale_x && screen_x + 1 >= image->cell_end && image->cell < image->rect.x1) {
+        image->cell++;
+        image->cell_end = gif_cell_end(gif->col_start, image->cell);
+    }
+    if(++image->x == image->width) gif_end_row(gif);
+}
+
+static int gif_data_byte(ImageGif* gif) {
+    if(!gif->block_left) {
+        if(gif->data_end) return -1;
+        int length = gif_byte(gif);
+        if(length <= 0) {
+            gif->data_end = true;
+            return -1;
+        }
+        gif->block_left = length;
+    }
+    gif->block_left--;
+    return gif_byte(gif);
+}
+
+static int gif_read_code(ImageGif* gif, uint8_t code_bits) {
+    while(gif->bit_count < code_bits) {
+        int value = gif_data_byte(gif);
+        if(value < 0) return -1;
+        gif->bits |= (uint32_t)value << gif->bit_count;
+        gif->bit_count += 8;
+    }
+    int code = gif->bits & ((1U << code_bits) - 1);
+    gif->bits >>= code_bits;
+    gif->bit_count -= code_bits;
+    return code;
+}
+
+// Decode the image data into the canvas. Data that ends early or breaks
+// the code stream leaves the rest of the frame as it was.
+static bool gif_decode_pixels(ImageGif* gif) {
+    int min_bits = gif_byte(gif);
+    if(min_bits < 1 || min_bits > 8) return false;
+
+    uint32_t clear = 1U << min_bits;
+    uint32_t next = clear + 2;
+    uint8_t code_bits = min_bits + 1;
+    int32_t old = -1;
+    uint8_t first = 0;
+    for(uint32_t i = 0; i < clear; i++) {
+        gif->suffix[i] = i;
+    }
+    gif->bits = 0;
+    gif->bit_count = 0;
+    gif->block_left = 0;
+    gif->data_end = false;
+
+    while(gif->image.rows_done < gif->image.height) {
+        int code = gif_read_code(gif, code_bits);
+        if(code < 0 || (uint32_t)code == clear + 1) break;
+        if((uint32_t)code == clear) {
+            next = clear + 2;
+            code_bits = min_bits + 1;
+            old = -1;
+            continue;
+        }
+        if(old < 0) {
+            if((uint32_t)code >= clear) break;
+            gif_put_pixel(gif, code);
+            old = first = code;
+            continue;
+        }
+
+        int32_t in = code;
+        uint32_t depth = 0;
+        if((uint32_t)code >= next) {
+            if((uint32_t)code > next) break;
+            gif->stack[depth++] = first;
+            code = old;
+        }
+        while((uint32_t)code >= clear) {
+            gif->stack[depth++] = gif->suffix[code];
+            code = gif->prefix[code];
+        }
+        first = code;
+        gif->stack[depth++] = first;
+        while(depth) {
+            gif_put_pixel(gif, gif->stack[--depth]);
+        }
+
+        if(next < GIF_MAX_CODES) {
+            gif->prefix[next] = old;
+            gif->suffix[next] = first;
+            next++;
+            if(next == (1U << code_bits) && code_bits < GIF_MAX_CODE_BITS) code_bits++;
+        }
+        old = in;
+    }
+
+    // Skip what is left of the data, trailing codes included
+    if(gif->data_end) return true;
+    return gif_skip(gif, gif->block_left) && gif_skip_blocks(gif);
+}
+
+static bool gif_decode_image(ImageGif* gif) {
+    uint8_t descriptor[GIF_DESCRIPTOR_SIZE];
+    if(!gif_read(gif, descriptor, sizeof(descriptor))) return false;
+
+    GifImage* image = &gif->image;
+    memset(image, 0, sizeof(GifImage));
+    image->left = gif_u16(descriptor);
+    image->top = gif_u16(descriptor + 2);
+    image->width = gif_u16(descriptor + 4);
+    image->height = gif_u16(descriptor + 6);
+    image->interlaced = descriptor[8] & 0x40;
+    image->transparent = gif->transparent;
+    image->palette = gif->global_luma;
+    if(descriptor[8] & 0x80) {
+        if(!gif_read_palette(gif, gif->local_luma, 2U << (descriptor[8] & 7))) return false;
+        image->palette = gif->local_luma;
+    }
+
+    if(!gif->screen_ready) {
+        gif_setup_screen(gif, image->left + image->width, image->top + image->height);
+    }
+    image->clip_left = MAX(image->left, gif->col_start[0]);
+    image->right = MIN(
+        MIN(image->left + image->width, gif->screen_width),
+        gif_cell_end(gif->col_start, IMAGE_OUT_WIDTH - 1));
+    image->bottom = MIN(image->top + image->height, gif->screen_height);
+    gif_cover(
+        gif->col_start,
+        IMAGE_OUT_WIDTH,
+        image->clip_left,
+        image->right,
+        &image->rect.x0,
+        &image->rect.x1);
+    gif_cover(
+        gif->row_start,
+        IMAGE_OUT_HEIGHT,
+        image->top,
+        image->bottom,
+        &image->rect.y0,
+        &image->rect.y1);
+    if(image->rect.x0 > image->rect.x1 || image->rect.y0 > image->rect.y1 || !image->width) {
+        // Off screen: the data still has to be read past
+        image->height = 0;
+    }
+
+    if(gif->dispose == GifDisposePrevious) {
+        if(!gif->saved) gif->saved = malloc(sizeof(gif->canvas));
+        memcpy(gif->saved, gif->canvas, sizeof(gif->canvas));
+    }
+    // Rows of a canvas row outside the frame keep their weight in it
+    for(uint32_t y = image->rect.y0; y <= image->rect.y1; y++) {
+        uint32_t start = gif->row_start[y];
+        uint32_t end = gif_cell_end(gif->row_start, y);
+        gif->band_rows[y] = (end - start) - (MIN(end, image->bottom) - MAX(start, image->top));
+    }
+    memset(gif->row_sum, 0, sizeof(gif->row_sum));
+    memset(gif->row_count, 0, sizeof(gif->row_count));
+    gif_start_row(gif);
+
+    bool ok = gif_decode_pixels(gif);
+
+    gif->pending_dispose = gif->dispose;
+    gif->pending_rect = image->rect;
+    gif->dispose = GifDisposeNone;
+    gif->transparent = -1;
+    return ok;
+}
+
+static bool gif_read_extension(ImageGif* gif) {
+    int label = gif_byte(gif);
+    if(label < 0) return false;
+
+    uint8_t data[16];
+    int length = gif_read_block(gif, data, sizeof(data));
+    if(label == 0xF9 && length >= 4) {
+        // Graphic control: disposal, delay and transparency of the next image
+        gif->dispose = (data[0] >> 2) & 7;
+        gif->delay_cs = gif_u16(data + 1);
+        gif->transparent = (data[0] & 1) ? data[3] : -1;
+    } else if(label == 0xFF && length == 11 && memcmp(data, "NETSCAPE2.0", 11) == 0) {
+        length = gif_read_block(gif, data, sizeof(data));
+        if(length >= 3 && data[0] == 1 && !gif->loop_seen) {
+            uint16_t loops = gif_u16(data + 1);
+            gif->loops_left = loops ? loops : -1;
+            gif->loop_seen = true;
+        }
+    }
+    return length == 0 || (length > 0 && gif_skip_blocks(gif));
+}
+
+static GifBlock gif_next_block(ImageGif* gif) {
+    while(true) {
+        switch(gif_byte(gif)) {
+        case 0x21:
+            if(!gif_read_extension(gif)) return GifBlockError;
+            break;
+        case 0x2C:
+            return GifBlockImage;
+        case 0x3B:
+            return GifBlockTrailer;
+        default:
+            return GifBlockError;
+        }
+    }
+}
+
+bool image_gif_next_frame(ImageGif* gif, uint32_t* delay_ms) {
+    gif_dispose(gif);
+
+    GifBlock block;
+    while((block = gif_next_block(gif)) == GifBlockTrailer) {
+        // Without a loop extension the animation plays once
+        if(gif->frame < 2 || !gif->loops_left) return false;
+        if(gif->loops_left > 0) gif->loops_left--;
+        if(!gif_seek(gif, gif->first_block)) return false;
+        gif_clear_canvas(gif);
+        gif->frame = 0;
+    }
+    if(block != GifBlockImage) return false;
+
+    uint16_t delay_cs = gif->delay_cs < GIF_MIN_DELAY_CS ? GIF_SLOW_DELAY_CS : gif->delay_cs;
+    gif->delay_cs = 0;
+    if(!gif_decode_image(gif)) return false;
+    gif->frame++;
+    *delay_ms = delay_cs * 10U;
+    return true;
+}
+
+// The canvas already is the window the scaler was set up for
+static void gif_render(ImageGif* gif, ImageScaler* scaler) {
+    image_scaler_set_tile(scaler, 0, 0, 0);
+    image_scaler_init(scaler, IMAGE_OUT_WIDTH, IMAGE_OUT_HEIGHT);
+    for(uint32_t y = 0; y < IMAGE_OUT_HEIGHT; y++) {
+        memcpy(scaler->line, gif->canvas + y * IMAGE_OUT_WIDTH, IMAGE_OUT_WIDTH);
+        image_scaler_emit_row(scaler, y, scaler->line);
+    }
+}
+
+void image_gif_render(ImageGif* gif, uint8_t* bitmap, ImageDitherMode dither_mode) {
+    image_scaler_setup(gif->scaler, bitmap, dither_mode);
+    gif_render(gif, gif->scaler);
+}
+
+static ImageGif* gif_alloc(ImageReader* reader) {
+    ImageGif* gif = malloc(sizeof(ImageGif));
+    if(!gif) return NULL;
+    memset(gif, 0, sizeof(ImageGif));
+    gif->reader = reader;
+    gif->out_width = IMAGE_OUT_WIDTH;
+    gif->out_height = IMAGE_OUT_HEIGHT;
+    return gif;
+}
+
+ImageGif* image_gif_open(Storage* storage, const char* path) {
+    File* file = storage_file_alloc(storage);
+    if(!storage_file_open(file, path, FSAM_READ, FSOM_OPEN_EXISTING)) {
+        storage_file_free(file);
+        return NULL;
+    }
+
+    // Playback streams the file over and over, read ahead all along
+    ImageReader* reader = image_reader_alloc(file, NULL);
+    image_reader_set_double_buffered(reader);
+    ImageGif* gif = gif_alloc(reader);
+    if(!gif) {
+        image_reader_free(reader);
+        storage_file_close(file);
+        storage_file_free(file);
+        return NULL;
+    }
+    gif->storage = storage;
+    gif->scaler = malloc(sizeof(ImageScaler));
+    if(!gif->scaler || !gif_read_header(gif)) {
+        image_gif_close(gif);
+        return NULL;
+    }
+    return gif;
+}
+
+void image_gif_close(ImageGif* gif) {
+    if(gif->storage) {
+        File* file = gif->reader->file;
+        image_reader_free(gif->reader);
+        storage_file_close(file);
+        storage_file_free(file);
+        free(gif->scaler);
+    }
+    free(gif->saved);
+    free(gif);
+}
+
+ImageConverterResult image_gif_decode(ImageReader* reader, ImageScaler* scaler) {
+    ImageGif* gif = gif_alloc(reader);
+    if(!gif) return ImageConverterError;
+    gif->out_width = scaler->out_width;
+    gif->out_height = scaler->out_height;
+    gif->window_x = scaler->window_x;
+    gif->window_y = scaler->window_y;
+
+    uint32_t delay_ms;
+    ImageConverterResult result = ImageConverterOK;
+    if(!gif_read_header(gif)) {
+        result = ImageConverterUnsupported;
+    } else if(!image_gif_next_frame(gif, &delay_ms)) {
+        result = ImageConverterError;
+    } else {
+        gif_render(gif, scaler);
+    }
+
+    if(result != ImageConverterOK) {
+        FURI_LOG_E(TAG, "Decode failed: %d", result);
+    }
+    free(gif->saved);
+    free(gif);
+    return result;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <storage/storage.h>
+#include "convert.h"
+#include "reader.h"
+#include "scaler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Decode the first frame of a GIF (87a or 89a, interlaced or not) from the
+// start of a file into the scaler, or the tile the scaler is set to
+ImageConverterResult image_gif_decode(ImageReader* reader, ImageScaler* scaler);
+
+// Animated playback. Frames are LZW decoded one pixel at a time straight
+// into a 128x64 luma canvas: each source row is box-filtered across the
+// canvas columns and averaged into the canvas row it falls on, with what
+// was below showing through transparent pixels. Disposal works on the canvas,
+// so playback holds about 31 KB whatever the size or length of the GIF,
+// plus one 8 KB canvas copy once a frame asks to restore the previous one.
+typedef struct ImageGif ImageGif;
+
+// Open a GIF for playback; NULL if it cannot be read or is not a GIF
+ImageGif* image_gif_open(Storage* storage, const char* path);
+void image_gif_close(ImageGif* gif);
+
+// Composite the next frame onto the canvas, rewinding after the last one as
+// long as the loop count allows. `delay_ms` is how long the frame stays up.
+// False once playback is over, for single frame GIFs, and on read errors.
+bool image_gif_next_frame(ImageGif* gif, uint32_t* delay_ms);
+
+// Dither the canvas into a 128x64 bitmap in XBM order
+void image_gif_render(ImageGif* gif, uint8_t* bitmap, ImageDitherMode dither_mode);
+
+#ifdef __cplusplus
+}
+#endif
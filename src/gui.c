@@ -7,11 +7,19 @@
 #include <gui/modules/file_browser.h>
 #include "gui.h"
 #include "convert.h"
+#include "trace.h"
 
 #define TAG           "ImageViewer"
 #define SCREEN_WIDTH  128
 #define SCREEN_HEIGHT 64
 
+// Slideshow interval, set with Up and Down while it runs
+#define SLIDESHOW_DEFAULT_MS 5000
+#define SLIDESHOW_STEP_MS    1000
+#define SLIDESHOW_MAX_MS     60000
+// How often a late frame is checked on
+#define SLIDESHOW_RECHECK_MS 20
+
 typedef enum {
     IMAGEVIEWER_ICON_SIZE_DEFAULT,
     IMAGEVIEWER_ICON_SIZE_LARGE,
@@ -45,6 +53,12 @@ typedef enum {
     FILE_BROWSER_WORKER,
 } FileBrowserWorker;
 
+// The view's model only points back at the viewer: frames stay with the
+// worker, which hands them over under its own lock
+typedef struct {
+    ImageViewer* app;
+} ImageViewerModel;
+
 typedef struct {
     View* view;
     ViewPort* view_port;
@@ -82,35 +96,307 @@ static void file_browser_callback(FileBrowser* file_browser, FileBrowserEvent ev
 }
 #endif
 
-static void draw_callback(Canvas* canvas, void* ctx) {
-    ImageViewer* app = ctx;
-    if(app->bitmap) {
-        canvas_draw_bitmap(canvas, 0, 0, app->width, app->height, app->bitmap);
+// Durations on the HUD: microseconds for cache hits, milliseconds otherwise
+static void hud_format_time(char* out, size_t size, uint32_t us) {
+    if(us < 1000) {
+        snprintf(out, size, "%luus", (unsigned long)us);
+    } else if(us < 10000) {
+        snprintf(
+            out, size, "%lu.%lums", (unsigned long)(us / 1000), (unsigned long)(us / 100 % 10));
+    } else {
+        snprintf(out, size, "%lums", (unsigned long)(us / 1000));
+    }
+}
+
+// Where the frame on screen came from and what each stage cost, over the
+// top of the image
+static void draw_hud(Canvas* canvas, ImageViewer* app) {
+    static const char* const sources[] = {
+        [ImageConvertDecoded] = "decoded",
+        [ImageConvertDiskCache] = "SD cache",
+        [ImageConvertRamCache] = "RAM cache",
+    };
+    ImageConvertStats stats;
+    char line[6][32];
+    size_t lines = 5;
+    char a[12], b[12];
+
+    if(image_worker_get_current_stats(app->worker, &stats)) {
+        hud_format_time(a, sizeof(a), stats.open_us);
+        hud_format_time(b, sizeof(b), stats.read_us);
+        snprintf(line[0], sizeof(line[0]), "Open %s Read %s", a, b);
+        hud_format_time(a, sizeof(a), stats.decode_us);
+        hud_format_time(b, sizeof(b), stats.scale_us);
+        snprintf(line[1], sizeof(line[1]), "Dec %s Scale %s", a, b);
+        hud_format_time(a, sizeof(a), stats.dither_us);
+        hud_format_time(b, sizeof(b), stats.total_us);
+        snprintf(line[2], sizeof(line[2]), "Dith %s Tot %s", a, b);
+        snprintf(
+            line[3],
+            sizeof(line[3]),
+            "%luKB %lu rd %s",
+            (unsigned long)(stats.bytes_read + 1023) / 1024,
+            (unsigned long)stats.read_calls,
+            sources[stats.source]);
+    } else {
+        strlcpy(line[0], "Decoding...", sizeof(line[0]));
+        line[1][0] = line[2][0] = line[3][0] = '\0';
+    }
+    snprintf(
+        line[4],
+        sizeof(line[4]),
+        "Heap %uK min %uK",
+        (unsigned)(memmgr_get_free_heap() / 1024),
+        (unsigned)(memmgr_get_minimum_free_heap() / 1024));
+    if(app->slideshow) {
+        const ImageSlideshowStats* show = &app->slideshow_stats;
+        snprintf(
+            line[lines++],
+            sizeof(line[0]),
+            "%lus %lu late max %lums",
+            (unsigned long)(app->slideshow_interval_ms / 1000),
+            (unsigned long)show->late,
+            (unsigned long)show->late_ms_max);
+    }
+
+    uint8_t height = 2 + lines * 9;
+    canvas_set_font(canvas, FontSecondary);
+    canvas_set_color(canvas, ColorWhite);
+    canvas_draw_box(canvas, 0, 0, SCREEN_WIDTH, height);
+    canvas_set_color(canvas, ColorBlack);
+    canvas_draw_frame(canvas, 0, 0, SCREEN_WIDTH, height);
+    for(size_t i = 0; i < lines; i++) {
+        canvas_draw_str(canvas, 3, 10 + i * 9, line[i]);
+    }
+}
+
+// Only redrawn when something changed: the worker calls back once the image
+// on screen is done and each time a preview of it lands before that, which
+// is then drawn like the finished frame and later replaced by it in place
+static void draw_callback(Canvas* canvas, void* model) {
+    ImageViewer* app = ((ImageViewerModel*)model)->app;
+    image_trace_begin("draw");
+    ImageFrameState state;
+    const uint8_t* bitmap = image_worker_lock_current(app->worker, &state);
+    if(bitmap) {
+        canvas_draw_xbm(canvas, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, bitmap);
     } else {
         canvas_set_font(canvas, FontPrimary);
-        canvas_draw_str_aligned(canvas, 64, 32, AlignCenter, AlignCenter, "No Image");
+        const char* text = state == ImageFrameFailed ? "Unsupported Image" :
+                           state == ImageFrameEmpty  ? "No Image" :
+                                                       "Loading...";
+        canvas_draw_str_aligned(canvas, 64, 32, AlignCenter, AlignCenter, text);
     }
+    image_worker_unlock(app->worker);
+
+    if(app->hud) draw_hud(canvas, app);
+    image_trace_end("draw");
+}
+
+// Runs on the worker thread once the image on screen is decoded, and for
+// each preview of it on the way
+static void frame_ready_callback(void* ctx) {
+    ImageViewer* app = ctx;
+    image_trace_instant("frame_ready");
+    with_view_model(app->view, void* model, { UNUSED(model); }, true);
+}
+
+// Redrawn by frame_ready_callback once the worker has composed the view
+static void image_viewer_update_view(ImageViewer* app) {
+    image_worker_set_view(app->worker, app->zoom, app->view_x, app->view_y);
+}
+
+// Up zooms in and Down out around the middle of the screen. The screen spans
+// two half tiles, so its middle is half tile view + 1 and doubles per level.
+static void image_viewer_zoom(ImageViewer* app, bool in) {
+    if(in && app->zoom < IMAGE_ZOOM_MAX) {
+        app->zoom++;
+        app->view_x = app->view_x * 2 + 1;
+        app->view_y = app->view_y * 2 + 1;
+    } else if(!in && app->zoom > 0) {
+        app->zoom--;
+        app->view_x = app->view_x > 0 ? (app->view_x - 1) / 2 : 0;
+        app->view_y = app->view_y > 0 ? (app->view_y - 1) / 2 : 0;
+    } else {
+        return;
+    }
+    if(!app->zoom) app->view_x = app->view_y = 0;
+    FURI_LOG_D(TAG, "Zoom %u at %u,%u", app->zoom, app->view_x, app->view_y);
+    image_viewer_update_view(app);
+}
+
+// Half a screen per step, stopping at the edges of the image
+static void image_viewer_pan(ImageViewer* app, InputKey key) {
+    uint16_t last = (2U << app->zoom) - 2;
+    uint16_t x = app->view_x;
+    uint16_t y = app->view_y;
+    if(key == InputKeyLeft && x > 0) x--;
+    if(key == InputKeyRight && x < last) x++;
+    if(key == InputKeyUp && y > 0) y--;
+    if(key == InputKeyDown && y < last) y++;
+    if(x == app->view_x && y == app->view_y) return;
+    app->view_x = x;
+    app->view_y = y;
+    image_viewer_update_view(app);
+}
+
+// Advance the slideshow when the next image is due and decoded. Returns how
+// many ms until it wants to be called again, UINT32_MAX when it is off.
+static uint32_t image_viewer_slideshow_poll(ImageViewer* app) {
+    if(!app->slideshow) return UINT32_MAX;
+    uint32_t now = furi_get_tick();
+    int32_t wait = app->slideshow_due - now;
+    if(wait > 0) return wait;
+    if(!app->next_file[0] || strcmp(app->next_file, app->current_file) == 0) {
+        // Nothing to move on to yet, e.g. while the scan is still at the first image
+        app->slideshow_due = now + furi_ms_to_ticks(app->slideshow_interval_ms);
+        return app->slideshow_interval_ms;
+    }
+
+    ImageSlideshowStats* stats = &app->slideshow_stats;
+    ImageFrameState state = image_worker_get_state(app->worker, app->next_file);
+    if(state == ImageFrameReady) {
+        if(app->slideshow_late_since) {
+            uint32_t late_ms = now - app->slideshow_late_since;
+            stats->late_ms_max = MAX(stats->late_ms_max, late_ms);
+            stats->late_ms_total += late_ms;
+            app->slideshow_late_since = 0;
+        }
+        stats->shown++;
+        image_viewer_set_file(app, app->next_file);
+        return app->slideshow_interval_ms;
+    }
+
+    if(state == ImageFrameFailed) {
+        // Passed over rather than given a turn as "Unsupported Image"
+        stats->skipped++;
+        extwalk_get_next_image(app->next_file, app->next_file, sizeof(app->next_file));
+        image_worker_prefetch(app->worker, app->prev_file, app->next_file);
+    } else {
+        // Still decoding: the image on screen stays up until it lands
+        if(!app->slideshow_late_since) {
+            app->slideshow_late_since = now;
+            stats->late++;
+            image_trace_instant("slideshow_late");
+        }
+        if(state == ImageFrameEmpty) {
+            image_worker_prefetch(app->worker, app->prev_file, app->next_file);
+        }
+    }
+    app->slideshow_due = now + furi_ms_to_ticks(SLIDESHOW_RECHECK_MS);
+    return SLIDESHOW_RECHECK_MS;
+}
+
+static void slideshow_timer_callback(void* context) {
+    ImageViewer* app = context;
+    uint32_t wait = image_viewer_slideshow_poll(app);
+    if(wait != UINT32_MAX) {
+        furi_event_loop_timer_start(app->slideshow_timer, furi_ms_to_ticks(wait));
+    }
+}
+
+static void image_viewer_slideshow_toggle(ImageViewer* app) {
+    app->slideshow = !app->slideshow;
+    if(app->slideshow) {
+        memset(&app->slideshow_stats, 0, sizeof(app->slideshow_stats));
+        app->slideshow_late_since = 0;
+        app->slideshow_due = furi_get_tick() + furi_ms_to_ticks(app->slideshow_interval_ms);
+        furi_event_loop_timer_start(
+            app->slideshow_timer, furi_ms_to_ticks(app->slideshow_interval_ms));
+    } else {
+        furi_event_loop_timer_stop(app->slideshow_timer);
+        const ImageSlideshowStats* stats = &app->slideshow_stats;
+        FURI_LOG_I(
+            TAG,
+            "Slideshow: %lu shown, %lu late (max %lu ms, total %lu ms), %lu skipped",
+            (unsigned long)stats->shown,
+            (unsigned long)stats->late,
+            (unsigned long)stats->late_ms_max,
+            (unsigned long)stats->late_ms_total,
+            (unsigned long)stats->skipped);
+    }
+    if(app->hud) with_view_model(app->view, void* model, { UNUSED(model); }, true);
+}
+
+static void image_viewer_slideshow_interval(ImageViewer* app, bool longer) {
+    if(longer && app->slideshow_interval_ms < SLIDESHOW_MAX_MS) {
+        app->slideshow_interval_ms += SLIDESHOW_STEP_MS;
+    } else if(!longer && app->slideshow_interval_ms > SLIDESHOW_STEP_MS) {
+        app->slideshow_interval_ms -= SLIDESHOW_STEP_MS;
+    }
+    FURI_LOG_D(TAG, "Slideshow every %lu ms", (unsigned long)app->slideshow_interval_ms);
+    if(app->hud) with_view_model(app->view, void* model, { UNUSED(model); }, true);
 }
 
 static bool input_callback(InputEvent* event, void* ctx) {
     ImageViewer* app = ctx;
     bool handled = false;
+    image_trace_instant("input");
+
+    if(event->type == InputTypeLong && event->key == InputKeyBack) {
+        // Snapshot the trace without leaving the app
+        image_trace_flush();
+        return true;
+    }
+
+    if(event->type == InputTypeLong && event->key == InputKeyOk) {
+        app->hud = !app->hud;
+        with_view_model(app->view, void* model, { UNUSED(model); }, true);
+        return true;
+    }
+
+    // Holding a direction pans the zoomed image, repeating while held
+    if((event->type == InputTypeLong || event->type == InputTypeRepeat) && app->zoom &&
+       (event->key == InputKeyUp || event->key == InputKeyDown ||
+        event->key == InputKeyLeft || event->key == InputKeyRight)) {
+        image_viewer_pan(app, event->key);
+        return true;
+    }
+
+    if(event->type == InputTypeLong && event->key == InputKeyRight) {
+        image_viewer_slideshow_toggle(app);
+        return true;
+    }
 
     if(event->type == InputTypeShort) {
-        char next_file[256];
+        // Steps land in next_file, which set_file then looks up afresh
         switch(event->key) {
+        case InputKeyUp:
+        case InputKeyDown:
+            // Up and Down set the pace of a running slideshow, zoom otherwise
+            if(app->slideshow) {
+                image_viewer_slideshow_interval(app, event->key == InputKeyUp);
+            } else {
+                image_viewer_zoom(app, event->key == InputKeyUp);
+            }
+            handled = true;
+            break;
         case InputKeyRight:
-            if(extwalk_get_next_image(app->current_file, next_file, sizeof(next_file))) {
-                image_viewer_set_file(app, next_file);
+            if(extwalk_get_next_image(
+                   app->current_file, app->next_file, sizeof(app->next_file))) {
+                image_viewer_set_file(app, app->next_file);
             }
             handled = true;
             break;
         case InputKeyLeft:
-            if(extwalk_get_prev_image(app->current_file, next_file, sizeof(next_file))) {
-                image_viewer_set_file(app, next_file);
+            if(extwalk_get_prev_image(
+                   app->current_file, app->next_file, sizeof(app->next_file))) {
+                image_viewer_set_file(app, app->next_file);
+            }
+            handled = true;
+            break;
+        case InputKeyOk: {
+            // Cycle the dithering mode and re-convert the current image
+            ImageDitherMode mode = (image_convert_get_dither_mode() + 1) % ImageDitherCount;
+            image_convert_set_dither_mode(mode);
+            FURI_LOG_I(TAG, "Dither: %s", image_convert_get_dither_name(mode));
+            if(app->current_file[0]) {
+                image_worker_invalidate(app->worker);
+                image_viewer_set_file(app, app->current_file);
             }
             handled = true;
             break;
+        }
         default:
             break;
         }
@@ -122,19 +408,32 @@ static bool input_callback(InputEvent* event, void* ctx) {
 ImageViewer* image_viewer_alloc() {
     ImageViewer* app = malloc(sizeof(ImageViewer));
     app->view = view_alloc();
-    app->bitmap = NULL;
+    app->worker = image_worker_alloc(frame_ready_callback, app);
     app->current_file[0] = '\0';
+    app->hud = false;
+    app->zoom = 0;
+    app->view_x = app->view_y = 0;
+    app->slideshow = false;
+    app->slideshow_interval_ms = SLIDESHOW_DEFAULT_MS;
+    app->slideshow_timer = NULL;
 
     view_set_context(app->view, app);
-    view_allocate_model(app->view, ViewModelTypeLocking, sizeof(ImageViewer));
+    view_allocate_model(app->view, ViewModelTypeLockFree, sizeof(ImageViewerModel));
+    with_view_model(app->view, ImageViewerModel * model, { model->app = app; }, false);
     view_set_draw_callback(app->view, draw_callback);
     view_set_input_callback(app->view, input_callback);
 
     return app;
 }
 
+void image_viewer_set_event_loop(ImageViewer* app, FuriEventLoop* event_loop) {
+    app->slideshow_timer = furi_event_loop_timer_alloc(
+        event_loop, slideshow_timer_callback, FuriEventLoopTimerTypeOnce, app);
+}
+
 void image_viewer_free(ImageViewer* app) {
-    if(app->bitmap) free(app->bitmap);
+    if(app->slideshow_timer) furi_event_loop_timer_free(app->slideshow_timer);
+    image_worker_free(app->worker);
     view_free(app->view);
     free(app);
 }
@@ -144,30 +443,41 @@ View* image_viewer_get_view(ImageViewer* app) {
 }
 
 void image_viewer_set_file(ImageViewer* app, const char* path) {
-    if(app->bitmap) {
-        free(app->bitmap);
-        app->bitmap = NULL;
+    // Another image starts out whole; the same one, e.g. redithered, keeps
+    // its zoom
+    if(strcmp(app->current_file, path) != 0 && app->zoom) {
+        app->zoom = 0;
+        app->view_x = app->view_y = 0;
+        image_worker_set_view(app->worker, 0, 0, 0);
     }
-
-    strncpy(app->current_file, path, sizeof(app->current_file) - 1);
-
-    // Allocate bitmap buffer
-    app->bitmap = malloc(128 * 64 / 8);
-    if(!app->bitmap) {
-        FURI_LOG_E(TAG, "Failed to allocate bitmap");
-        return;
+    if(path != app->current_file) {
+        strncpy(app->current_file, path, sizeof(app->current_file) - 1);
     }
+    image_trace_begin("set_file");
 
-    // Convert image to bitmap
-    ImageConverterResult result =
-        image_convert_to_bitmap(path, app->bitmap, &app->width, &app->height);
+    // Every image gets a full turn, also when stepped to by hand
+    app->slideshow_due = furi_get_tick() + furi_ms_to_ticks(app->slideshow_interval_ms);
 
-    if(result != ImageConverterOK) {
-        FURI_LOG_E(TAG, "Failed to convert image");
-        free(app->bitmap);
-        app->bitmap = NULL;
-        return;
+    // A prefetched frame is shown by switching slots; anything else is
+    // decoded on the worker and drawn once frame_ready_callback fires
+    uint32_t start = furi_hal_cortex_timer_get(0).start;
+    bool ready = image_worker_show(app->worker, app->current_file);
+    if(ready) {
+        uint32_t cycles = furi_hal_cortex_timer_get(0).start - start;
+        FURI_LOG_D(
+            TAG,
+            "Swap in %lu us",
+            (unsigned long)(cycles / furi_hal_cortex_instructions_per_microsecond()));
     }
+    with_view_model(app->view, void* model, { UNUSED(model); }, true);
+
+    // Neighbours are looked up only after the swap so they never delay it
+    extwalk_get_neighbours(
+        app->current_file, app->prev_file, app->next_file, sizeof(app->next_file));
+    image_worker_prefetch(app->worker, app->prev_file, app->next_file);
+    image_trace_end("set_file");
+}
 
-    view_commit_model(app->view, true);
+void image_viewer_get_slideshow_stats(ImageViewer* app, ImageSlideshowStats* stats) {
+    *stats = app->slideshow_stats;
 }
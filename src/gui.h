@@ -1,5 +1,6 @@
 #pragma once
 
+#include <furi.h>
 #include <gui/gui.h>
 #include <gui/view.h>
 #include <gui/canvas.h>
@@ -8,6 +9,18 @@
 #include <gui/modules/submenu.h>
 #include <gui/modules/popup.h>
 #include "extwalk.h"
+#include "worker.h"
+
+// How well decoding kept up with the slideshow. A frame is late when its
+// turn comes while it is still decoding; the image before it stays up until
+// it lands.
+typedef struct {
+    uint32_t shown;
+    uint32_t late;
+    uint32_t late_ms_max; // Longest a frame overran its turn
+    uint32_t late_ms_total;
+    uint32_t skipped; // Failed to decode and passed over
+} ImageSlideshowStats;
 
 // Forward declare to prevent circular includes
 typedef struct ImageViewer ImageViewer;
@@ -15,14 +28,36 @@ typedef struct ImageViewer ImageViewer;
 // Concrete struct definition
 typedef struct ImageViewer {
     View* view;
-    uint8_t* bitmap;
-    uint16_t width;
-    uint16_t height;
+    ImageWorker* worker; // Decodes off the input thread and owns the frames
     char current_file[256];
+    char prev_file[256];
+    char next_file[256];
+    bool hud; // Timing overlay, toggled with a long press on OK
+    uint8_t zoom; // Tile pyramid level on screen, 0 for the whole image
+    uint16_t view_x; // Top-left of the screen in half tiles when zoomed
+    uint16_t view_y;
+
+    // Slideshow through the extwalk order, toggled with a long press on
+    // Right. The next image is already being prefetched while one is up,
+    // so a turn is a slot swap.
+    bool slideshow;
+    uint32_t slideshow_interval_ms;
+    uint32_t slideshow_due; // Tick the next image is due
+    uint32_t slideshow_late_since; // Tick the next image became late, 0 if it is not
+    ImageSlideshowStats slideshow_stats;
+    FuriEventLoopTimer* slideshow_timer; // Runs the turns on the app's event loop
 } ImageViewer;
 
 // Viewer API
 ImageViewer* image_viewer_alloc();
 void image_viewer_free(ImageViewer* app);
 View* image_viewer_get_view(ImageViewer* app);
+
+// The event loop the view is dispatched on; slideshow turns run off a timer
+// on it. Set before any input arrives.
+void image_viewer_set_event_loop(ImageViewer* app, FuriEventLoop* event_loop);
+// `path` may be one of the app's own paths; it is copied before the
+// neighbours are looked up again
 void image_viewer_set_file(ImageViewer* app, const char* path);
+
+void image_viewer_get_slideshow_stats(ImageViewer* app, ImageSlideshowStats* stats);
@@ -0,0 +1,413 @@
+#include <furi.h>
+#include "inflate.h"
+
+#define INFLATE_INPUT_SIZE   512
+#define INFLATE_FAST_BITS    9
+#define INFLATE_MAX_BITS     15
+#define INFLATE_LITLEN_CODES 288
+#define INFLATE_DIST_CODES   32
+
+typedef enum {
+    InflateStateHeader,
+    InflateStateStored,
+    InflateStateCodes,
+    InflateStateDone,
+    InflateStateError,
+} InflateState;
+
+// Canonical Huffman table. Codes up to INFLATE_FAST_BITS long resolve with a
+// single lookup of (symbol << 4 | length); longer ones fall back to a
+// count-based walk over the canonical ordering.
+typedef struct {
+    uint16_t fast[1 << INFLATE_FAST_BITS];
+    uint16_t count[INFLATE_MAX_BITS + 1];
+    uint16_t symbol[INFLATE_LITLEN_CODES];
+} InflateHuffman;
+
+struct ImageInflate {
+    ImageInflateInputCallback input;
+    void* context;
+
+    uint8_t in[INFLATE_INPUT_SIZE];
+    size_t in_pos;
+    size_t in_len;
+    bool in_eof;
+    uint32_t padding; // Zero bits appended past the end of input
+    uint32_t bits;
+    uint8_t bit_count;
+
+    InflateState state;
+    bool last_block;
+    bool fixed_loaded;
+    uint32_t stored_left;
+    uint16_t copy_len;
+    uint16_t copy_dist;
+
+    InflateHuffman litlen;
+    InflateHuffman dist;
+    uint8_t lengths[INFLATE_LITLEN_CODES + INFLATE_DIST_CODES];
+
+    uint32_t window_mask;
+    uint32_t window_pos;
+    uint32_t window_fill; // Valid history bytes, saturates at the window size
+    uint8_t window[];
+};
+
+static const uint16_t inflate_length_base[29] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t inflate_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t inflate_dist_base[30] = {
+    1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+    193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t inflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+    6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t inflate_clen_order[19] =
+    {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+size_t image_inflate_get_memory_size(uint8_t window_bits) {
+    return sizeof(ImageInflate) + (1U << window_bits);
+}
+
+ImageInflate*
+    image_inflate_alloc(uint8_t window_bits, ImageInflateInputCallback input, void* context) {
+    if(window_bits < 8 || window_bits > 15) return NULL;
+
+    ImageInflate* inflate = malloc(image_inflate_get_memory_size(window_bits));
+    if(!inflate) return NULL;
+    memset(inflate, 0, sizeof(ImageInflate));
+    inflate->input = input;
+    inflate->context = context;
+    inflate->window_mask = (1U << window_bits) - 1;
+    inflate->state = InflateStateHeader;
+    return inflate;
+}
+
+void image_inflate_free(ImageInflate* inflate) {
+    free(inflate);
+}
+
+bool image_inflate_failed(const ImageInflate* inflate) {
+    return inflate->state == InflateStateError;
+}
+
+// Top the bit buffer up to at least `need` bits; past the end of input it is
+// padded with zeros so lookahead works, and inflate_overrun() tells whether
+// any of that padding was actually consumed
+static inline void inflate_fill(ImageInflate* inflate, uint8_t need) {
+    while(inflate->bit_count < need) {
+        if(inflate->in_pos == inflate->in_len) {
+            inflate->in_len =
+                inflate->in_eof ?
+                    0 :
+                    inflate->input(inflate->in, sizeof(inflate->in), inflate->context);
+            inflate->in_pos = 0;
+            if(inflate->in_len == 0) {
+                inflate->in_eof = true;
+                inflate->bit_count += 8;
+                inflate->padding += 8;
+                continue;
+            }
+        }
+        inflate->bits |= (uint32_t)inflate->in[inflate->in_pos++] << inflate->bit_count;
+        inflate->bit_count += 8;
+    }
+}
+
+static inline bool inflate_overrun(const ImageInflate* inflate) {
+    return inflate->padding > inflate->bit_count;
+}
+
+static inline uint32_t inflate_bits(ImageInflate* inflate, uint8_t count) {
+    if(!count) return 0;
+    inflate_fill(inflate, count);
+    uint32_t value = inflate->bits & ((1U << count) - 1);
+    inflate->bits >>= count;
+    inflate->bit_count -= count;
+    return value;
+}
+
+static bool inflate_build(InflateHuffman* huffman, const uint8_t* lengths, uint16_t codes) {
+    uint16_t offsets[INFLATE_MAX_BITS + 1];
+
+    memset(huffman->count, 0, sizeof(huffman->count));
+    for(uint16_t i = 0; i < codes; i++) {
+        huffman->count[lengths[i]]++;
+    }
+    huffman->count[0] = 0;
+
+    // Reject oversubscribed code sets; incomplete ones are legal
+    int32_t left = 1;
+    for(uint8_t len = 1; len <= INFLATE_MAX_BITS; len++) {
+        left <<= 1;
+        left -= huffman->count[len];
+        if(left < 0) return false;
+    }
+
+    offsets[1] = 0;
+    for(uint8_t len = 1; len < INFLATE_MAX_BITS; len++) {
+        offsets[len + 1] = offsets[len] + huffman->count[len];
+    }
+
+    memset(huffman->fast, 0, sizeof(huffman->fast));
+    uint16_t code = 0;
+    uint16_t next_code[INFLATE_MAX_BITS + 1];
+    for(uint8_t len = 1; len <= INFLATE_MAX_BITS; len++) {
+        code = (code + huffman->count[len - 1]) << 1;
+        next_code[len] = code;
+    }
+
+    for(uint16_t symbol = 0; symbol < codes; symbol++) {
+        uint8_t len = lengths[symbol];
+        if(!len) continue;
+        huffman->symbol[offsets[len]++] = symbol;
+
+        uint16_t value = next_code[len]++;
+        if(len > INFLATE_FAST_BITS) continue;
+
+        // Deflate sends codes MSB first into an LSB first stream
+        uint16_t reversed = 0;
+        for(uint8_t i = 0; i < len; i++) {
+            reversed = (reversed << 1) | ((value >> i) & 1);
+        }
+        for(uint16_t fill = reversed; fill < (1U << INFLATE_FAST_BITS); fill += 1U << len) {
+            huffman->fast[fill] = (symbol << 4) | len;
+        }
+    }
+
+    return true;
+}
+
+static int32_t inflate_decode(ImageInflate* inflate, const InflateHuffman* huffman) {
+    inflate_fill(inflate, INFLATE_MAX_BITS);
+
+    uint16_t entry = huffman->fast[inflate->bits & ((1U << INFLATE_FAST_BITS) - 1)];
+    if(entry) {
+        uint8_t len = entry & 0x0F;
+        inflate->bits >>= len;
+        inflate->bit_count -= len;
+        return entry >> 4;
+    }
+
+    // Slow path for long codes
+    int32_t code = 0;
+    int32_t first = 0;
+    int32_t index = 0;
+    for(uint8_t len = 1; len <= INFLATE_MAX_BITS; len++) {
+        code |= inflate->bits & 1;
+        inflate->bits >>= 1;
+        inflate->bit_count--;
+        int32_t count = huffman->count[len];
+        if(code - count < first) {
+            return huffman->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+static bool inflate_load_fixed(ImageInflate* inflate) {
+    uint8_t* lengths = inflate->lengths;
+    uint16_t i = 0;
+    for(; i < 144; i++)
+        lengths[i] = 8;
+    for(; i < 256; i++)
+        lengths[i] = 9;
+    for(; i < 280; i++)
+        lengths[i] = 7;
+    for(; i < INFLATE_LITLEN_CODES; i++)
+        lengths[i] = 8;
+    inflate_build(&inflate->litlen, lengths, INFLATE_LITLEN_CODES);
+
+    memset(lengths, 5, INFLATE_DIST_CODES);
+    inflate_build(&inflate->dist, lengths, INFLATE_DIST_CODES);
+    inflate->fixed_loaded = true;
+    return true;
+}
+
+static bool inflate_load_dynamic(ImageInflate* inflate) {
+    uint16_t litlen_codes = inflate_bits(inflate, 5) + 257;
+    uint16_t dist_codes = inflate_bits(inflate, 5) + 1;
+    uint16_t clen_codes = inflate_bits(inflate, 4) + 4;
+    if(litlen_codes > 286 || dist_codes > 30) return false;
+
+    // Code length alphabet is built into the distance table, which is free now
+    uint8_t* lengths = inflate->lengths;
+    memset(lengths, 0, 19);
+    for(uint16_t i = 0; i < clen_codes; i++) {
+        lengths[inflate_clen_order[i]] = inflate_bits(inflate, 3);
+    }
+    if(!inflate_build(&inflate->dist, lengths, 19)) return false;
+
+    uint16_t total = litlen_codes + dist_codes;
+    for(uint16_t i = 0; i < total;) {
+        int32_t symbol = inflate_decode(inflate, &inflate->dist);
+        if(symbol < 0) return false;
+
+        if(symbol < 16) {
+            lengths[i++] = symbol;
+            continue;
+        }
+
+        uint8_t repeat_value = 0;
+        uint8_t repeat;
+        if(symbol == 16) {
+            if(i == 0) return false;
+            repeat_value = lengths[i - 1];
+            repeat = 3 + inflate_bits(inflate, 2);
+        } else if(symbol == 17) {
+            repeat = 3 + inflate_bits(inflate, 3);
+        } else {
+            repeat = 11 + inflate_bits(inflate, 7);
+        }
+        if(i + repeat > total) return false;
+        while(repeat--) {
+            lengths[i++] = repeat_value;
+        }
+    }
+
+    if(lengths[256] == 0) return false;
+    if(!inflate_build(&inflate->litlen, lengths, litlen_codes)) return false;
+    if(!inflate_build(&inflate->dist, lengths + litlen_codes, dist_codes)) return false;
+    inflate->fixed_loaded = false;
+    return !inflate_overrun(inflate);
+}
+
+static bool inflate_block_header(ImageInflate* inflate) {
+    if(inflate->last_block) {
+        inflate->state = InflateStateDone;
+        return true;
+    }
+
+    inflate->last_block = inflate_bits(inflate, 1);
+    switch(inflate_bits(inflate, 2)) {
+    case 0: {
+        // Stored: drop to a byte boundary, then LEN and its complement
+        inflate_bits(inflate, inflate->bit_count & 7);
+        uint16_t len = inflate_bits(inflate, 16);
+        uint16_t nlen = inflate_bits(inflate, 16);
+        if((len ^ nlen) != 0xFFFF) return false;
+        inflate->stored_left = len;
+        inflate->state = InflateStateStored;
+        break;
+    }
+    case 1:
+        if(!inflate->fixed_loaded) inflate_load_fixed(inflate);
+        inflate->state = InflateStateCodes;
+        break;
+    case 2:
+        if(!inflate_load_dynamic(inflate)) return false;
+        inflate->state = InflateStateCodes;
+        break;
+    default:
+        return false;
+    }
+
+    return !inflate_overrun(inflate);
+}
+
+static inline void inflate_put(ImageInflate* inflate, uint8_t byte) {
+    inflate->window[inflate->window_pos] = byte;
+    inflate->window_pos = (inflate->window_pos + 1) & inflate->window_mask;
+    if(inflate->window_fill <= inflate->window_mask) inflate->window_fill++;
+}
+
+size_t image_inflate_read(ImageInflate* inflate, uint8_t* out, size_t size) {
+    size_t produced = 0;
+
+    while(produced < size) {
+        switch(inflate->state) {
+        case InflateStateHeader:
+            if(!inflate_block_header(inflate)) inflate->state = InflateStateError;
+            break;
+
+        case InflateStateStored:
+            if(!inflate->stored_left) {
+                inflate->state = InflateStateHeader;
+                break;
+            }
+            while(inflate->stored_left && produced < size) {
+                uint8_t byte = inflate_bits(inflate, 8);
+                if(inflate_overrun(inflate)) {
+                    inflate->state = InflateStateError;
+                    break;
+                }
+                out[produced++] = byte;
+                inflate_put(inflate, byte);
+                inflate->stored_left--;
+            }
+            break;
+
+        case InflateStateCodes:
+            // Finish any back-reference left over from the previous call first
+            while(inflate->copy_len && produced < size) {
+                uint32_t from = inflate->window_pos - inflate->copy_dist;
+                uint8_t byte = inflate->window[from & inflate->window_mask];
+                out[produced++] = byte;
+                inflate_put(inflate, byte);
+                inflate->copy_len--;
+            }
+
+            while(!inflate->copy_len && produced < size) {
+                int32_t symbol = inflate_decode(inflate, &inflate->litlen);
+                if(symbol < 0 || inflate_overrun(inflate)) {
+                    inflate->state = InflateStateError;
+                    break;
+                }
+
+                if(symbol < 256) {
+                    out[produced++] = symbol;
+                    inflate_put(inflate, symbol);
+                    continue;
+                }
+                if(symbol == 256) {
+                    inflate->state = InflateStateHeader;
+                    break;
+                }
+
+                symbol -= 257;
+                if(symbol >= 29) {
+                    inflate->state = InflateStateError;
+                    break;
+                }
+                uint16_t len = inflate_length_base[symbol] +
+                               inflate_bits(inflate, inflate_length_extra[symbol]);
+
+                int32_t dist_symbol = inflate_decode(inflate, &inflate->dist);
+                if(dist_symbol < 0 || dist_symbol >= 30) {
+                    inflate->state = InflateStateError;
+                    break;
+                }
+                uint32_t dist = inflate_dist_base[dist_symbol] +
+                                inflate_bits(inflate, inflate_dist_extra[dist_symbol]);
+                if(dist > inflate->window_fill || inflate_overrun(inflate)) {
+                    inflate->state = InflateStateError;
+                    break;
+                }
+
+                inflate->copy_len = len;
+                inflate->copy_dist = dist;
+                while(inflate->copy_len && produced < size) {
+                    uint8_t byte =
+                        inflate->window[(inflate->window_pos - dist) & inflate->window_mask];
+                    out[produced++] = byte;
+                    inflate_put(inflate, byte);
+                    inflate->copy_len--;
+                }
+            }
+            break;
+
+        case InflateStateDone:
+        case InflateStateError:
+            return produced;
+        }
+    }
+
+    return produced;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Pull-model DEFLATE (RFC 1951) decoder. Compressed bytes are fetched on
+// demand through the input callback and decompressed bytes are handed out in
+// whatever slices the caller asks for, so nothing but the sliding window and
+// the Huffman tables is ever resident.
+typedef struct ImageInflate ImageInflate;
+
+// Fill buffer with up to size compressed bytes, return 0 at end of input
+typedef size_t (*ImageInflateInputCallback)(uint8_t* buffer, size_t size, void* context);
+
+// Allocate a decoder with a 2^window_bits byte history (8..15)
+ImageInflate*
+    image_inflate_alloc(uint8_t window_bits, ImageInflateInputCallback input, void* context);
+
+void image_inflate_free(ImageInflate* inflate);
+
+// Heap bytes used by a decoder with the given window, for budgeting up front
+size_t image_inflate_get_memory_size(uint8_t window_bits);
+
+// Decompress up to size bytes into out. Returns the number of bytes produced,
+// which is only short of size at the end of the stream or on error.
+size_t image_inflate_read(ImageInflate* inflate, uint8_t* out, size_t size);
+
+// True if the stream was malformed or truncated
+bool image_inflate_failed(const ImageInflate* inflate);
+
+#ifdef __cplusplus
+}
+#endif
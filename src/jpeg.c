@@ -0,0 +1,681 @@
+#include <furi.h>
+#include <storage/storage.h>
+#include "jpeg.h"
+#include "reader.h"
+#include "scaler.h"
+
+#define TAG "ImageJpeg"
+
+#define JPEG_FAST_BITS 9
+
+// Baseline allows two DC and two AC tables. Extended sequential (SOF1) files
+// may use four, and are unsupported when they do.
+#define JPEG_TABLES 2
+
+// Upper bound for the scaled MCU row buffer; extreme aspect ratios fall back
+// to a coarser IDCT instead of allocating more
+#define JPEG_MAX_ROW_BUFFER (16 * 1024)
+
+#define JPEG_MARKER_SOF0 0xC0
+#define JPEG_MARKER_SOF1 0xC1
+#define JPEG_MARKER_DHT  0xC4
+#define JPEG_MARKER_RST0 0xD0
+#define JPEG_MARKER_RST7 0xD7
+#define JPEG_MARKER_SOI  0xD8
+#define JPEG_MARKER_EOI  0xD9
+#define JPEG_MARKER_SOS  0xDA
+#define JPEG_MARKER_DQT  0xDB
+#define JPEG_MARKER_DRI  0xDD
+
+typedef struct {
+    uint16_t lookup[1 << JPEG_FAST_BITS]; // (length << 8) | symbol, 0 for long codes
+    int32_t maxcode[18];
+    int16_t valoffset[17];
+    uint8_t symbols[256];
+    bool defined;
+} JpegHuffman;
+
+typedef struct {
+    uint8_t id;
+    uint8_t h;
+    uint8_t v;
+    uint8_t tq;
+    uint8_t td;
+    uint8_t ta;
+    bool in_scan;
+    int32_t pred;
+} JpegComponent;
+
+typedef struct {
+    ImageReader* reader;
+
+    uint32_t bits; // MSB aligned
+    int8_t bit_count;
+    bool marker_hit; // Entropy data ended at a marker, pad with zeros
+    uint8_t marker;
+
+    uint16_t qt[4][64]; // Zigzag order, as stored
+    JpegHuffman dc[JPEG_TABLES];
+    JpegHuffman ac[JPEG_TABLES];
+    JpegComponent components[4];
+    uint8_t component_count;
+    uint16_t width;
+    uint16_t height;
+    uint8_t hmax;
+    uint8_t vmax;
+    uint16_t restart_interval;
+    bool frame_seen;
+
+    uint8_t scale_shift; // Blocks decode to 8 >> scale_shift pixels square
+    int32_t coef[64];
+    uint8_t* rows; // One MCU row of scaled luma
+    uint32_t row_stride;
+    uint32_t scaled_width;
+    uint32_t scaled_height;
+
+    ImageScaler* scaler;
+} JpegDecoder;
+
+static const uint8_t jpeg_zigzag[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+    41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+    30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+// C(u) / 2 * cos((2x + 1) * u * pi / 2N) in 4.12 fixed point, indexed [x][u],
+// for N = 8, 4 and 2. Feeding the top-left NxN coefficients through the
+// N-point transform yields the 8/N box-filtered block directly.
+static const int16_t jpeg_idct8[64] = {
+    1448, 2009,  1892,  1703,  1448,  1138,  784,   400,   1448, 1703,  784,  -400, -1448,
+    -2009, -1892, -1138, 1448,  1138,  -784,  -2009, -1448, 400,  1892,  1703, 1448, 400,
+    -1892, -1138, 1448,  1703,  -784,  -2009, 1448,  -400,  -1892, 1138, 1448, -1703, -784,
+    2009,  1448,  -1138, -784,  2009,  -1448, -400,  1892,  -1703, 1448, -1703, 784,  400,
+    -1448, 2009,  -1892, 1138,  1448,  -2009, 1892,  -1703, 1448,  -1138, 784,  -400};
+static const int16_t jpeg_idct4[16] = {
+    1448, 1892, 1448, 784, 1448, 784, -1448, -1892,
+    1448, -784, -1448, 1892, 1448, -1892, 1448, -784};
+static const int16_t jpeg_idct2[4] = {1448, 1448, 1448, -1448};
+
+static inline int32_t jpeg_next_byte(JpegDecoder* jpeg) {
+    return image_reader_byte(jpeg->reader);
+}
+
+static int32_t jpeg_next_u16(JpegDecoder* jpeg) {
+    int32_t hi = jpeg_next_byte(jpeg);
+    int32_t lo = jpeg_next_byte(jpeg);
+    if(hi < 0 || lo < 0) return -1;
+    return (hi << 8) | lo;
+}
+
+// Large segments (EXIF thumbnails) are seeked over, not read
+static inline bool jpeg_skip(JpegDecoder* jpeg, uint32_t size) {
+    return image_reader_skip(jpeg->reader, size);
+}
+
+// Next marker code, skipping fill bytes and any garbage in between
+static int32_t jpeg_next_marker(JpegDecoder* jpeg) {
+    int32_t byte;
+    do {
+        do {
+            byte = jpeg_next_byte(jpeg);
+            if(byte < 0) return -1;
+        } while(byte != 0xFF);
+        do {
+            byte = jpeg_next_byte(jpeg);
+            if(byte < 0) return -1;
+        } while(byte == 0xFF);
+    } while(byte == 0);
+    return byte;
+}
+
+static bool jpeg_read_dqt(JpegDecoder* jpeg, int32_t length) {
+    while(length > 0) {
+        int32_t info = jpeg_next_byte(jpeg);
+        if(info < 0 || (info & 0x0F) > 3) return false;
+        bool wide = info >> 4;
+        uint16_t* table = jpeg->qt[info & 0x0F];
+        for(uint8_t i = 0; i < 64; i++) {
+            int32_t value = wide ? jpeg_next_u16(jpeg) : jpeg_next_byte(jpeg);
+            if(value < 0) return false;
+            table[i] = value;
+        }
+        length -= 1 + (wide ? 128 : 64);
+    }
+    return length == 0;
+}
+
+static bool jpeg_build_huffman(JpegHuffman* huffman, const uint8_t* counts) {
+    // Reject oversubscribed code sets before any code lands in the lookup
+    int32_t left = 1;
+    for(uint8_t len = 1; len <= 16; len++) {
+        left <<= 1;
+        left -= counts[len - 1];
+        if(left < 0) return false;
+    }
+
+    uint32_t code = 0;
+    uint16_t index = 0;
+
+    memset(huffman->lookup, 0, sizeof(huffman->lookup));
+    for(uint8_t len = 1; len <= 16; len++) {
+        uint8_t count = counts[len - 1];
+        huffman->valoffset[len] = index - code;
+        for(uint8_t i = 0; i < count; i++, index++, code++) {
+            if(len <= JPEG_FAST_BITS) {
+                uint32_t shift = JPEG_FAST_BITS - len;
+                uint32_t first = code << shift;
+                for(uint32_t fill = 0; fill < (1U << shift); fill++) {
+                    huffman->lookup[first + fill] = (len << 8) | huffman->symbols[index];
+                }
+            }
+        }
+        huffman->maxcode[len] = count ? (int32_t)code - 1 : -1;
+        code <<= 1;
+    }
+    huffman->maxcode[17] = INT32_MAX;
+    huffman->defined = true;
+    return true;
+}
+
+static ImageConverterResult jpeg_read_dht(JpegDecoder* jpeg, int32_t length) {
+    while(length > 0) {
+        int32_t info = jpeg_next_byte(jpeg);
+        if(info < 0 || (info & 0x0F) > 3 || (info >> 4) > 1) return ImageConverterError;
+        if((info & 0x0F) >= JPEG_TABLES) return ImageConverterUnsupported;
+        JpegHuffman* huffman = (info >> 4) ? &jpeg->ac[info & 0x0F] : &jpeg->dc[info & 0x0F];
+
+        uint8_t counts[16];
+        uint16_t total = 0;
+        for(uint8_t i = 0; i < 16; i++) {
+            int32_t count = jpeg_next_byte(jpeg);
+            if(count < 0) return ImageConverterError;
+            counts[i] = count;
+            total += count;
+        }
+        if(total > 256) return ImageConverterError;
+        for(uint16_t i = 0; i < total; i++) {
+            int32_t symbol = jpeg_next_byte(jpeg);
+            if(symbol < 0) return ImageConverterError;
+            huffman->symbols[i] = symbol;
+        }
+        if(!jpeg_build_huffman(huffman, counts)) return ImageConverterError;
+        length -= 17 + total;
+    }
+    return length == 0 ? ImageConverterOK : ImageConverterError;
+}
+
+static ImageConverterResult jpeg_read_sof(JpegDecoder* jpeg, int32_t length) {
+    int32_t precision = jpeg_next_byte(jpeg);
+    int32_t height = jpeg_next_u16(jpeg);
+    int32_t width = jpeg_next_u16(jpeg);
+    int32_t count = jpeg_next_byte(jpeg);
+    if(count < 0) return ImageConverterError;
+    if(precision != 8 || height <= 0 || width <= 0) return ImageConverterUnsupported;
+    if(count < 1 || count > 4 || length != 6 + count * 3) return ImageConverterError;
+
+    jpeg->width = width;
+    jpeg->height = height;
+    jpeg->component_count = count;
+    jpeg->hmax = 1;
+    jpeg->vmax = 1;
+    for(uint8_t i = 0; i < count; i++) {
+        JpegComponent* component = &jpeg->components[i];
+        int32_t id = jpeg_next_byte(jpeg);
+        int32_t sampling = jpeg_next_byte(jpeg);
+        int32_t tq = jpeg_next_byte(jpeg);
+        if(tq < 0 || tq > 3) return ImageConverterError;
+        component->id = id;
+        component->h = sampling >> 4;
+        component->v = sampling & 0x0F;
+        component->tq = tq;
+        if(component->h < 1 || component->h > 4 || component->v < 1 || component->v > 4) {
+            return ImageConverterError;
+        }
+        jpeg->hmax = MAX(jpeg->hmax, component->h);
+        jpeg->vmax = MAX(jpeg->vmax, component->v);
+    }
+
+    // Luma must be the full resolution component
+    if(jpeg->components[0].h != jpeg->hmax || jpeg->components[0].v != jpeg->vmax) {
+        return ImageConverterUnsupported;
+    }
+
+    jpeg->frame_seen = true;
+    return ImageConverterOK;
+}
+
+static inline void jpeg_fill(JpegDecoder* jpeg) {
+    while(jpeg->bit_count <= 24) {
+        uint32_t byte = 0;
+        if(!jpeg->marker_hit) {
+            int32_t next = jpeg_next_byte(jpeg);
+            if(next < 0) {
+                jpeg->marker_hit = true;
+                jpeg->marker = JPEG_MARKER_EOI;
+            } else if(next == 0xFF) {
+                int32_t stuffed = jpeg_next_byte(jpeg);
+                while(stuffed == 0xFF) {
+                    stuffed = jpeg_next_byte(jpeg);
+                }
+                if(stuffed == 0) {
+                    byte = 0xFF;
+                } else {
+                    // A marker ends the entropy coded segment
+                    jpeg->marker_hit = true;
+                    jpeg->marker = stuffed < 0 ? JPEG_MARKER_EOI : stuffed;
+                }
+            } else {
+                byte = next;
+            }
+        }
+        jpeg->bits |= byte << (24 - jpeg->bit_count);
+        jpeg->bit_count += 8;
+    }
+}
+
+static inline uint32_t jpeg_bits(JpegDecoder* jpeg, uint8_t count) {
+    if(!count) return 0;
+    jpeg_fill(jpeg);
+    uint32_t value = jpeg->bits >> (32 - count);
+    jpeg->bits <<= count;
+    jpeg->bit_count -= count;
+    return value;
+}
+
+// Sign-extend a count-bit magnitude category value (the spec's EXTEND)
+static inline int32_t jpeg_receive(JpegDecoder* jpeg, uint8_t count) {
+    if(!count) return 0;
+    int32_t value = jpeg_bits(jpeg, count);
+    if(value < (1 << (count - 1))) value -= (1 << count) - 1;
+    return value;
+}
+
+static inline int32_t jpeg_decode(JpegDecoder* jpeg, const JpegHuffman* huffman) {
+    jpeg_fill(jpeg);
+
+    uint16_t entry = huffman->lookup[jpeg->bits >> (32 - JPEG_FAST_BITS)];
+    if(entry) {
+        uint8_t len = entry >> 8;
+        jpeg->bits <<= len;
+        jpeg->bit_count -= len;
+        return entry & 0xFF;
+    }
+
+    uint8_t len = JPEG_FAST_BITS + 1;
+    int32_t code = jpeg->bits >> (32 - len);
+    while(code > huffman->maxcode[len]) {
+        if(++len > 16) return -1;
+        code = jpeg->bits >> (32 - len);
+    }
+    jpeg->bits <<= len;
+    jpeg->bit_count -= len;
+    return huffman->symbols[(code + huffman->valoffset[len]) & 0xFF];
+}
+
+// Entropy decode one block. With coef set, dequantized coefficients inside
+// the top-left keep x keep corner are stored in natural order; everything
+// else is decoded only to advance the bitstream.
+static bool jpeg_decode_block(
+    JpegDecoder* jpeg,
+    JpegComponent* component,
+    int32_t* coef,
+    uint8_t keep) {
+    const JpegHuffman* dc = &jpeg->dc[component->td];
+    const JpegHuffman* ac = &jpeg->ac[component->ta];
+    const uint16_t* qt = jpeg->qt[component->tq];
+
+    int32_t size = jpeg_decode(jpeg, dc);
+    if(size < 0 || size > 11) return false;
+    // Valid DC values fit 11 bits; corrupt streams without restarts could
+    // otherwise run the predictor up until the products below overflow
+    int32_t pred = component->pred + jpeg_receive(jpeg, size);
+    component->pred = CLAMP(pred, 2047, -2048);
+
+    if(coef) {
+        memset(coef, 0, keep == 1 ? sizeof(int32_t) : sizeof(int32_t) * 64);
+        int32_t value = component->pred * qt[0];
+        coef[0] = CLAMP(value, 4095, -4096);
+    }
+
+    for(uint8_t k = 1; k < 64;) {
+        int32_t symbol = jpeg_decode(jpeg, ac);
+        if(symbol < 0) return false;
+        uint8_t run = symbol >> 4;
+        uint8_t bits = symbol & 0x0F;
+
+        if(!bits) {
+            if(run != 15) break; // End of block
+            k += 16;
+            continue;
+        }
+
+        k += run;
+        if(k > 63) return false;
+        uint8_t natural = jpeg_zigzag[k];
+        if(coef && (natural >> 3) < keep && (natural & 7) < keep) {
+            // Clamping keeps the fixed point IDCT in range on corrupt data
+            int32_t value = jpeg_receive(jpeg, bits) * qt[k];
+            coef[natural] = CLAMP(value, 4095, -4096);
+        } else {
+            jpeg_bits(jpeg, bits);
+        }
+        k++;
+    }
+
+    return true;
+}
+
+// Mean of a block from its dequantized DC coefficient
+static inline uint8_t jpeg_dc_luma(int32_t dc) {
+    int32_t value = ((dc + 4) >> 3) + 128;
+    return CLAMP(value, 255, 0);
+}
+
+// Reduced-size IDCT of the top-left n x n coefficients into an n x n tile
+static void jpeg_idct(const int32_t* coef, uint8_t n, uint8_t* out, uint32_t stride) {
+    if(n == 1) {
+        out[0] = jpeg_dc_luma(coef[0]);
+        return;
+    }
+
+    const int16_t* table = (n == 8) ? jpeg_idct8 : (n == 4) ? jpeg_idct4 : jpeg_idct2;
+    int32_t tmp[64];
+
+    // Rows: 4.12 table x coefficients, kept with 3 fractional bits
+    for(uint8_t v = 0; v < n; v++) {
+        const int32_t* in = coef + v * 8;
+        bool ac_zero = true;
+        for(uint8_t u = 1; u < n; u++) {
+            if(in[u]) {
+                ac_zero = false;
+                break;
+            }
+        }
+        for(uint8_t x = 0; x < n; x++) {
+            int32_t sum;
+            if(ac_zero) {
+                sum = in[0] * table[0];
+            } else {
+                sum = 0;
+                for(uint8_t u = 0; u < n; u++) {
+                    sum += in[u] * table[x * n + u];
+                }
+            }
+            tmp[v * 8 + x] = (sum + 256) >> 9;
+        }
+    }
+
+    // Columns, then level shift
+    for(uint8_t x = 0; x < n; x++) {
+        for(uint8_t y = 0; y < n; y++) {
+            int32_t sum = 0;
+            for(uint8_t v = 0; v < n; v++) {
+                sum += tmp[v * 8 + x] * table[y * n + v];
+            }
+            int32_t value = ((sum + (1 << 14)) >> 15) + 128;
+            out[y * stride + x] = CLAMP(value, 255, 0);
+        }
+    }
+}
+
+static bool jpeg_restart(JpegDecoder* jpeg) {
+    // Drop the partial byte and expect RSTn
+    jpeg->bits = 0;
+    jpeg->bit_count = 0;
+    if(!jpeg->marker_hit) {
+        int32_t marker = jpeg_next_marker(jpeg);
+        if(marker < 0) return false;
+        jpeg->marker = marker;
+    }
+    if(jpeg->marker < JPEG_MARKER_RST0 || jpeg->marker > JPEG_MARKER_RST7) return false;
+    jpeg->marker_hit = false;
+
+    for(uint8_t i = 0; i < jpeg->component_count; i++) {
+        jpeg->components[i].pred = 0;
+    }
+    return true;
+}
+
+static ImageConverterResult jpeg_setup_output(
+    JpegDecoder* jpeg,
+    uint32_t mcu_columns,
+    uint8_t mcu_blocks_h,
+    uint8_t mcu_blocks_v) {
+    // Coarsest IDCT that still leaves at least one scaled pixel per output
+    // pixel, which is 128x64 unless zoomed in
+    jpeg->scale_shift = 3;
+    while(jpeg->scale_shift > 0 &&
+          ((uint32_t)jpeg->width >> jpeg->scale_shift < jpeg->scaler->out_width ||
+           (uint32_t)jpeg->height >> jpeg->scale_shift < jpeg->scaler->out_height)) {
+        jpeg->scale_shift--;
+    }
+
+    uint8_t block = 8 >> jpeg->scale_shift;
+    while(jpeg->scale_shift < 3 &&
+          mcu_columns * mcu_blocks_h * block * mcu_blocks_v * block > JPEG_MAX_ROW_BUFFER) {
+        jpeg->scale_shift++;
+        block = 8 >> jpeg->scale_shift;
+    }
+
+    jpeg->row_stride = mcu_columns * mcu_blocks_h * block;
+    size_t size = jpeg->row_stride * mcu_blocks_v * block;
+    if(size > JPEG_MAX_ROW_BUFFER) return ImageConverterUnsupported;
+
+    uint32_t divisor = 1U << jpeg->scale_shift;
+    jpeg->scaled_width = (jpeg->width + divisor - 1) >> jpeg->scale_shift;
+    jpeg->scaled_height = (jpeg->height + divisor - 1) >> jpeg->scale_shift;
+    FURI_LOG_I(
+        TAG,
+        "%ux%u, 1/%lu IDCT to %lux%lu",
+        jpeg->width,
+        jpeg->height,
+        (unsigned long)divisor,
+        (unsigned long)jpeg->scaled_width,
+        (unsigned long)jpeg->scaled_height);
+
+    jpeg->rows = malloc(size);
+    if(!jpeg->rows) return ImageConverterError;
+    image_scaler_init(jpeg->scaler, jpeg->scaled_width, jpeg->scaled_height);
+    return ImageConverterOK;
+}
+
+static ImageConverterResult jpeg_decode_scan(JpegDecoder* jpeg) {
+    JpegComponent* luma = &jpeg->components[0];
+    bool interleaved = false;
+    uint8_t scan_components = 0;
+    for(uint8_t i = 0; i < jpeg->component_count; i++) {
+        if(jpeg->components[i].in_scan) scan_components++;
+    }
+    interleaved = scan_components > 1;
+
+    // A non-interleaved luma scan codes one block per MCU over the luma plane
+    uint8_t mcu_blocks_h = interleaved ? luma->h : 1;
+    uint8_t mcu_blocks_v = interleaved ? luma->v : 1;
+    uint32_t mcu_width = interleaved ? 8 * jpeg->hmax : 8;
+    uint32_t mcu_height = interleaved ? 8 * jpeg->vmax : 8;
+    uint32_t mcu_columns = (jpeg->width + mcu_width - 1) / mcu_width;
+    uint32_t mcu_rows = (jpeg->height + mcu_height - 1) / mcu_height;
+
+    ImageConverterResult result = jpeg_setup_output(jpeg, mcu_columns, mcu_blocks_h, mcu_blocks_v);
+    if(result != ImageConverterOK) return result;
+
+    uint8_t block = 8 >> jpeg->scale_shift;
+    uint32_t rows_per_mcu = mcu_blocks_v * block;
+    uint32_t restarts_left = jpeg->restart_interval;
+
+    for(uint32_t mcu_y = 0; mcu_y < mcu_rows; mcu_y++) {
+        // MCU rows the scaler does not sample are entropy decoded only
+        uint32_t first_row = mcu_y * rows_per_mcu;
+        bool wanted = false;
+        for(uint32_t y = first_row; y < first_row + rows_per_mcu && y < jpeg->scaled_height; y++) {
+            if(image_scaler_wants_row(jpeg->scaler, y)) {
+                wanted = true;
+                break;
+            }
+        }
+
+        for(uint32_t mcu_x = 0; mcu_x < mcu_columns; mcu_x++) {
+            if(jpeg->restart_interval) {
+                if(restarts_left == 0) {
+                    if(!jpeg_restart(jpeg)) return ImageConverterError;
+                    restarts_left = jpeg->restart_interval;
+                }
+                restarts_left--;
+            }
+
+            for(uint8_t c = 0; c < jpeg->component_count; c++) {
+                JpegComponent* component = &jpeg->components[c];
+                if(!component->in_scan) continue;
+
+                uint8_t blocks_h = interleaved ? component->h : 1;
+                uint8_t blocks_v = interleaved ? component->v : 1;
+                for(uint8_t by = 0; by < blocks_v; by++) {
+                    for(uint8_t bx = 0; bx < blocks_h; bx++) {
+                        bool keep = wanted && component == luma;
+                        if(!jpeg_decode_block(
+                               jpeg, component, keep ? jpeg->coef : NULL, block)) {
+                            return ImageConverterError;
+                        }
+                        // The DC value of every luma block, inside the tile
+                        // or not, goes into the levels histogram
+                        if(component == luma) {
+                            int32_t dc = component->pred * jpeg->qt[component->tq][0];
+                            image_scaler_sample(jpeg->scaler, jpeg_dc_luma(dc));
+                        }
+                        if(keep) {
+                            uint32_t x = (mcu_x * mcu_blocks_h + bx) * block;
+                            uint32_t y = by * block;
+                            jpeg_idct(
+                                jpeg->coef,
+                                block,
+                                jpeg->rows + y * jpeg->row_stride + x,
+                                jpeg->row_stride);
+                        }
+                    }
+                }
+            }
+        }
+
+        if(wanted) {
+            for(uint32_t y = 0; y < rows_per_mcu && first_row + y < jpeg->scaled_height; y++) {
+                image_scaler_push_row(
+                    jpeg->scaler, first_row + y, jpeg->rows + y * jpeg->row_stride);
+            }
+        }
+    }
+
+    return ImageConverterOK;
+}
+
+static ImageConverterResult jpeg_read_sos(JpegDecoder* jpeg, int32_t length) {
+    int32_t count = jpeg_next_byte(jpeg);
+    if(count < 1 || count > 4 || length != 4 + count * 2) return ImageConverterError;
+
+    for(uint8_t i = 0; i < jpeg->component_count; i++) {
+        jpeg->components[i].in_scan = false;
+        jpeg->components[i].pred = 0;
+    }
+    for(int32_t i = 0; i < count; i++) {
+        int32_t id = jpeg_next_byte(jpeg);
+        int32_t tables = jpeg_next_byte(jpeg);
+        if(tables < 0) return ImageConverterError;
+        for(uint8_t c = 0; c < jpeg->component_count; c++) {
+            JpegComponent* component = &jpeg->components[c];
+            if(component->id != id) continue;
+            component->in_scan = true;
+            component->td = tables >> 4;
+            component->ta = tables & 0x0F;
+            if(component->td > 3 || component->ta > 3) return ImageConverterError;
+            if(component->td >= JPEG_TABLES || component->ta >= JPEG_TABLES) {
+                return ImageConverterUnsupported;
+            }
+            if(!jpeg->dc[component->td].defined || !jpeg->ac[component->ta].defined) {
+                return ImageConverterError;
+            }
+        }
+    }
+
+    // Spectral selection and approximation must cover everything in baseline
+    int32_t ss = jpeg_next_byte(jpeg);
+    int32_t se = jpeg_next_byte(jpeg);
+    int32_t approx = jpeg_next_byte(jpeg);
+    if(ss != 0 || se != 63 || approx != 0) return ImageConverterUnsupported;
+
+    jpeg->bits = 0;
+    jpeg->bit_count = 0;
+    jpeg->marker_hit = false;
+    return ImageConverterOK;
+}
+
+static ImageConverterResult jpeg_decode_file(JpegDecoder* jpeg) {
+    if(jpeg_next_byte(jpeg) != 0xFF || jpeg_next_byte(jpeg) != JPEG_MARKER_SOI) {
+        return ImageConverterError;
+    }
+
+    while(true) {
+        int32_t marker = jpeg_next_marker(jpeg);
+        if(marker < 0 || marker == JPEG_MARKER_EOI) return ImageConverterError;
+        if(marker == JPEG_MARKER_SOI ||
+           (marker >= JPEG_MARKER_RST0 && marker <= JPEG_MARKER_RST7)) {
+            continue;
+        }
+
+        int32_t length = jpeg_next_u16(jpeg);
+        if(length < 2) return ImageConverterError;
+        length -= 2;
+
+        ImageConverterResult result = ImageConverterOK;
+        switch(marker) {
+        case JPEG_MARKER_SOF0:
+        case JPEG_MARKER_SOF1:
+            result = jpeg_read_sof(jpeg, length);
+            break;
+        case JPEG_MARKER_DHT:
+            result = jpeg_read_dht(jpeg, length);
+            break;
+        case JPEG_MARKER_DQT:
+            if(!jpeg_read_dqt(jpeg, length)) result = ImageConverterError;
+            break;
+        case JPEG_MARKER_DRI:
+            if(length != 2) return ImageConverterError;
+            jpeg->restart_interval = jpeg_next_u16(jpeg);
+            break;
+        case JPEG_MARKER_SOS:
+            if(!jpeg->frame_seen) return ImageConverterError;
+            result = jpeg_read_sos(jpeg, length);
+            if(result != ImageConverterOK) return result;
+            if(jpeg->components[0].in_scan) {
+                // The luma scan is all we need
+                return jpeg_decode_scan(jpeg);
+            }
+            // Chroma-only scan of a non-interleaved file: skip to the next marker
+            break;
+        default:
+            if(marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 &&
+               marker != 0xCC) {
+                // Progressive, lossless and arithmetic coded frames
+                return ImageConverterUnsupported;
+            }
+            if(!jpeg_skip(jpeg, length)) result = ImageConverterError;
+            break;
+        }
+
+        if(result != ImageConverterOK) return result;
+    }
+}
+
+ImageConverterResult image_jpeg_decode(ImageReader* reader, ImageScaler* scaler) {
+    JpegDecoder* jpeg = malloc(sizeof(JpegDecoder));
+    if(!jpeg) return ImageConverterError;
+    memset(jpeg, 0, sizeof(JpegDecoder));
+    jpeg->reader = reader;
+    jpeg->scaler = scaler;
+
+    ImageConverterResult result = jpeg_decode_file(jpeg);
+    if(result != ImageConverterOK) {
+        FURI_LOG_E(TAG, "Decode failed: %d", result);
+    }
+
+    free(jpeg->rows);
+    free(jpeg);
+    return result;
+}
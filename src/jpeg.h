@@ -0,0 +1,21 @@
+#pragma once
+
+#include <storage/storage.h>
+#include "convert.h"
+#include "reader.h"
+#include "scaler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Decode a baseline (or extended sequential, Huffman) JPEG from the start of
+// a file into the scaler. Only the luma component is reconstructed,
+// with a reduced-size IDCT (8x8, 4x4, 2x2 or DC only) picked so the scaled
+// image is still at least 128x64. Chroma blocks are entropy
+// decoded and dropped. One MCU row of scaled luma is kept at a time.
+ImageConverterResult image_jpeg_decode(ImageReader* reader, ImageScaler* scaler);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,82 @@
+#include <furi.h>
+#include <math.h>
+#include <string.h>
+#include "levels.h"
+
+#define TAG "ImageLevels"
+
+// Share of samples clipped off each end before stretching, in 1/1024
+#define LEVELS_CLIP 5
+
+// Narrowest range stretched to full scale, so gain stays at most 4x and a
+// flat image is not blown up into noise
+#define LEVELS_MIN_RANGE 64
+
+// Gamma only ever lifts: an image whose stretched median is below mid gray
+// is brightened towards it, by at most this exponent
+#define LEVELS_MIN_GAMMA 0.5f
+
+void image_levels_reset(ImageLevels* levels, uint32_t src_width, uint32_t src_height) {
+    memset(levels->histogram, 0, sizeof(levels->histogram));
+    levels->ready = false;
+    levels->row_step = (src_height + IMAGE_LEVELS_ROWS - 1) / IMAGE_LEVELS_ROWS;
+    levels->col_step = (src_width + IMAGE_LEVELS_COLUMNS - 1) / IMAGE_LEVELS_COLUMNS;
+    if(!levels->row_step) levels->row_step = 1;
+    if(!levels->col_step) levels->col_step = 1;
+}
+
+// Darkest value with more than `rank` samples at or below it
+static int32_t levels_rank(const uint32_t* histogram, uint32_t rank) {
+    uint32_t sum = 0;
+    for(int32_t value = 0; value < 256; value++) {
+        sum += histogram[value];
+        if(sum > rank) return value;
+    }
+    return 255;
+}
+
+void image_levels_build(ImageLevels* levels) {
+    uint32_t total = 0;
+    for(uint32_t value = 0; value < 256; value++) {
+        total += levels->histogram[value];
+    }
+
+    int32_t lo = 0;
+    int32_t hi = 255;
+    int32_t median = 128;
+    if(total) {
+        uint32_t clip = (uint64_t)total * LEVELS_CLIP / 1024;
+        lo = levels_rank(levels->histogram, clip);
+        hi = levels_rank(levels->histogram, total - 1 - clip);
+        median = levels_rank(levels->histogram, total / 2);
+    }
+
+    if(hi - lo < LEVELS_MIN_RANGE) {
+        lo = CLAMP((lo + hi) / 2 - LEVELS_MIN_RANGE / 2, 255 - LEVELS_MIN_RANGE, 0);
+        hi = lo + LEVELS_MIN_RANGE;
+    }
+
+    int32_t range = hi - lo;
+    int32_t mid = CLAMP((median - lo) * 255 / range, 255, 0);
+    float gamma = 1.0f;
+    if(mid > 0 && mid < 128) {
+        gamma = MAX(logf(0.5f) / logf(mid / 255.0f), LEVELS_MIN_GAMMA);
+    }
+
+    for(int32_t value = 0; value < 256; value++) {
+        int32_t stretched = CLAMP((value - lo) * 255 / range, 255, 0);
+        if(gamma < 1.0f) {
+            stretched = powf(stretched / 255.0f, gamma) * 255.0f + 0.5f;
+        }
+        levels->lut[value] = stretched;
+    }
+
+    FURI_LOG_D(
+        TAG,
+        "%lu samples, %ld..%ld, median %ld, gamma %d/100",
+        (unsigned long)total,
+        (long)lo,
+        (long)hi,
+        (long)median,
+        (int)(gamma * 100));
+}
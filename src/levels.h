@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Rows and columns sampled for the histogram, at most, spread over the
+// whole source image
+#define IMAGE_LEVELS_ROWS    32
+#define IMAGE_LEVELS_COLUMNS 128
+
+// Auto levels. A luma histogram of the whole source is collected from a
+// cheap sample (a few dozen rows, JPEG DC values, the first Adam7 pass), and
+// turned into a 256 entry table that stretches the tones between the darkest
+// and brightest half percent to full range and lifts dark images with a
+// gamma curve. The scaler runs every output row through the table before
+// dithering, so dark or flat images no longer come out solid black or white.
+// The sample covers the whole image whatever tile is being converted, so all
+// tiles of an image share the table of its whole frame.
+typedef struct {
+    uint32_t histogram[256];
+    uint8_t lut[256];
+    bool ready; // lut is built; samples counted after this are ignored
+    uint32_t row_step; // Source rows and columns between samples
+    uint32_t col_step;
+} ImageLevels;
+
+// Start over for a source image of the given size
+void image_levels_reset(ImageLevels* levels, uint32_t src_width, uint32_t src_height);
+
+static inline bool image_levels_samples_row(const ImageLevels* levels, uint32_t src_y) {
+    return !levels->ready && src_y % levels->row_step == 0;
+}
+
+static inline void image_levels_add(ImageLevels* levels, uint8_t luma) {
+    levels->histogram[luma]++;
+}
+
+// Turn the histogram so far into the table; identity if nothing was
+// counted. Marking the table ready is up to the caller, so a provisional one
+// can be built for a preview while samples still come in.
+void image_levels_build(ImageLevels* levels);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,89 @@
+#include <string.h>
+#include "pack.h"
+
+#if IMAGE_PACK_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "1-bit packing stores little-endian words"
+#endif
+
+// Reference kernel: one pixel at a time into a byte register
+void image_pack_row_bytewise(const uint8_t* line, uint8_t* out) {
+    for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x += 8) {
+        uint8_t byte = 0;
+        for(uint32_t i = 0; i < 8; i++) {
+            if(!(line[x + i] & 0x80)) byte |= 1 << i;
+        }
+        out[x / 8] = byte;
+    }
+}
+
+// Gather the inverted top bits of four little-endian pixel bytes into a
+// nibble: the multiply moves bits 0/8/16/24 to 21..24 without any carries
+static inline uint32_t pack_gather4(uint32_t pixels) {
+    uint32_t dark = (~pixels >> 7) & 0x01010101;
+    return ((dark * 0x00204081) >> 21) & 0xF;
+}
+
+// Portable SWAR kernel: 32 pixels per stored word, four per multiply
+void image_pack_row_swar(const uint8_t* line, uint8_t* out) {
+    for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x += 32) {
+        uint32_t word = 0;
+        for(uint32_t i = 0; i < 32; i += 4) {
+            uint32_t pixels;
+            memcpy(&pixels, line + x + i, sizeof(pixels));
+            word |= pack_gather4(pixels) << i;
+        }
+        memcpy(out + x / 8, &word, sizeof(word));
+    }
+}
+
+#if IMAGE_PACK_X86
+
+// movemask collects the top bit of every byte, pixel 0 in bit 0, which is
+// already XBM order; only the polarity needs flipping
+__attribute__((target("sse2"))) void image_pack_row_sse2(const uint8_t* line, uint8_t* out) {
+    for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x += 16) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(line + x));
+        uint16_t bits = ~_mm_movemask_epi8(pixels);
+        memcpy(out + x / 8, &bits, sizeof(bits));
+    }
+}
+
+__attribute__((target("avx2"))) void image_pack_row_avx2(const uint8_t* line, uint8_t* out) {
+    for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x += 32) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i*)(line + x));
+        uint32_t bits = ~(uint32_t)_mm256_movemask_epi8(pixels);
+        memcpy(out + x / 8, &bits, sizeof(bits));
+    }
+}
+
+static void pack_row_resolve(const uint8_t* line, uint8_t* out);
+
+static ImagePackRowFn pack_row_impl = pack_row_resolve;
+
+static void pack_row_resolve(const uint8_t* line, uint8_t* out) {
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        pack_row_impl = image_pack_row_avx2;
+    } else if(__builtin_cpu_supports("sse2")) {
+        pack_row_impl = image_pack_row_sse2;
+    } else {
+        pack_row_impl = image_pack_row_swar;
+    }
+    pack_row_impl(line, out);
+}
+
+void image_pack_row(const uint8_t* line, uint8_t* out) {
+    pack_row_impl(line, out);
+}
+
+#else
+
+void image_pack_row(const uint8_t* line, uint8_t* out) {
+    image_pack_row_swar(line, out);
+}
+
+#endif
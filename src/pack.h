@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include "convert.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IMAGE_PACK_X86 1
+#else
+#define IMAGE_PACK_X86 0
+#endif
+
+// Pack one dithered 128 sample row (0/255) into 16 bytes of 1-bit output in
+// XBM order, the layout canvas_draw_xbm takes and canvas_draw_bitmap decodes
+// to: pixel x is bit (x % 8) of byte x / 8, and a set bit is a dark pixel.
+// Whole bytes are stored, so the row needs no clearing beforehand.
+typedef void (*ImagePackRowFn)(const uint8_t* line, uint8_t* out);
+
+// Fastest variant for this CPU; on x86 hosts picked once at first use
+void image_pack_row(const uint8_t* line, uint8_t* out);
+
+// Individual variants, exposed for the host benchmark
+void image_pack_row_bytewise(const uint8_t* line, uint8_t* out);
+void image_pack_row_swar(const uint8_t* line, uint8_t* out);
+#if IMAGE_PACK_X86
+void image_pack_row_sse2(const uint8_t* line, uint8_t* out);
+void image_pack_row_avx2(const uint8_t* line, uint8_t* out);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
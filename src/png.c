@@ -0,0 +1,543 @@
+#include <furi.h>
+#include <storage/storage.h>
+#include "png.h"
+#include "inflate.h"
+#include "reader.h"
+#include "scaler.h"
+
+#define TAG "ImagePng"
+
+#define PNG_SIGNATURE_SIZE 8
+#define PNG_MAX_DIMENSION  16384
+
+// Free heap the decoder always leaves to the rest of the system
+#define PNG_HEAP_RESERVE (16 * 1024)
+
+#define PNG_CHUNK(a, b, c, d) \
+    (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+#define PNG_CHUNK_IHDR PNG_CHUNK('I', 'H', 'D', 'R')
+#define PNG_CHUNK_PLTE PNG_CHUNK('P', 'L', 'T', 'E')
+#define PNG_CHUNK_TRNS PNG_CHUNK('t', 'R', 'N', 'S')
+#define PNG_CHUNK_IDAT PNG_CHUNK('I', 'D', 'A', 'T')
+#define PNG_CHUNK_IEND PNG_CHUNK('I', 'E', 'N', 'D')
+
+typedef enum {
+    PngColorGray = 0,
+    PngColorRgb = 2,
+    PngColorPalette = 3,
+    PngColorGrayAlpha = 4,
+    PngColorRgba = 6,
+} PngColorType;
+
+typedef enum {
+    PngFilterNone = 0,
+    PngFilterSub = 1,
+    PngFilterUp = 2,
+    PngFilterAverage = 3,
+    PngFilterPaeth = 4,
+} PngFilter;
+
+typedef struct {
+    uint8_t x0;
+    uint8_t y0;
+    uint8_t dx;
+    uint8_t dy;
+    uint8_t lx; // Pixels decoded once the pass is done form a lattice with
+    uint8_t ly; // these column and row steps
+} PngPass;
+
+static const PngPass png_adam7_passes[7] = {
+    {0, 0, 8, 8, 8, 8},
+    {4, 0, 8, 8, 4, 8},
+    {0, 4, 4, 8, 4, 4},
+    {2, 0, 4, 4, 2, 4},
+    {0, 2, 2, 4, 2, 2},
+    {1, 0, 2, 2, 1, 2},
+    {0, 1, 1, 2, 1, 1},
+};
+
+static const PngPass png_single_pass = {0, 0, 1, 1, 1, 1};
+
+typedef struct {
+    ImageReader* reader;
+    uint32_t width;
+    uint32_t height;
+    uint8_t depth;
+    uint8_t color_type;
+    bool interlaced;
+    uint8_t bits_per_pixel;
+    uint8_t filter_stride; // Bytes between corresponding samples for filters
+
+    uint8_t palette[256]; // Palette as luma, transparency composited over white
+    uint8_t palette_alpha[256];
+    uint16_t palette_size;
+    uint16_t palette_alpha_size;
+
+    uint32_t chunk_left; // IDAT bytes not yet handed to inflate
+    bool idat_done;
+    ImageInflate* inflate;
+
+    uint8_t* prev; // Previous scanline, reused as the luma row after unfiltering
+    uint8_t* cur;
+    uint8_t* grid; // 128x64 point samples, interlaced images only
+
+    ImageScaler* scaler;
+} PngDecoder;
+
+static size_t png_peak_heap = 0;
+
+size_t image_png_get_peak_heap(void) {
+    return __atomic_load_n(&png_peak_heap, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t png_u32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static size_t png_idat_read(uint8_t* buffer, size_t size, void* context) {
+    PngDecoder* png = context;
+
+    // Consecutive IDAT chunks form one zlib stream; step over the CRCs between them
+    while(png->chunk_left == 0) {
+        if(png->idat_done) return 0;
+
+        uint8_t header[12];
+        if(image_reader_read(png->reader, header, sizeof(header)) != sizeof(header) ||
+           png_u32(header + 8) != PNG_CHUNK_IDAT) {
+            png->idat_done = true;
+            return 0;
+        }
+        png->chunk_left = png_u32(header + 4);
+    }
+
+    size_t read = image_reader_read(png->reader, buffer, MIN(size, png->chunk_left));
+    png->chunk_left -= read;
+    if(read == 0) png->idat_done = true;
+    return read;
+}
+
+static ImageConverterResult png_read_ihdr(PngDecoder* png, uint32_t length) {
+    uint8_t ihdr[13];
+    if(length != sizeof(ihdr)) return ImageConverterError;
+    if(image_reader_read(png->reader, ihdr, sizeof(ihdr)) != sizeof(ihdr)) {
+        return ImageConverterError;
+    }
+
+    png->width = png_u32(ihdr);
+    png->height = png_u32(ihdr + 4);
+    png->depth = ihdr[8];
+    png->color_type = ihdr[9];
+    png->interlaced = ihdr[12] == 1;
+
+    if(png->width == 0 || png->height == 0) return ImageConverterError;
+    if(png->width > PNG_MAX_DIMENSION || png->height > PNG_MAX_DIMENSION) {
+        return ImageConverterUnsupported;
+    }
+    if(ihdr[10] != 0 || ihdr[11] != 0 || ihdr[12] > 1) return ImageConverterUnsupported;
+
+    uint8_t channels;
+    switch(png->color_type) {
+    case PngColorGray:
+        channels = 1;
+        if(png->depth != 1 && png->depth != 2 && png->depth != 4 && png->depth != 8 &&
+           png->depth != 16) {
+            return ImageConverterError;
+        }
+        break;
+    case PngColorPalette:
+        channels = 1;
+        if(png->depth != 1 && png->depth != 2 && png->depth != 4 && png->depth != 8) {
+            return ImageConverterError;
+        }
+        break;
+    case PngColorGrayAlpha:
+        channels = 2;
+        break;
+    case PngColorRgb:
+        channels = 3;
+        break;
+    case PngColorRgba:
+        channels = 4;
+        break;
+    default:
+        return ImageConverterError;
+    }
+    if(channels > 1 && png->depth != 8 && png->depth != 16) return ImageConverterError;
+
+    png->bits_per_pixel = channels * png->depth;
+    png->filter_stride = MAX(png->bits_per_pixel / 8, 1);
+    return ImageConverterOK;
+}
+
+// PLTE and tRNS entries, up to 256 of them, converted as they are read
+static bool png_read_table(PngDecoder* png, uint32_t length, uint8_t entry_size, uint8_t* out) {
+    uint32_t entries = MIN(length / entry_size, 256U);
+    uint8_t entry[3];
+
+    for(uint32_t i = 0; i < entries; i++) {
+        if(image_reader_read(png->reader, entry, entry_size) != entry_size) return false;
+        out[i] = (entry_size == 3) ? image_luma(entry[0], entry[1], entry[2]) : entry[0];
+    }
+
+    return image_reader_skip(png->reader, length - entries * entry_size);
+}
+
+static ImageConverterResult png_read_chunks(PngDecoder* png) {
+    uint8_t header[8];
+    bool have_ihdr = false;
+
+    if(image_reader_read(png->reader, header, PNG_SIGNATURE_SIZE) != PNG_SIGNATURE_SIZE) {
+        return ImageConverterError;
+    }
+
+    // Walk chunks up to the first IDAT, leaving the file at its data
+    while(true) {
+        if(image_reader_read(png->reader, header, sizeof(header)) != sizeof(header)) {
+            return ImageConverterError;
+        }
+        uint32_t length = png_u32(header);
+        uint32_t type = png_u32(header + 4);
+
+        if(type == PNG_CHUNK_IDAT) {
+            if(!have_ihdr) return ImageConverterError;
+            png->chunk_left = length;
+            return ImageConverterOK;
+        }
+
+        if(type == PNG_CHUNK_IHDR) {
+            ImageConverterResult result = png_read_ihdr(png, length);
+            if(result != ImageConverterOK) return result;
+            have_ihdr = true;
+        } else if(type == PNG_CHUNK_PLTE) {
+            if(!png_read_table(png, length, 3, png->palette)) return ImageConverterError;
+            png->palette_size = MIN(length / 3, 256U);
+        } else if(type == PNG_CHUNK_TRNS && png->color_type == PngColorPalette) {
+            if(!png_read_table(png, length, 1, png->palette_alpha)) return ImageConverterError;
+            png->palette_alpha_size = MIN(length, 256U);
+        } else if(type == PNG_CHUNK_IEND) {
+            return ImageConverterError;
+        } else if(!image_reader_skip(png->reader, length)) {
+            return ImageConverterError;
+        }
+
+        // CRC
+        if(!image_reader_skip(png->reader, 4)) return ImageConverterError;
+    }
+}
+
+static inline uint8_t png_paeth(uint8_t a, uint8_t b, uint8_t c) {
+    int16_t p = a + b - c;
+    int16_t pa = p > a ? p - a : a - p;
+    int16_t pb = p > b ? p - b : b - p;
+    int16_t pc = p > c ? p - c : c - p;
+    if(pa <= pb && pa <= pc) return a;
+    if(pb <= pc) return b;
+    return c;
+}
+
+static bool png_unfilter(PngDecoder* png, uint8_t filter, size_t size) {
+    uint8_t* cur = png->cur;
+    const uint8_t* prev = png->prev;
+    size_t stride = png->filter_stride;
+
+    switch(filter) {
+    case PngFilterNone:
+        break;
+    case PngFilterSub:
+        for(size_t i = stride; i < size; i++) {
+            cur[i] += cur[i - stride];
+        }
+        break;
+    case PngFilterUp:
+        for(size_t i = 0; i < size; i++) {
+            cur[i] += prev[i];
+        }
+        break;
+    case PngFilterAverage:
+        for(size_t i = 0; i < stride; i++) {
+            cur[i] += prev[i] >> 1;
+        }
+        for(size_t i = stride; i < size; i++) {
+            cur[i] += (cur[i - stride] + prev[i]) >> 1;
+        }
+        break;
+    case PngFilterPaeth:
+        for(size_t i = 0; i < stride; i++) {
+            cur[i] += prev[i];
+        }
+        for(size_t i = stride; i < size; i++) {
+            cur[i] += png_paeth(cur[i - stride], prev[i], prev[i - stride]);
+        }
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+// Layout the scaler takes unfiltered scanlines in as they are; false for
+// the bit depths png_to_luma has to unpack first
+static bool png_pixel_format(const PngDecoder* png, ImagePixelFormat* format) {
+    if(png->depth != 8) return false;
+    switch(png->color_type) {
+    case PngColorGray:
+        *format = ImagePixelGray;
+        return true;
+    case PngColorPalette:
+        *format = ImagePixelIndexed;
+        return true;
+    case PngColorGrayAlpha:
+        *format = ImagePixelGrayAlpha;
+        return true;
+    case PngColorRgb:
+        *format = ImagePixelRgb;
+        return true;
+    case PngColorRgba:
+        *format = ImagePixelRgba;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Convert an unfiltered scanline of `count` pixels to luma
+static void png_to_luma(PngDecoder* png, const uint8_t* data, uint8_t* luma, uint32_t count) {
+    // 16-bit samples only keep their high byte
+    uint8_t step = png->depth == 16 ? 2 : 1;
+
+    switch(png->color_type) {
+    case PngColorGray:
+    case PngColorPalette:
+        if(png->depth < 8) {
+            uint8_t depth = png->depth;
+            uint8_t mask = (1 << depth) - 1;
+            uint8_t scale = (png->color_type == PngColorGray) ? 255 / mask : 0;
+            for(uint32_t x = 0; x < count; x++) {
+                uint32_t bit = x * depth;
+                uint8_t value = (data[bit >> 3] >> (8 - depth - (bit & 7))) & mask;
+                luma[x] = scale ? value * scale : png->palette[value];
+            }
+        } else if(png->color_type == PngColorPalette) {
+            for(uint32_t x = 0; x < count; x++) {
+                luma[x] = png->palette[data[x]];
+            }
+        } else {
+            for(uint32_t x = 0; x < count; x++) {
+                luma[x] = data[x * step];
+            }
+        }
+        break;
+    case PngColorGrayAlpha:
+        for(uint32_t x = 0; x < count; x++) {
+            const uint8_t* p = data + x * 2 * step;
+            luma[x] = image_luma_over_white(p[0], p[step]);
+        }
+        break;
+    case PngColorRgb:
+        for(uint32_t x = 0; x < count; x++) {
+            const uint8_t* p = data + x * 3 * step;
+            luma[x] = image_luma(p[0], p[step], p[2 * step]);
+        }
+        break;
+    case PngColorRgba:
+        for(uint32_t x = 0; x < count; x++) {
+            const uint8_t* p = data + x * 4 * step;
+            luma[x] = image_luma_over_white(image_luma(p[0], p[step], p[2 * step]), p[3 * step]);
+        }
+        break;
+    }
+}
+
+// Point-sample one row of an Adam7 pass into the output grid at the top-left
+// corner of each output cell; passes arrive out of row order, so they cannot
+// be box filtered as they stream. Until the pixel at a corner comes in, the
+// cell takes the nearest one up and left of it on the lattice decoded so far,
+// so after every pass the grid is a whole, if coarser, picture.
+static void png_sample_pass_row(
+    PngDecoder* png,
+    const PngPass* pass,
+    uint32_t src_y,
+    const uint8_t* luma) {
+    for(uint32_t y = 0; y < IMAGE_OUT_HEIGHT; y++) {
+        if((png->scaler->row_start[y] & ~(pass->ly - 1U)) != src_y) continue;
+        uint8_t* out = png->grid + y * IMAGE_OUT_WIDTH;
+        for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+            uint32_t src_x = png->scaler->col_start[x] & ~(pass->lx - 1U);
+            if(src_x < pass->x0 || (src_x - pass->x0) % pass->dx) continue;
+            out[x] = luma[(src_x - pass->x0) / pass->dx];
+        }
+    }
+}
+
+// True if png_sample_pass_row takes anything from row src_y of the pass
+static bool png_pass_wants_row(const PngDecoder* png, const PngPass* pass, uint32_t src_y) {
+    for(uint32_t y = 0; y < IMAGE_OUT_HEIGHT; y++) {
+        if((png->scaler->row_start[y] & ~(pass->ly - 1U)) == src_y) return true;
+    }
+    return false;
+}
+
+static ImageConverterResult png_decode_pass(PngDecoder* png, const PngPass* pass) {
+    if(pass->x0 >= png->width || pass->y0 >= png->height) return ImageConverterOK;
+
+    uint32_t pass_width = (png->width - pass->x0 + pass->dx - 1) / pass->dx;
+    size_t row_bytes = ((size_t)pass_width * png->bits_per_pixel + 7) / 8;
+
+    // Filters treat the row above the first one of each pass as zeros
+    memset(png->prev, 0, row_bytes);
+
+    // Interlaced passes are point sampled from luma; otherwise 8-bit
+    // scanlines go to the scaler untouched
+    ImagePixelFormat format = ImagePixelGray;
+    bool native = !png->grid && png_pixel_format(png, &format);
+
+    // Auto levels count a few rows spread over the image, or all of the
+    // first Adam7 pass, which is itself spread over the image
+    bool sample_pass = png->scaler->levels && pass == &png_adam7_passes[0];
+
+    for(uint32_t y = pass->y0; y < png->height; y += pass->dy) {
+        uint8_t filter;
+        if(image_inflate_read(png->inflate, &filter, 1) != 1 ||
+           image_inflate_read(png->inflate, png->cur, row_bytes) != row_bytes) {
+            return ImageConverterError;
+        }
+        if(!png_unfilter(png, filter, row_bytes)) return ImageConverterError;
+
+        // The old previous row is dead now, so it doubles as the luma row
+        bool sampled = png->grid ? sample_pass : image_scaler_samples_row(png->scaler, y);
+        if(native) {
+            image_scaler_push_pixels(png->scaler, y, png->cur, format);
+            if(sampled) image_scaler_sample_row(png->scaler, png->cur, pass_width, format);
+        } else {
+            bool wanted = png->grid ? png_pass_wants_row(png, pass, y) :
+                                      image_scaler_wants_row(png->scaler, y);
+            if(wanted || sampled) png_to_luma(png, png->cur, png->prev, pass_width);
+            if(sampled) {
+                image_scaler_sample_row(png->scaler, png->prev, pass_width, ImagePixelGray);
+            }
+            if(wanted && png->grid) {
+                png_sample_pass_row(png, pass, y, png->prev);
+            } else if(wanted) {
+                image_scaler_push_row(png->scaler, y, png->prev);
+            }
+        }
+
+        uint8_t* swap = png->prev;
+        png->prev = png->cur;
+        png->cur = swap;
+    }
+
+    return ImageConverterOK;
+}
+
+static ImageConverterResult png_decode_image(PngDecoder* png) {
+    // zlib header: deflate only, no preset dictionary, window from CINFO
+    uint8_t zlib[2];
+    if(png_idat_read(zlib, 1, png) != 1 || png_idat_read(zlib + 1, 1, png) != 1) {
+        return ImageConverterError;
+    }
+    if((zlib[0] & 0x0F) != 8 || (zlib[1] & 0x20) || ((zlib[0] << 8) | zlib[1]) % 31) {
+        return ImageConverterError;
+    }
+    uint8_t window_bits = (zlib[0] >> 4) + 8;
+    if(window_bits > 15) return ImageConverterError;
+
+    // Budget everything up front so a huge image fails cleanly instead of
+    // exhausting the heap halfway through
+    size_t row_bytes = ((size_t)png->width * png->bits_per_pixel + 7) / 8;
+    size_t line_bytes = MAX(row_bytes, (size_t)png->width);
+    // Interlaced images are point sampled into a 128x64 grid; for the others
+    // the scaler holds back as many bytes of rows until auto levels are known
+    size_t grid_bytes =
+        png->interlaced || png->scaler->levels ? IMAGE_OUT_WIDTH * IMAGE_OUT_HEIGHT : 0;
+    size_t inflate_bytes = image_inflate_get_memory_size(window_bits);
+    size_t total = sizeof(PngDecoder) + inflate_bytes + line_bytes * 2 + grid_bytes;
+    size_t free_heap = memmgr_get_free_heap();
+    FURI_LOG_I(
+        TAG,
+        "%lux%lu window %u B, inflate %u B, lines 2x%u B, total %u B of %u B free",
+        (unsigned long)png->width,
+        (unsigned long)png->height,
+        1U << window_bits,
+        (unsigned)inflate_bytes,
+        (unsigned)line_bytes,
+        (unsigned)total,
+        (unsigned)free_heap);
+    if(total + PNG_HEAP_RESERVE > free_heap) return ImageConverterUnsupported;
+
+    png->inflate = image_inflate_alloc(window_bits, png_idat_read, png);
+    png->prev = malloc(line_bytes);
+    png->cur = malloc(line_bytes);
+    if(png->interlaced) png->grid = malloc(grid_bytes);
+    if(!png->inflate || !png->prev || !png->cur || (png->interlaced && !png->grid)) {
+        return ImageConverterError;
+    }
+    // Atomic so the host batch converter can decode on several threads
+    __atomic_store_n(&png_peak_heap, total, __ATOMIC_RELAXED);
+
+    if(png->grid) memset(png->grid, 0xFF, grid_bytes);
+
+    ImageConverterResult result = ImageConverterOK;
+    if(png->interlaced) {
+        for(size_t i = 0; i < COUNT_OF(png_adam7_passes) && result == ImageConverterOK; i++) {
+            result = png_decode_pass(png, &png_adam7_passes[i]);
+            if(i == 0) image_scaler_apply_levels(png->scaler);
+            // Passes 1, 3 and 5 complete square lattices, 8, 4 and 2 pixels
+            // apart, each a sharper preview than the last
+            if(i % 2 == 0 && i + 1 < COUNT_OF(png_adam7_passes) && result == ImageConverterOK) {
+                image_scaler_preview(png->scaler, png->grid);
+            }
+        }
+        if(result == ImageConverterOK) {
+            for(uint32_t y = 0; y < IMAGE_OUT_HEIGHT; y++) {
+                image_scaler_emit_row(png->scaler, y, png->grid + y * IMAGE_OUT_WIDTH);
+            }
+        }
+    } else {
+        result = png_decode_pass(png, &png_single_pass);
+    }
+
+    return result;
+}
+
+ImageConverterResult image_png_decode(ImageReader* reader, ImageScaler* scaler) {
+    PngDecoder* png = malloc(sizeof(PngDecoder));
+    if(!png) return ImageConverterError;
+    memset(png, 0, sizeof(PngDecoder));
+    png->reader = reader;
+    png->scaler = scaler;
+    memset(png->palette_alpha, 0xFF, sizeof(png->palette_alpha));
+
+    ImageConverterResult result = png_read_chunks(png);
+    if(result == ImageConverterOK) {
+        if(png->color_type == PngColorPalette) {
+            if(!png->palette_size) {
+                result = ImageConverterError;
+            } else {
+                for(uint16_t i = 0; i < png->palette_alpha_size; i++) {
+                    png->palette[i] =
+                        image_luma_over_white(png->palette[i], png->palette_alpha[i]);
+                }
+                image_scaler_set_palette(png->scaler, png->palette);
+            }
+        }
+    }
+
+    if(result == ImageConverterOK) {
+        image_scaler_init(png->scaler, png->width, png->height);
+        result = png_decode_image(png);
+    }
+
+    if(result != ImageConverterOK) {
+        FURI_LOG_E(TAG, "Decode failed: %d", result);
+    }
+
+    if(png->inflate) image_inflate_free(png->inflate);
+    free(png->prev);
+    free(png->cur);
+    free(png->grid);
+    free(png);
+    return result;
+}
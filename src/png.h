@@ -0,0 +1,24 @@
+#pragma once
+
+#include <storage/storage.h>
+#include "convert.h"
+#include "reader.h"
+#include "scaler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Decode a PNG (grayscale, palette, RGB, with or without alpha, 1-16 bit,
+// Adam7 or progressive scan order) from the start of a file into the
+// scaler. IDAT data is inflated and unfiltered one scanline at
+// a time; only the previous and current scanline are kept.
+ImageConverterResult image_png_decode(ImageReader* reader, ImageScaler* scaler);
+
+// Heap bytes the last PNG decode held at its peak (decoder, inflate window
+// and scanlines), for profiling on device
+size_t image_png_get_peak_heap(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,238 @@
+#include <furi.h>
+#include <furi_hal.h>
+#include "reader.h"
+
+#define READER_THREAD_STACK 1024
+
+struct ImageReaderPrefetch {
+    FuriThread* thread;
+    FuriSemaphore* request; // Given by the decoder to start a read
+    FuriSemaphore* done; // Given by the helper once the read is back
+    uint8_t* block;
+    size_t size; // Bytes asked for
+    size_t len; // Bytes read
+    bool busy; // A read was started and its block not taken yet
+    bool stop;
+};
+
+// Bytes to read from `offset` so the read ends on a block boundary
+static inline size_t reader_block_end(uint32_t offset) {
+    return IMAGE_READER_BLOCK_SIZE - offset % IMAGE_READER_BLOCK_SIZE;
+}
+
+// Bytes to read from `offset` into `room` bytes: up to the block boundary
+// if that fits, no further than the limit, and never less than `need`
+static size_t
+    reader_read_size(const ImageReader* reader, uint32_t offset, size_t room, size_t need) {
+    size_t size = MIN(reader_block_end(offset), room);
+    if(reader->limit > offset) size = MIN(size, reader->limit - offset);
+    return MAX(size, need);
+}
+
+static inline uint32_t reader_cycles(void) {
+    return furi_hal_cortex_timer_get(0).start;
+}
+
+static void reader_count(ImageReader* reader, size_t bytes, uint32_t start) {
+    ImageReaderStats* stats = reader->stats;
+    if(!stats) return;
+    stats->cycles += reader_cycles() - start;
+    stats->bytes += bytes;
+    stats->calls++;
+}
+
+// Storage reads and seeks on the decoding thread, timed and counted
+static size_t reader_file_read(ImageReader* reader, void* data, size_t size) {
+    uint32_t start = reader_cycles();
+    size_t read = storage_file_read(reader->file, data, size);
+    reader_count(reader, read, start);
+    return read;
+}
+
+static bool reader_file_seek(ImageReader* reader, uint32_t offset) {
+    uint32_t start = reader_cycles();
+    bool ok = storage_file_seek(reader->file, offset, true);
+    reader_count(reader, 0, start);
+    return ok;
+}
+
+static int32_t reader_prefetch_thread(void* context) {
+    ImageReader* reader = context;
+    ImageReaderPrefetch* prefetch = reader->prefetch;
+    while(true) {
+        furi_semaphore_acquire(prefetch->request, FuriWaitForever);
+        if(prefetch->stop) break;
+        prefetch->len = storage_file_read(reader->file, prefetch->block, prefetch->size);
+        furi_semaphore_release(prefetch->done);
+    }
+    return 0;
+}
+
+// Read the block after the buffered data on the helper. The file is the
+// helper's until the read is waited for.
+static void reader_prefetch_start(ImageReader* reader) {
+    ImageReaderPrefetch* prefetch = reader->prefetch;
+    prefetch->size = reader_block_end(reader->offset + reader->len);
+    prefetch->busy = true;
+    furi_semaphore_release(prefetch->request);
+}
+
+// Only the time spent waiting counts as reading; the rest overlapped decoding
+static void reader_prefetch_wait(ImageReader* reader) {
+    ImageReaderPrefetch* prefetch = reader->prefetch;
+    uint32_t start = reader_cycles();
+    furi_semaphore_acquire(prefetch->done, FuriWaitForever);
+    reader_count(reader, prefetch->len, start);
+    prefetch->busy = false;
+}
+
+// Make the block read ahead the current one and start on the next
+static void reader_prefetch_take(ImageReader* reader, size_t pos) {
+    ImageReaderPrefetch* prefetch = reader->prefetch;
+    uint8_t* block = reader->data;
+    reader->offset += reader->len;
+    reader->data = prefetch->block;
+    reader->len = prefetch->len;
+    reader->pos = pos;
+    prefetch->block = block;
+    // A short read was the end of the file
+    if(reader->len == prefetch->size) reader_prefetch_start(reader);
+}
+
+ImageReader* image_reader_alloc(File* file, ImageReaderStats* stats) {
+    ImageReader* reader = malloc(sizeof(ImageReader));
+    memset(reader, 0, sizeof(ImageReader));
+    reader->file = file;
+    reader->stats = stats;
+    reader->limit = UINT32_MAX;
+#ifdef HOST_STORAGE_ZERO_COPY
+    // Host tools decode straight out of the input's mapping, the whole file
+    // being a single block
+    size_t size;
+    const uint8_t* map = host_storage_file_peek(file, &size);
+    if(map && size <= UINT32_MAX) {
+        reader->data = (uint8_t*)map;
+        reader->len = size;
+        reader->mapped = true;
+        return reader;
+    }
+#endif
+    reader->data = malloc(IMAGE_READER_BLOCK_SIZE);
+    return reader;
+}
+
+void image_reader_free(ImageReader* reader) {
+    ImageReaderPrefetch* prefetch = reader->prefetch;
+    if(prefetch) {
+        if(prefetch->busy) reader_prefetch_wait(reader);
+        prefetch->stop = true;
+        furi_semaphore_release(prefetch->request);
+        furi_thread_join(prefetch->thread);
+        furi_thread_free(prefetch->thread);
+        furi_semaphore_free(prefetch->request);
+        furi_semaphore_free(prefetch->done);
+        free(prefetch->block);
+        free(prefetch);
+    }
+    if(!reader->mapped) free(reader->data);
+    free(reader);
+}
+
+void image_reader_set_double_buffered(ImageReader* reader) {
+    if(reader->prefetch || reader->mapped) return;
+    ImageReaderPrefetch* prefetch = malloc(sizeof(ImageReaderPrefetch));
+    memset(prefetch, 0, sizeof(ImageReaderPrefetch));
+    prefetch->block = malloc(IMAGE_READER_BLOCK_SIZE);
+    prefetch->request = furi_semaphore_alloc(1, 0);
+    prefetch->done = furi_semaphore_alloc(1, 0);
+    prefetch->thread =
+        furi_thread_alloc_ex("ImageReader", READER_THREAD_STACK, reader_prefetch_thread, reader);
+    reader->prefetch = prefetch;
+    furi_thread_start(prefetch->thread);
+
+    // Buffered data ending on a block boundary is likely followed by more
+    uint32_t end = reader->offset + reader->len;
+    if(reader->len && end % IMAGE_READER_BLOCK_SIZE == 0) reader_prefetch_start(reader);
+}
+
+bool image_reader_fill(ImageReader* reader) {
+    if(reader->mapped) return false;
+    ImageReaderPrefetch* prefetch = reader->prefetch;
+    if(prefetch && prefetch->busy) {
+        reader_prefetch_wait(reader);
+        reader_prefetch_take(reader, 0);
+    } else {
+        reader->offset += reader->len;
+        reader->pos = 0;
+        size_t size =
+            reader_read_size(reader, reader->offset, IMAGE_READER_BLOCK_SIZE, 1);
+        reader->len = reader_file_read(reader, reader->data, size);
+        if(prefetch && reader->len == size) reader_prefetch_start(reader);
+    }
+    return reader->len > 0;
+}
+
+size_t image_reader_read(ImageReader* reader, void* data, size_t size) {
+    uint8_t* out = data;
+    size_t done = 0;
+    while(done < size) {
+        if(reader->pos == reader->len && !image_reader_fill(reader)) break;
+        size_t count = MIN(size - done, reader->len - reader->pos);
+        memcpy(out + done, reader->data + reader->pos, count);
+        reader->pos += count;
+        done += count;
+    }
+    return done;
+}
+
+const uint8_t* image_reader_peek(ImageReader* reader, size_t size) {
+    furi_assert(!reader->prefetch && size <= IMAGE_READER_BLOCK_SIZE);
+    size_t left = reader->len - reader->pos;
+    if(left < size) {
+        if(reader->mapped) return NULL;
+        // Move what is left to the front and top the block up behind it
+        memmove(reader->data, reader->data + reader->pos, left);
+        reader->offset += reader->pos;
+        reader->pos = 0;
+        size_t count = reader_read_size(
+            reader, reader->offset + left, IMAGE_READER_BLOCK_SIZE - left, size - left);
+        reader->len = left + reader_file_read(reader, reader->data + left, count);
+        if(reader->len < size) return NULL;
+    }
+    return reader->data + reader->pos;
+}
+
+bool image_reader_skip(ImageReader* reader, uint32_t size) {
+    if(size <= reader->len - reader->pos) {
+        reader->pos += size;
+        return true;
+    }
+    return image_reader_seek(reader, image_reader_tell(reader) + size);
+}
+
+bool image_reader_seek(ImageReader* reader, uint32_t offset) {
+    if(offset >= reader->offset && offset - reader->offset <= reader->len) {
+        reader->pos = offset - reader->offset;
+        return true;
+    }
+    if(reader->mapped) {
+        // Past the end; like the card, stop there
+        reader->pos = reader->len;
+        return false;
+    }
+
+    ImageReaderPrefetch* prefetch = reader->prefetch;
+    if(prefetch && prefetch->busy) {
+        reader_prefetch_wait(reader);
+        uint32_t next = reader->offset + reader->len;
+        if(offset >= next && offset - next <= prefetch->len) {
+            reader_prefetch_take(reader, offset - next);
+            return true;
+        }
+    }
+
+    reader->offset = offset;
+    reader->pos = 0;
+    reader->len = 0;
+    return reader_file_seek(reader, offset);
+}
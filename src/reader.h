@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <storage/storage.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Reads are issued in blocks that end on a multiple of this, so every call
+// after the first moves whole SD sectors
+#define IMAGE_READER_BLOCK_SIZE 1024
+
+// Buffered input shared by the decoders. Header fields, entropy coded bytes
+// and short skips are served from a block held in RAM, so a decoder makes one
+// storage call per kilobyte instead of one per field or per small buffer.
+// Once double buffering is on, a helper thread reads the next block while
+// the decoder works through the current one, keeping the card busy during
+// decoding; seeks wait for that read and skip into it when they can.
+typedef struct ImageReaderPrefetch ImageReaderPrefetch;
+
+// Storage traffic of a reader, for the conversion stats. Only the time the
+// decoder spent in storage calls or waiting for a block read ahead counts.
+typedef struct {
+    uint32_t cycles;
+    uint32_t bytes;
+    uint32_t calls; // Reads and seeks
+} ImageReaderStats;
+
+typedef struct {
+    File* file;
+    uint8_t* data; // Block being consumed
+    size_t pos;
+    size_t len;
+    uint32_t offset; // File offset of data[0]
+    uint32_t limit; // Reads stop here unless more is asked for
+    ImageReaderPrefetch* prefetch; // NULL while single buffered
+    ImageReaderStats* stats; // NULL unless counted
+    bool mapped; // data is the whole file, mapped by the host storage shim
+} ImageReader;
+
+// Wrap a file opened for reading, positioned at its start. Traffic is added
+// to `stats`, which may be NULL, until the reader is freed.
+ImageReader* image_reader_alloc(File* file, ImageReaderStats* stats);
+void image_reader_free(ImageReader* reader);
+
+// Read ahead on a helper thread from now on. Worth it for decoders that
+// stream most of the file front to back; peeking is not available after.
+void image_reader_set_double_buffered(ImageReader* reader);
+
+// Data from `offset` on will not be needed before the next seek, so reads
+// stop short of it. For decoders that jump over large parts of the file;
+// UINT32_MAX (the default) lets every read run to the end of its block.
+static inline void image_reader_set_limit(ImageReader* reader, uint32_t offset) {
+    reader->limit = offset;
+}
+
+// Load the block after the current one; false at the end of the file
+bool image_reader_fill(ImageReader* reader);
+
+// Next byte, or -1 at the end of the file
+static inline int32_t image_reader_byte(ImageReader* reader) {
+    if(reader->pos == reader->len && !image_reader_fill(reader)) return -1;
+    return reader->data[reader->pos++];
+}
+
+// Copy up to `size` bytes out; short only at the end of the file
+size_t image_reader_read(ImageReader* reader, void* data, size_t size);
+
+// The next `size` bytes (at most a block) in one piece without consuming
+// them, or NULL if the file ends first. Single buffered readers only.
+const uint8_t* image_reader_peek(ImageReader* reader, size_t size);
+
+// Move forward or to an absolute offset. Targets inside the buffered data
+// cost no storage call.
+bool image_reader_skip(ImageReader* reader, uint32_t size);
+bool image_reader_seek(ImageReader* reader, uint32_t offset);
+
+static inline uint32_t image_reader_tell(const ImageReader* reader) {
+    return reader->offset + reader->pos;
+}
+
+#ifdef __cplusplus
+}
+#endif
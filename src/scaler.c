@@ -0,0 +1,495 @@
+#include <furi.h>
+#include <furi_hal.h>
+#include <string.h>
+#include "scaler.h"
+#include "pack.h"
+
+// Split `total` source pixels into `scaled` spans with Bresenham stepping and
+// keep `count` of them from `first` on: one division up front, then a
+// remainder carried from step to step. start[i] ends up as
+// floor((first + i) * total / scaled).
+static void scaler_step_edges(
+    uint16_t* start,
+    uint32_t count,
+    uint32_t total,
+    uint32_t scaled,
+    uint32_t first) {
+    uint32_t step = total / scaled;
+    uint32_t rem = total % scaled;
+    uint32_t pos = (uint64_t)first * total / scaled;
+    uint32_t err = (uint64_t)first * total % scaled;
+
+    for(uint32_t i = 0; i <= count; i++) {
+        start[i] = pos;
+        pos += step;
+        err += rem;
+        if(err >= scaled) {
+            err -= scaled;
+            pos++;
+        }
+    }
+}
+
+void image_scaler_setup(ImageScaler* scaler, uint8_t* bitmap, ImageDitherMode dither_mode) {
+    scaler->bitmap = bitmap;
+    scaler->palette = NULL;
+    scaler->levels = NULL;
+    scaler->held = NULL;
+    scaler->held_rows = 0;
+    scaler->progress = NULL;
+    scaler->dither.mode = dither_mode;
+    scaler->dither.cycles = 0;
+    scaler->cycles = 0;
+    image_scaler_set_tile(scaler, 0, 0, 0);
+}
+
+void image_scaler_set_tile(ImageScaler* scaler, uint8_t zoom, uint32_t tile_x, uint32_t tile_y) {
+    scaler->out_width = IMAGE_OUT_WIDTH << zoom;
+    scaler->out_height = IMAGE_OUT_HEIGHT << zoom;
+    scaler->window_x = tile_x * IMAGE_OUT_WIDTH;
+    scaler->window_y = tile_y * IMAGE_OUT_HEIGHT;
+}
+
+void image_scaler_init(ImageScaler* scaler, uint32_t src_width, uint32_t src_height) {
+    memset(scaler->acc, 0, sizeof(scaler->acc));
+    image_dither_init(&scaler->dither, scaler->dither.mode);
+
+    scaler->src_width = src_width;
+    scaler->src_height = src_height;
+    scaler->band = -1;
+    scaler->band_rows = 0;
+    scaler->done_rows = 0;
+    scaler->shown_rows = 0;
+    scaler->sketched = false;
+    if(scaler->levels) image_levels_reset(scaler->levels, src_width, src_height);
+
+    scaler_step_edges(
+        scaler->col_start, IMAGE_OUT_WIDTH, src_width, scaler->out_width, scaler->window_x);
+    scaler_step_edges(
+        scaler->row_start, IMAGE_OUT_HEIGHT, src_height, scaler->out_height, scaler->window_y);
+
+    scaler->col_shift = 0xFF;
+    for(uint8_t shift = 0; shift <= 3; shift++) {
+        if(src_width == scaler->out_width << shift) scaler->col_shift = shift;
+    }
+
+    for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+        uint32_t span = scaler->col_start[x + 1] - scaler->col_start[x];
+        scaler->col_recip[x] = span ? 65536 / span : 65536;
+    }
+}
+
+// Output row whose band holds src_y; only meaningful when downscaling rows
+static uint32_t scaler_band_of(const ImageScaler* scaler, uint32_t src_y) {
+    uint32_t lo = 0;
+    uint32_t hi = IMAGE_OUT_HEIGHT - 1;
+    while(lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if(scaler->row_start[mid] <= src_y) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+static uint32_t scaler_band_taps(const ImageScaler* scaler, uint32_t band) {
+    uint32_t span = scaler->row_start[band + 1] - scaler->row_start[band];
+    return span > IMAGE_SCALER_MAX_TAPS ? IMAGE_SCALER_MAX_TAPS : span;
+}
+
+bool image_scaler_wants_row(const ImageScaler* scaler, uint32_t src_y) {
+    if(src_y >= scaler->src_height || src_y < scaler->row_start[0]) return false;
+    if(scaler->src_height < scaler->out_height) {
+        return src_y <= scaler->row_start[IMAGE_OUT_HEIGHT - 1];
+    }
+    if(src_y >= scaler->row_start[IMAGE_OUT_HEIGHT]) return false;
+
+    uint32_t band = scaler_band_of(scaler, src_y);
+    uint32_t span = scaler->row_start[band + 1] - scaler->row_start[band];
+    if(span <= IMAGE_SCALER_MAX_TAPS) return true;
+
+    // Exactly MAX_TAPS offsets in [0, span) satisfy this, evenly spread and
+    // always including the first row of the band
+    uint32_t offset = src_y - scaler->row_start[band];
+    return (offset * IMAGE_SCALER_MAX_TAPS) % span < IMAGE_SCALER_MAX_TAPS;
+}
+
+static inline uint32_t scaler_cycles(void) {
+    return furi_hal_cortex_timer_get(0).start;
+}
+
+static inline uint32_t scaler_ms_to_cycles(uint32_t ms) {
+    return ms * 1000 * furi_hal_cortex_instructions_per_microsecond();
+}
+
+static void scaler_dither_row(ImageScaler* scaler, uint32_t out_y, uint8_t* line) {
+    if(scaler->levels) {
+        const uint8_t* lut = scaler->levels->lut;
+        for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+            line[x] = lut[line[x]];
+        }
+    }
+    image_dither_row(&scaler->dither, out_y, line);
+    image_pack_row(line, scaler->bitmap + out_y * (IMAGE_OUT_WIDTH / 8));
+}
+
+static void scaler_apply_levels(ImageScaler* scaler) {
+    image_levels_build(scaler->levels);
+    scaler->levels->ready = true;
+    if(scaler->held) {
+        for(uint32_t y = 0; y < IMAGE_OUT_HEIGHT; y++) {
+            if(!(scaler->held_rows >> y & 1)) continue;
+            scaler_dither_row(scaler, y, scaler->held + y * IMAGE_OUT_WIDTH);
+        }
+        scaler->done_rows |= scaler->held_rows;
+        free(scaler->held);
+        scaler->held = NULL;
+        scaler->held_rows = 0;
+    }
+}
+
+static void scaler_emit_row(ImageScaler* scaler, uint32_t out_y, uint8_t* line) {
+    if(scaler->levels && !scaler->levels->ready) {
+        if(!scaler->held) scaler->held = malloc(IMAGE_OUT_WIDTH * IMAGE_OUT_HEIGHT);
+        if(scaler->held) {
+            memcpy(scaler->held + out_y * IMAGE_OUT_WIDTH, line, IMAGE_OUT_WIDTH);
+            scaler->held_rows |= 1ULL << out_y;
+            return;
+        }
+        // No room to wait for the whole histogram: go with what was counted
+        scaler_apply_levels(scaler);
+    }
+    scaler_dither_row(scaler, out_y, line);
+    scaler->done_rows |= 1ULL << out_y;
+}
+
+// Start error diffusion over, keeping the time spent on it so far
+static void scaler_restart_dither(ImageScaler* scaler) {
+    uint32_t cycles = scaler->dither.cycles;
+    image_dither_init(&scaler->dither, scaler->dither.mode);
+    scaler->dither.cycles = cycles;
+}
+
+// Dither the rows of a luma frame picked by `rows` into the bitmap and blank
+// the others, through a table built from the samples so far if the levels
+// are not known yet. Diffusion starts over on both sides, so the image itself
+// comes out the same as without previews.
+static void scaler_draw_frame(ImageScaler* scaler, const uint8_t* frame, uint64_t rows) {
+    if(scaler->levels && !scaler->levels->ready) image_levels_build(scaler->levels);
+    scaler_restart_dither(scaler);
+    for(uint32_t y = 0; y < IMAGE_OUT_HEIGHT; y++) {
+        if(rows >> y & 1) {
+            memcpy(scaler->line, frame + y * IMAGE_OUT_WIDTH, IMAGE_OUT_WIDTH);
+            scaler_dither_row(scaler, y, scaler->line);
+        } else {
+            memset(scaler->bitmap + y * (IMAGE_OUT_WIDTH / 8), 0, IMAGE_OUT_WIDTH / 8);
+        }
+    }
+    scaler_restart_dither(scaler);
+}
+
+static void scaler_show(ImageScaler* scaler) {
+    scaler->shown_rows = scaler->held_rows | scaler->done_rows;
+    scaler->progress(scaler->progress_context);
+    scaler->progress_due = scaler_cycles() + scaler_ms_to_cycles(IMAGE_SCALER_REFINE_MS);
+}
+
+// Hand over a partial frame if one is due and rows came in since the last.
+// A finished frame is left to the converter.
+static void scaler_report_progress(ImageScaler* scaler) {
+    if(!scaler->progress || (int32_t)(scaler_cycles() - scaler->progress_due) < 0) return;
+    uint64_t rows = scaler->held_rows | scaler->done_rows;
+    if(rows == scaler->shown_rows || rows == UINT64_MAX) return;
+
+    if(scaler->held_rows) {
+        scaler_draw_frame(scaler, scaler->held, scaler->held_rows);
+    } else if(!scaler->sketched) {
+        for(uint32_t y = 0; y < IMAGE_OUT_HEIGHT; y++) {
+            if(scaler->done_rows >> y & 1) continue;
+            memset(scaler->bitmap + y * (IMAGE_OUT_WIDTH / 8), 0, IMAGE_OUT_WIDTH / 8);
+        }
+    }
+    scaler_show(scaler);
+}
+
+void image_scaler_set_progress(
+    ImageScaler* scaler,
+    ImageConvertProgressCallback callback,
+    void* context) {
+    scaler->progress = callback;
+    scaler->progress_context = context;
+    scaler->progress_due = scaler_cycles() + scaler_ms_to_cycles(IMAGE_SCALER_PREVIEW_MS);
+}
+
+void image_scaler_preview(ImageScaler* scaler, const uint8_t* frame) {
+    if(!scaler->progress) return;
+    scaler_draw_frame(scaler, frame, UINT64_MAX);
+    scaler->sketched = true;
+    scaler_show(scaler);
+}
+
+void image_scaler_apply_levels(ImageScaler* scaler) {
+    if(!scaler->levels || scaler->levels->ready) return;
+
+    uint32_t start = scaler_cycles();
+    scaler_apply_levels(scaler);
+    scaler->cycles += scaler_cycles() - start;
+}
+
+void image_scaler_emit_row(ImageScaler* scaler, uint32_t out_y, uint8_t* line) {
+    uint32_t start = scaler_cycles();
+    scaler_emit_row(scaler, out_y, line);
+    scaler->cycles += scaler_cycles() - start;
+    scaler_report_progress(scaler);
+}
+
+// Box filter one source row for an exact 1x/2x/4x/8x width ratio. Always
+// inlined with a constant shift, so each ratio gets its own unrolled loop and
+// the normalization is a shift.
+static FURI_ALWAYS_INLINE void
+    scaler_reduce_pow2(uint32_t* acc, const uint8_t* luma, const uint32_t shift) {
+    for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+        uint32_t sum = 0;
+        for(uint32_t i = 0; i < (1U << shift); i++) {
+            sum += *luma++;
+        }
+        acc[x] += sum << (8 - shift);
+    }
+}
+
+static void scaler_reduce_luma(ImageScaler* scaler, const uint8_t* luma) {
+    uint32_t* acc = scaler->acc;
+    const uint16_t* start = scaler->col_start;
+
+    switch(scaler->col_shift) {
+    case 0:
+        scaler_reduce_pow2(acc, luma + start[0], 0);
+        return;
+    case 1:
+        scaler_reduce_pow2(acc, luma + start[0], 1);
+        return;
+    case 2:
+        scaler_reduce_pow2(acc, luma + start[0], 2);
+        return;
+    case 3:
+        scaler_reduce_pow2(acc, luma + start[0], 3);
+        return;
+    default:
+        break;
+    }
+
+    if(scaler->src_width < scaler->out_width) {
+        // Upscaling: spans are 0 or 1 pixel wide, replicate the nearest one
+        for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+            acc[x] += (uint32_t)luma[start[x]] << 8;
+        }
+        return;
+    }
+
+    for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+        uint32_t sum = 0;
+        for(uint32_t i = start[x]; i < start[x + 1]; i++) {
+            sum += luma[i];
+        }
+        // sum <= 255 * 128, times a reciprocal <= 65536 still fits 32 bits
+        acc[x] += (sum * scaler->col_recip[x]) >> 8;
+    }
+}
+
+static FURI_ALWAYS_INLINE uint32_t
+    scaler_pixel(const ImageScaler* scaler, const uint8_t* p, const ImagePixelFormat format) {
+    switch(format) {
+    case ImagePixelIndexed:
+        return scaler->palette[p[0]];
+    case ImagePixelGrayAlpha:
+        return image_luma_over_white(p[0], p[1]);
+    case ImagePixelRgb:
+        return image_luma(p[0], p[1], p[2]);
+    case ImagePixelRgba:
+        return image_luma_over_white(image_luma(p[0], p[1], p[2]), p[3]);
+    case ImagePixelBgr:
+    case ImagePixelBgrx:
+        return image_luma(p[2], p[1], p[0]);
+    default:
+        return p[0];
+    }
+}
+
+// The luma loop above with each pixel converted as it is summed. Always
+// inlined with a constant format, so every layout gets its own loop; pixels
+// in columns the output skips are never converted.
+static FURI_ALWAYS_INLINE void scaler_reduce_format(
+    ImageScaler* scaler,
+    const uint8_t* pixels,
+    const ImagePixelFormat format,
+    const uint32_t size) {
+    uint32_t* acc = scaler->acc;
+    const uint16_t* start = scaler->col_start;
+
+    if(scaler->src_width < scaler->out_width) {
+        for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+            acc[x] += scaler_pixel(scaler, pixels + start[x] * size, format) << 8;
+        }
+        return;
+    }
+
+    for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+        uint32_t sum = 0;
+        for(uint32_t i = start[x]; i < start[x + 1]; i++) {
+            sum += scaler_pixel(scaler, pixels + i * size, format);
+        }
+        acc[x] += (sum * scaler->col_recip[x]) >> 8;
+    }
+}
+
+static void
+    scaler_reduce_row(ImageScaler* scaler, const uint8_t* pixels, ImagePixelFormat format) {
+    switch(format) {
+    case ImagePixelIndexed:
+        scaler_reduce_format(scaler, pixels, ImagePixelIndexed, 1);
+        break;
+    case ImagePixelGrayAlpha:
+        scaler_reduce_format(scaler, pixels, ImagePixelGrayAlpha, 2);
+        break;
+    case ImagePixelRgb:
+        scaler_reduce_format(scaler, pixels, ImagePixelRgb, 3);
+        break;
+    case ImagePixelRgba:
+        scaler_reduce_format(scaler, pixels, ImagePixelRgba, 4);
+        break;
+    case ImagePixelBgr:
+        scaler_reduce_format(scaler, pixels, ImagePixelBgr, 3);
+        break;
+    case ImagePixelBgrx:
+        scaler_reduce_format(scaler, pixels, ImagePixelBgrx, 4);
+        break;
+    default:
+        scaler_reduce_luma(scaler, pixels);
+        break;
+    }
+}
+
+static const uint8_t scaler_pixel_sizes[] = {
+    [ImagePixelGray] = 1,
+    [ImagePixelIndexed] = 1,
+    [ImagePixelGrayAlpha] = 2,
+    [ImagePixelRgb] = 3,
+    [ImagePixelRgba] = 4,
+    [ImagePixelBgr] = 3,
+    [ImagePixelBgrx] = 4,
+};
+
+void image_scaler_sample_row(
+    ImageScaler* scaler,
+    const uint8_t* pixels,
+    uint32_t count,
+    ImagePixelFormat format) {
+    ImageLevels* levels = scaler->levels;
+    if(!levels || levels->ready) return;
+
+    uint32_t stride = levels->col_step * scaler_pixel_sizes[format];
+    const uint8_t* end = pixels + count * scaler_pixel_sizes[format];
+    for(const uint8_t* p = pixels; p < end; p += stride) {
+        image_levels_add(levels, scaler_pixel(scaler, p, format));
+    }
+}
+
+void image_scaler_sketch_row(
+    const ImageScaler* scaler,
+    uint8_t* frame,
+    uint32_t src_y,
+    uint32_t step,
+    const uint8_t* pixels,
+    ImagePixelFormat format) {
+    uint32_t size = scaler_pixel_sizes[format];
+    const uint8_t* first = NULL;
+    for(uint32_t y = 0; y < IMAGE_OUT_HEIGHT; y++) {
+        uint32_t start = scaler->row_start[y];
+        if(start < src_y || start - src_y >= step) continue;
+
+        uint8_t* out = frame + y * IMAGE_OUT_WIDTH;
+        if(first) {
+            memcpy(out, first, IMAGE_OUT_WIDTH);
+            continue;
+        }
+        for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+            out[x] = scaler_pixel(scaler, pixels + scaler->col_start[x] * size, format);
+        }
+        first = out;
+    }
+}
+
+// Normalize the accumulated band into `line` (one division per output row),
+// dither it out and start a new band
+static void scaler_flush_band(ImageScaler* scaler) {
+    if(scaler->band < 0 || !scaler->band_rows) return;
+
+    uint32_t recip = 65536 / scaler->band_rows;
+    for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+        uint32_t value = ((uint64_t)scaler->acc[x] * recip + (1U << 23)) >> 24;
+        scaler->line[x] = value > 255 ? 255 : value;
+    }
+    scaler_emit_row(scaler, scaler->band, scaler->line);
+
+    memset(scaler->acc, 0, sizeof(scaler->acc));
+    scaler->band = -1;
+    scaler->band_rows = 0;
+}
+
+static void scaler_push_row(
+    ImageScaler* scaler,
+    uint32_t src_y,
+    const uint8_t* pixels,
+    ImagePixelFormat format) {
+    if(scaler->src_height < scaler->out_height) {
+        // Upscaled sources map one source row onto several output rows
+        scaler_reduce_row(scaler, pixels, format);
+        scaler->band_rows = 1;
+        for(uint32_t y = 0; y < IMAGE_OUT_HEIGHT; y++) {
+            if(scaler->row_start[y] != src_y) continue;
+            scaler->band = y;
+            for(uint32_t x = 0; x < IMAGE_OUT_WIDTH; x++) {
+                scaler->line[x] = scaler->acc[x] >> 8;
+            }
+            scaler_emit_row(scaler, y, scaler->line);
+        }
+        memset(scaler->acc, 0, sizeof(scaler->acc));
+        scaler->band = -1;
+        scaler->band_rows = 0;
+        return;
+    }
+
+    // Rows come in monotonic order (top-down, or bottom-up for most BMPs), so
+    // reaching another band means the held one is done even if it was short
+    int32_t band = scaler_band_of(scaler, src_y);
+    if(band != scaler->band) {
+        scaler_flush_band(scaler);
+        scaler->band = band;
+    }
+
+    scaler_reduce_row(scaler, pixels, format);
+    scaler->band_rows++;
+
+    if(scaler->band_rows == scaler_band_taps(scaler, band)) {
+        scaler_flush_band(scaler);
+    }
+}
+
+void image_scaler_push_row(ImageScaler* scaler, uint32_t src_y, const uint8_t* luma) {
+    image_scaler_push_pixels(scaler, src_y, luma, ImagePixelGray);
+}
+
+void image_scaler_push_pixels(
+    ImageScaler* scaler,
+    uint32_t src_y,
+    const uint8_t* pixels,
+    ImagePixelFormat format) {
+    if(!image_scaler_wants_row(scaler, src_y)) return;
+
+    uint32_t start = scaler_cycles();
+    scaler_push_row(scaler, src_y, pixels, format);
+    scaler->cycles += scaler_cycles() - start;
+    scaler_report_progress(scaler);
+}
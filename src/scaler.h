@@ -0,0 +1,168 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "convert.h"
+#include "dither.h"
+#include "levels.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Most source rows averaged into one output row; taller bands are sampled at
+// evenly spaced rows so seekable decoders can skip the rest
+#define IMAGE_SCALER_MAX_TAPS 8
+
+// With progress on, the first partial frame goes out this long after the
+// conversion starts and the next ones at most this often
+#define IMAGE_SCALER_PREVIEW_MS 50
+#define IMAGE_SCALER_REFINE_MS  250
+
+// Streaming area-averaging downscaler. Decoders push one source row at a
+// time, as luma or in an ImagePixelFormat; each row is converted and
+// box-filtered horizontally into a 128 entry column accumulator (8
+// fractional bits) in the same loop and, once an output band is complete,
+// normalized, dithered and packed into the 1-bit bitmap. Rows may arrive
+// top-down or bottom-up. Band edges are stepped Bresenham style at init, so
+// the per-pixel work for luma rows is one add.
+//
+// With auto levels on, finished rows go through the levels table before
+// dithering. Rows finished before the table is built are held back in one
+// 128x64 luma frame and dithered top-down once it is.
+//
+// With progress on, the bitmap is handed to a callback now and then before
+// it is finished: as a partial frame, the rows done so far with the rest
+// white, or with rows held back dithered through a table built from the
+// samples counted so far; or as a coarse preview of the whole image that a
+// decoder got to early, which the rows still to come then refine in place.
+//
+// The source is normally scaled to the screen. When zoomed it is scaled to
+// a larger image and only a screen sized window of that is produced; source
+// rows outside the window are not wanted.
+typedef struct {
+    uint8_t* bitmap;
+    uint32_t src_width;
+    uint32_t src_height;
+    uint32_t out_width; // Whole scaled image, IMAGE_OUT_WIDTH << zoom
+    uint32_t out_height;
+    uint32_t window_x; // Top-left of the window produced, in scaled pixels
+    uint32_t window_y;
+    uint8_t col_shift; // log2 of an exact power of two width ratio, or 0xFF
+    uint16_t col_start[IMAGE_OUT_WIDTH + 1];
+    uint32_t col_recip[IMAGE_OUT_WIDTH]; // 65536 / column span
+    uint16_t row_start[IMAGE_OUT_HEIGHT + 1];
+    int8_t band; // Output row held in acc, -1 when empty
+    uint16_t band_rows; // Source rows accumulated into acc so far
+    uint32_t acc[IMAGE_OUT_WIDTH];
+    uint8_t line[IMAGE_OUT_WIDTH];
+    const uint8_t* palette; // Luma of each index for ImagePixelIndexed rows
+    ImageLevels* levels; // NULL unless auto levels are on
+    uint8_t* held; // Rows waiting for the levels table, allocated on first use
+    uint64_t held_rows; // Bit y set once row y is in held
+    uint64_t done_rows; // Bit y set once row y is in the bitmap
+    uint64_t shown_rows; // held_rows | done_rows as of the last preview
+    bool sketched; // The bitmap holds a coarse preview of rows not done
+    ImageConvertProgressCallback progress; // NULL unless previews are wanted
+    void* progress_context;
+    uint32_t progress_due; // Cycle count from which a partial frame is due
+    ImageDither dither;
+    uint32_t cycles; // CPU cycles spent in push_row and emit_row, dithering included
+} ImageScaler;
+
+// Bind the output bitmap and dithering; done once by the converter. The
+// whole image is scaled to the screen unless a tile is picked.
+void image_scaler_setup(ImageScaler* scaler, uint8_t* bitmap, ImageDitherMode dither_mode);
+
+// Produce tile (tile_x, tile_y) of the image scaled to 2^zoom screens each way
+void image_scaler_set_tile(ImageScaler* scaler, uint8_t zoom, uint32_t tile_x, uint32_t tile_y);
+
+// Prepare the scaler for a source image; called by the decoder once it knows
+// the dimensions. Every output row is later written whole by emit_row, so the
+// bitmap is not cleared.
+void image_scaler_init(ImageScaler* scaler, uint32_t src_width, uint32_t src_height);
+
+// True if the source row contributes to the output, so decoders can skip the rest
+bool image_scaler_wants_row(const ImageScaler* scaler, uint32_t src_y);
+
+// Feed one source row of src_width luma samples; rows that are not wanted are ignored
+void image_scaler_push_row(ImageScaler* scaler, uint32_t src_y, const uint8_t* luma);
+
+// Feed one source row of src_width pixels as stored by the decoder
+void image_scaler_push_pixels(
+    ImageScaler* scaler,
+    uint32_t src_y,
+    const uint8_t* pixels,
+    ImagePixelFormat format);
+
+// Luma of each palette index, for ImagePixelIndexed rows; kept, not copied
+static inline void image_scaler_set_palette(ImageScaler* scaler, const uint8_t* luma) {
+    scaler->palette = luma;
+}
+
+// Turn auto levels on for the next image; set after setup, which turns
+// them off. `levels` is kept, not copied, and only counts once init starts
+// an image.
+static inline void image_scaler_set_levels(ImageScaler* scaler, ImageLevels* levels) {
+    scaler->levels = levels;
+    if(levels) levels->ready = true;
+}
+
+// True if the decoder should count source row src_y into the levels
+// histogram; rows are picked from the whole image, also when tiled
+static inline bool image_scaler_samples_row(const ImageScaler* scaler, uint32_t src_y) {
+    return scaler->levels && image_levels_samples_row(scaler->levels, src_y);
+}
+
+// Count every col_step-th of `count` pixels of a sampled source row
+void image_scaler_sample_row(
+    ImageScaler* scaler,
+    const uint8_t* pixels,
+    uint32_t count,
+    ImagePixelFormat format);
+
+// Count one luma value, for decoders that sample some other way
+static inline void image_scaler_sample(ImageScaler* scaler, uint8_t luma) {
+    if(scaler->levels && !scaler->levels->ready) image_levels_add(scaler->levels, luma);
+}
+
+// The histogram is complete: build the levels table and dither the rows
+// held back for it. Decoders with a pre-pass call this before their main
+// pass, the converter after every decode. Does nothing without levels or
+// once done.
+void image_scaler_apply_levels(ImageScaler* scaler);
+
+// Hand the bitmap to `callback` as it fills in; off after setup. Timing
+// starts here, so set it before the decoder starts.
+void image_scaler_set_progress(
+    ImageScaler* scaler,
+    ImageConvertProgressCallback callback,
+    void* context);
+
+// True if previews are shown, so decoders can skip preparing them
+static inline bool image_scaler_wants_preview(const ImageScaler* scaler) {
+    return scaler->progress != NULL;
+}
+
+// Point sample a source row into the 128x64 luma `frame` of a preview, in
+// every output row whose band starts between src_y and `step` rows further
+// down; for decoders that read rows spread over the image ahead of the rest
+void image_scaler_sketch_row(
+    const ImageScaler* scaler,
+    uint8_t* frame,
+    uint32_t src_y,
+    uint32_t step,
+    const uint8_t* pixels,
+    ImagePixelFormat format);
+
+// Show a coarse 128x64 luma preview of the whole image. Rows not yet done
+// keep it until they are; call before the decoder emits any.
+void image_scaler_preview(ImageScaler* scaler, const uint8_t* frame);
+
+// Write an already scaled 128 sample output row, for decoders (interlaced
+// PNG) that resample on their own
+void image_scaler_emit_row(ImageScaler* scaler, uint32_t out_y, uint8_t* line);
+
+#ifdef __cplusplus
+}
+#endif
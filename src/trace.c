@@ -0,0 +1,137 @@
+#include <furi.h>
+#include <furi_hal.h>
+#include <stdarg.h>
+#include <storage/storage.h>
+#include "trace.h"
+
+#define TAG "ImageTrace"
+
+// Threads told apart in one trace
+#define TRACE_THREADS 8
+
+// Longest line written, its newline and terminator included
+#define TRACE_LINE_MAX 128
+
+ImageTrace image_trace;
+
+typedef struct {
+    File* file;
+    char buffer[512];
+    size_t used;
+    bool ok;
+} TraceWriter;
+
+// Lines are formatted straight into the buffer, flushed first unless the
+// longest one fits
+static void trace_write(TraceWriter* writer, const char* format, ...) {
+    if(writer->used + TRACE_LINE_MAX > sizeof(writer->buffer)) {
+        writer->ok &= storage_file_write(writer->file, writer->buffer, writer->used) ==
+                      writer->used;
+        writer->used = 0;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(writer->buffer + writer->used, TRACE_LINE_MAX, format, args);
+    va_end(args);
+    if(length < 0) return;
+    writer->used += MIN((size_t)length, TRACE_LINE_MAX - 1);
+}
+
+// Copy an event out while it may still be written
+static void trace_load(ImageTraceEvent* out, const ImageTraceEvent* event) {
+    out->cycles = __atomic_load_n(&event->cycles, __ATOMIC_RELAXED);
+    out->name = __atomic_load_n(&event->name, __ATOMIC_RELAXED);
+    out->thread = __atomic_load_n(&event->thread, __ATOMIC_RELAXED);
+    out->phase = __atomic_load_n(&event->phase, __ATOMIC_RELAXED);
+}
+
+static uint32_t trace_thread_index(FuriThreadId* threads, uint32_t* count, FuriThreadId thread) {
+    for(uint32_t i = 0; i < *count; i++) {
+        if(threads[i] == thread) return i;
+    }
+    if(*count == TRACE_THREADS) return TRACE_THREADS;
+    threads[*count] = thread;
+    return (*count)++;
+}
+
+bool image_trace_flush(void) {
+    uint32_t head = __atomic_load_n(&image_trace.head, __ATOMIC_RELAXED);
+    uint32_t count = MIN(head, (uint32_t)IMAGE_TRACE_EVENTS);
+    uint32_t per_us = furi_hal_cortex_instructions_per_microsecond();
+
+    Storage* storage = furi_record_open(RECORD_STORAGE);
+    // On the heap, as flushes run on the app's event loop
+    TraceWriter* writer = malloc(sizeof(TraceWriter));
+    writer->file = storage_file_alloc(storage);
+    writer->used = 0;
+    writer->ok = true;
+    if(!storage_file_open(writer->file, IMAGE_TRACE_PATH, FSAM_WRITE, FSOM_CREATE_ALWAYS)) {
+        storage_file_free(writer->file);
+        free(writer);
+        furi_record_close(RECORD_STORAGE);
+        return false;
+    }
+
+    FuriThreadId threads[TRACE_THREADS];
+    uint32_t thread_count = 0;
+    int64_t elapsed = 0; // Cycles since the oldest event, unwrapped
+    uint32_t previous = 0;
+    bool first = true;
+    uint32_t skew = per_us * 1000; // Furthest back a stamp is taken as out of order
+    const char* separator = "";
+
+    trace_write(writer, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for(uint32_t i = head - count; i != head; i++) {
+        ImageTraceEvent event;
+        trace_load(&event, &image_trace.events[i & (IMAGE_TRACE_EVENTS - 1)]);
+        if(!event.name || (event.phase != ImageTraceBegin && event.phase != ImageTraceEnd &&
+                           event.phase != ImageTraceInstant)) {
+            continue;
+        }
+
+        // Stamps are taken after the slot is claimed, so neighbours from
+        // different threads can be a little out of order. Anything further
+        // back is a gap long enough for the counter to come round.
+        uint32_t behind = previous - event.cycles;
+        if(!first) {
+            elapsed += behind <= skew ? -(int64_t)behind : (int64_t)(event.cycles - previous);
+        }
+        previous = event.cycles;
+        first = false;
+
+        trace_write(
+            writer,
+            "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lu,\"pid\":1,\"tid\":%lu%s}",
+            separator,
+            event.name,
+            event.phase,
+            (unsigned long)(MAX(elapsed, 0) / per_us),
+            (unsigned long)trace_thread_index(threads, &thread_count, event.thread),
+            event.phase == ImageTraceInstant ? ",\"s\":\"t\"" : "");
+        separator = ",";
+    }
+
+    for(uint32_t i = 0; i < thread_count; i++) {
+        const char* name = furi_thread_get_name(threads[i]);
+        trace_write(
+            writer,
+            "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,"
+            "\"args\":{\"name\":\"%s\"}}",
+            separator,
+            (unsigned long)i,
+            name ? name : "?");
+        separator = ",";
+    }
+    trace_write(writer, "\n]}\n");
+
+    writer->ok &= storage_file_write(writer->file, writer->buffer, writer->used) == writer->used;
+    storage_file_close(writer->file);
+    storage_file_free(writer->file);
+    furi_record_close(RECORD_STORAGE);
+
+    FURI_LOG_I(TAG, "Wrote %lu events to %s", (unsigned long)count, IMAGE_TRACE_PATH);
+    bool ok = writer->ok;
+    free(writer);
+    return ok;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <furi.h>
+#include <furi_hal.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Set to 0 to compile every trace point out
+#ifndef IMAGE_TRACE_ENABLED
+#define IMAGE_TRACE_ENABLED 1
+#endif
+
+// Events kept; older ones are overwritten. Must be a power of two.
+#define IMAGE_TRACE_EVENTS 256
+
+#define IMAGE_TRACE_PATH APP_DATA_PATH("trace.json")
+
+typedef enum {
+    ImageTraceBegin = 'B',
+    ImageTraceEnd = 'E',
+    ImageTraceInstant = 'i',
+} ImageTracePhase;
+
+typedef struct {
+    uint32_t cycles;
+    const char* name; // Must be a string literal, only the pointer is kept
+    FuriThreadId thread;
+    uint8_t phase;
+} ImageTraceEvent;
+
+typedef struct {
+    ImageTraceEvent events[IMAGE_TRACE_EVENTS];
+    uint32_t head; // Total events recorded; the slot is head % IMAGE_TRACE_EVENTS
+} ImageTrace;
+
+extern ImageTrace image_trace;
+
+// Record an event: an atomic increment to claim a slot and four stores, so
+// it is cheap enough to leave on. Any thread or callback may record; a
+// writer that is lapped by the others while filling its slot can leave a
+// torn event, which the flush tolerates. The stores are relaxed atomics,
+// plain stores on the Cortex-M4, so a torn event is the worst that happens.
+static inline void image_trace_record(const char* name, ImageTracePhase phase) {
+#if IMAGE_TRACE_ENABLED
+    uint32_t slot = __atomic_fetch_add(&image_trace.head, 1, __ATOMIC_RELAXED);
+    ImageTraceEvent* event = &image_trace.events[slot & (IMAGE_TRACE_EVENTS - 1)];
+    __atomic_store_n(&event->cycles, furi_hal_cortex_timer_get(0).start, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->name, name, __ATOMIC_RELAXED);
+    __atomic_store_n(&event->thread, furi_thread_get_current_id(), __ATOMIC_RELAXED);
+    __atomic_store_n(&event->phase, phase, __ATOMIC_RELAXED);
+#else
+    UNUSED(name);
+    UNUSED(phase);
+#endif
+}
+
+static inline void image_trace_begin(const char* name) {
+    image_trace_record(name, ImageTraceBegin);
+}
+
+static inline void image_trace_end(const char* name) {
+    image_trace_record(name, ImageTraceEnd);
+}
+
+static inline void image_trace_instant(const char* name) {
+    image_trace_record(name, ImageTraceInstant);
+}
+
+// Write the buffered events to IMAGE_TRACE_PATH in Chrome trace format, for
+// chrome://tracing or Perfetto. Cycle stamps are unwrapped in recording
+// order, so a gap between two events is only right up to one period of the
+// cycle counter (about 67 s at 64 MHz); longer ones come out short by
+// whole periods.
+bool image_trace_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
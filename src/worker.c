@@ -0,0 +1,613 @@
+#include <furi.h>
+#include <furi_hal.h>
+#include <string.h>
+#include <storage/storage.h>
+#include "extwalk.h"
+#include "gif.h"
+#include "trace.h"
+#include "worker.h"
+
+#define TAG "ImageWorker"
+
+#define IMAGE_WORKER_STACK (3 * 1024)
+
+// Late animation frames dropped in a row before one is shown regardless
+#define WORKER_ANIM_MAX_SKIP 4
+
+// Frame buffers: one per slot, plus the decode target, the zoomed view and
+// the next animation frame
+#define WORKER_BUFFERS (IMAGE_WORKER_FRAMES + 3)
+
+typedef enum {
+    WorkerEventWork = (1 << 0),
+    WorkerEventStop = (1 << 1),
+    WorkerEventTick = (1 << 2), // Next animation frame is due
+} WorkerEvent;
+
+#define WORKER_EVENT_ALL (WorkerEventWork | WorkerEventStop | WorkerEventTick)
+
+// Decode order of pending slots
+typedef enum {
+    FramePriorityCurrent,
+    FramePriorityNext,
+    FramePriorityPrev,
+} FramePriority;
+
+typedef struct {
+    char path[256];
+    ImageFrameState state;
+    FramePriority priority;
+    uint32_t generation; // Bumped on every reassignment
+    ImageConvertStats stats; // How the frame was produced
+    uint8_t* bitmap; // One of the worker's buffers
+    bool preview; // While decoding, bitmap holds a coarse or partial frame
+} ImageFrame;
+
+struct ImageWorker {
+    FuriThread* thread;
+    FuriMutex* mutex;
+    ImageFrame frames[IMAGE_WORKER_FRAMES];
+    int8_t current; // Slot on screen, -1 for none
+    uint32_t generation;
+    ImageWorkerCallback callback;
+    void* context;
+
+    ImageCacheStats cache_stats; // Snapshot of the cache, under the mutex
+
+    // Zoomed view of the frame on screen, under the mutex. view_bitmap holds
+    // the view numbered view_done, cut from slot generation view_frame.
+    uint8_t view_zoom; // 0 shows the whole frame
+    uint16_t view_x; // Top-left of the screen in half tiles
+    uint16_t view_y;
+    uint32_t view_wanted; // Bumped on every change of the view
+    uint32_t view_done;
+    uint32_t view_frame;
+    bool view_ok; // False when a tile of it failed to convert
+    uint8_t* view_bitmap;
+
+    // Owned by the worker thread
+    Storage* storage;
+    ImageCache* cache;
+    char path[256];
+    int8_t job_slot; // Slot and generation being decoded
+    uint32_t job_generation;
+    uint8_t* scratch; // Decodes and views land here, then swap in
+    uint8_t tile[IMAGE_FRAME_SIZE];
+
+    // Playback of the GIF on screen, owned by the worker thread. The next
+    // frame is composited ahead into anim_frame and goes up when the timer
+    // says it is due.
+    FuriTimer* anim_timer;
+    ImageGif* anim;
+    uint32_t anim_generation; // Slot generation played, 0 for none
+    uint32_t anim_due; // Tick the next frame goes up
+    uint32_t anim_delay; // Ticks it then stays up
+    bool anim_ready;
+    uint8_t anim_skip_run;
+    uint32_t anim_skipped;
+    uint8_t* anim_frame;
+
+    // Every frame lives in one of these for the life of the worker. Finished
+    // frames are handed over by swapping pointers under the mutex, which is
+    // also held while a frame is drawn, so nothing is copied or allocated
+    // on the way to the screen.
+    uint8_t buffers[WORKER_BUFFERS][IMAGE_FRAME_SIZE];
+};
+
+static inline void worker_swap(uint8_t** a, uint8_t** b) {
+    uint8_t* buffer = *a;
+    *a = *b;
+    *b = buffer;
+}
+
+static int8_t worker_find(ImageWorker* worker, const char* path) {
+    for(int8_t i = 0; i < IMAGE_WORKER_FRAMES; i++) {
+        ImageFrame* frame = &worker->frames[i];
+        if(frame->state != ImageFrameEmpty && strcmp(frame->path, path) == 0) return i;
+    }
+    return -1;
+}
+
+// Pick a slot for a new image: never the one on screen or one holding a
+// path in `keep`, and empty or failed slots before decoded ones
+static int8_t worker_claim(
+    ImageWorker* worker,
+    const char* path,
+    FramePriority priority,
+    const char* keep_a,
+    const char* keep_b) {
+    int8_t victim = -1;
+    for(int8_t i = 0; i < IMAGE_WORKER_FRAMES; i++) {
+        ImageFrame* frame = &worker->frames[i];
+        if(i == worker->current && priority != FramePriorityCurrent) continue;
+        if(frame->state != ImageFrameEmpty) {
+            if(keep_a && strcmp(frame->path, keep_a) == 0) continue;
+            if(keep_b && strcmp(frame->path, keep_b) == 0) continue;
+        }
+        if(victim < 0 || frame->state == ImageFrameEmpty || frame->state == ImageFrameFailed) {
+            victim = i;
+        }
+    }
+    if(victim < 0) return -1;
+
+    ImageFrame* frame = &worker->frames[victim];
+    strlcpy(frame->path, path, sizeof(frame->path));
+    frame->state = ImageFramePending;
+    frame->priority = priority;
+    frame->generation = ++worker->generation;
+    return victim;
+}
+
+bool image_worker_show(ImageWorker* worker, const char* path) {
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+
+    int8_t slot = worker_find(worker, path);
+    if(slot < 0) {
+        // The old frame stays protected as the likely next neighbour
+        const char* old = worker->current >= 0 ? worker->frames[worker->current].path : NULL;
+        worker->current = -1;
+        slot = worker_claim(worker, path, FramePriorityCurrent, old, NULL);
+        if(slot < 0) {
+            furi_mutex_release(worker->mutex);
+            return false;
+        }
+    }
+    worker->current = slot;
+    worker->frames[slot].priority = FramePriorityCurrent;
+    bool ready = worker->frames[slot].state == ImageFrameReady;
+
+    furi_mutex_release(worker->mutex);
+
+    // Woken either way, to decode the frame or to start or stop playback
+    furi_thread_flags_set(furi_thread_get_id(worker->thread), WorkerEventWork);
+    return ready;
+}
+
+void image_worker_prefetch(ImageWorker* worker, const char* prev, const char* next) {
+    if(prev && !prev[0]) prev = NULL;
+    if(next && !next[0]) next = NULL;
+
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    bool queued = false;
+    if(next) {
+        int8_t slot = worker_find(worker, next);
+        if(slot < 0) {
+            queued = worker_claim(worker, next, FramePriorityNext, prev, NULL) >= 0;
+        } else if(slot != worker->current) {
+            worker->frames[slot].priority = FramePriorityNext;
+        }
+    }
+    if(prev) {
+        int8_t slot = worker_find(worker, prev);
+        if(slot < 0) {
+            queued |= worker_claim(worker, prev, FramePriorityPrev, next, NULL) >= 0;
+        } else if(slot != worker->current) {
+            worker->frames[slot].priority = FramePriorityPrev;
+        }
+    }
+    furi_mutex_release(worker->mutex);
+
+    if(queued) furi_thread_flags_set(furi_thread_get_id(worker->thread), WorkerEventWork);
+}
+
+ImageFrameState image_worker_get_state(ImageWorker* worker, const char* path) {
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    int8_t slot = worker_find(worker, path);
+    ImageFrameState state = slot >= 0 ? worker->frames[slot].state : ImageFrameEmpty;
+    furi_mutex_release(worker->mutex);
+    return state;
+}
+
+void image_worker_set_view(ImageWorker* worker, uint8_t zoom, uint16_t x, uint16_t y) {
+    zoom = MIN(zoom, IMAGE_ZOOM_MAX);
+    uint16_t last = (2U << zoom) - 2;
+    x = MIN(x, last);
+    y = MIN(y, last);
+
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    bool changed = zoom != worker->view_zoom || x != worker->view_x || y != worker->view_y;
+    if(changed) {
+        worker->view_zoom = zoom;
+        worker->view_x = x;
+        worker->view_y = y;
+        worker->view_wanted++;
+    }
+    furi_mutex_release(worker->mutex);
+
+    if(changed) furi_thread_flags_set(furi_thread_get_id(worker->thread), WorkerEventWork);
+}
+
+void image_worker_invalidate(ImageWorker* worker) {
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    for(size_t i = 0; i < IMAGE_WORKER_FRAMES; i++) {
+        worker->frames[i].state = ImageFrameEmpty;
+        worker->frames[i].generation = ++worker->generation;
+    }
+    worker->current = -1;
+    furi_mutex_release(worker->mutex);
+}
+
+const uint8_t* image_worker_lock_current(ImageWorker* worker, ImageFrameState* state) {
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    if(worker->current < 0) {
+        *state = ImageFrameEmpty;
+        return NULL;
+    }
+    ImageFrame* frame = &worker->frames[worker->current];
+    *state = frame->state;
+    if(frame->state == ImageFrameDecoding && frame->preview) return frame->bitmap;
+    if(frame->state != ImageFrameReady) return NULL;
+    bool zoomed = worker->view_zoom && worker->view_ok && worker->view_frame == frame->generation;
+    return zoomed ? worker->view_bitmap : frame->bitmap;
+}
+
+void image_worker_unlock(ImageWorker* worker) {
+    furi_mutex_release(worker->mutex);
+}
+
+bool image_worker_get_current_stats(ImageWorker* worker, ImageConvertStats* stats) {
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    bool done = worker->current >= 0 &&
+                (worker->frames[worker->current].state == ImageFrameReady ||
+                 worker->frames[worker->current].state == ImageFrameFailed);
+    if(done) *stats = worker->frames[worker->current].stats;
+    furi_mutex_release(worker->mutex);
+    return done;
+}
+
+void image_worker_get_cache_stats(ImageWorker* worker, ImageCacheStats* stats) {
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    *stats = worker->cache_stats;
+    furi_mutex_release(worker->mutex);
+}
+
+// Progress of the decode of the frame on screen: the coarse or partial frame
+// in scratch is copied into its slot, where it is drawn until the real one
+// is swapped in, and the screen redrawn
+static void worker_progress_callback(void* context) {
+    ImageWorker* worker = context;
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    ImageFrame* frame = &worker->frames[worker->job_slot];
+    bool on_screen = frame->generation == worker->job_generation &&
+                     worker->job_slot == worker->current;
+    if(on_screen) {
+        memcpy(frame->bitmap, worker->scratch, IMAGE_FRAME_SIZE);
+        frame->preview = true;
+    }
+    furi_mutex_release(worker->mutex);
+
+    if(on_screen && worker->callback) worker->callback(worker->context);
+}
+
+// Decode the most urgent pending slot; false when there is nothing to do
+static bool worker_run_job(ImageWorker* worker) {
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    int8_t slot = -1;
+    for(int8_t i = 0; i < IMAGE_WORKER_FRAMES; i++) {
+        ImageFrame* frame = &worker->frames[i];
+        if(frame->state != ImageFramePending) continue;
+        if(slot < 0 || frame->priority < worker->frames[slot].priority) slot = i;
+    }
+    if(slot < 0) {
+        furi_mutex_release(worker->mutex);
+        return false;
+    }
+    ImageFrame* frame = &worker->frames[slot];
+    frame->state = ImageFrameDecoding;
+    frame->preview = false;
+    uint32_t generation = frame->generation;
+    strlcpy(worker->path, frame->path, sizeof(worker->path));
+    // Only the frame on screen is worth previewing; prefetches go in one go
+    worker->job_slot = slot;
+    worker->job_generation = generation;
+    image_convert_set_progress_callback(
+        slot == worker->current ? worker_progress_callback : NULL, worker);
+    furi_mutex_release(worker->mutex);
+
+    image_trace_begin("worker_job");
+    // The key pins the file contents and the conversion settings; a file
+    // that cannot be stat'ed is decoded without the cache
+    ImageCacheKey key;
+    bool cacheable = image_cache_key_init(
+        &key, worker->storage, worker->path, image_convert_get_dither_mode());
+
+    ImageConverterResult result = ImageConverterOK;
+    ImageConvertStats stats = {.source = ImageConvertRamCache};
+    uint32_t lookup_start = furi_hal_cortex_timer_get(0).start;
+    if(cacheable && image_cache_lookup(worker->cache, &key, worker->scratch)) {
+        stats.open_us = stats.total_us = (furi_hal_cortex_timer_get(0).start - lookup_start) /
+                                         furi_hal_cortex_instructions_per_microsecond();
+        image_trace_instant("ram_cache_hit");
+    } else {
+        // Make room for the decoder before it starts allocating
+        image_cache_trim(worker->cache, IMAGE_CACHE_HEAP_RESERVE);
+
+        uint32_t start = furi_get_tick();
+        uint16_t width, height;
+        result = image_convert_to_bitmap(worker->path, worker->scratch, &width, &height, &stats);
+        FURI_LOG_D(
+            TAG,
+            "Decoded %s in %lu ms: %d",
+            worker->path,
+            (unsigned long)(furi_get_tick() - start),
+            result);
+
+        if(cacheable && result == ImageConverterOK) {
+            image_cache_insert(worker->cache, &key, worker->scratch);
+        }
+    }
+    image_trace_end("worker_job");
+
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    image_cache_get_stats(worker->cache, &worker->cache_stats);
+    bool on_screen = false;
+    if(frame->generation == generation) {
+        frame->stats = stats;
+        if(result == ImageConverterOK) {
+            worker_swap(&frame->bitmap, &worker->scratch);
+            frame->state = ImageFrameReady;
+        } else {
+            frame->state = ImageFrameFailed;
+        }
+        on_screen = slot == worker->current;
+    }
+    furi_mutex_release(worker->mutex);
+
+    if(on_screen && worker->callback) worker->callback(worker->context);
+    return true;
+}
+
+static bool worker_view_stale(ImageWorker* worker, uint32_t view, uint32_t generation) {
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    bool stale = worker->view_wanted != view || worker->current < 0 ||
+                 worker->frames[worker->current].generation != generation;
+    furi_mutex_release(worker->mutex);
+    return stale || (furi_thread_flags_get() & WorkerEventStop);
+}
+
+// Copy the quarters of a tile that are on screen into the scratch bitmap.
+// Quarters are 64x32, so rows copy as whole bytes.
+static void worker_view_copy(
+    ImageWorker* worker,
+    uint16_t view_x,
+    uint16_t view_y,
+    uint16_t tile_x,
+    uint16_t tile_y) {
+    const size_t stride = IMAGE_OUT_WIDTH / 8;
+    for(uint8_t quarter = 0; quarter < 4; quarter++) {
+        uint16_t half_x = view_x + (quarter & 1);
+        uint16_t half_y = view_y + (quarter >> 1);
+        if(half_x / 2 != tile_x || half_y / 2 != tile_y) continue;
+
+        uint8_t* out = worker->scratch + (quarter >> 1) * (IMAGE_FRAME_SIZE / 2) +
+                       (quarter & 1) * (stride / 2);
+        const uint8_t* in = worker->tile + (half_y & 1) * (IMAGE_FRAME_SIZE / 2) +
+                            (half_x & 1) * (stride / 2);
+        for(uint32_t y = 0; y < IMAGE_OUT_HEIGHT / 2; y++) {
+            memcpy(out + y * stride, in + y * stride, stride / 2);
+        }
+    }
+}
+
+// Compose the zoomed view from the up to four tiles under the screen. Runs
+// once the frame on screen is decoded and ahead of prefetches; false when
+// there is nothing to do.
+static bool worker_run_view(ImageWorker* worker) {
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    ImageFrame* frame = worker->current >= 0 ? &worker->frames[worker->current] : NULL;
+    bool wanted = worker->view_zoom && frame && frame->state == ImageFrameReady &&
+                  (worker->view_done != worker->view_wanted ||
+                   worker->view_frame != frame->generation);
+    if(!wanted) {
+        furi_mutex_release(worker->mutex);
+        return false;
+    }
+    uint32_t view = worker->view_wanted;
+    uint32_t generation = frame->generation;
+    uint8_t zoom = worker->view_zoom;
+    uint16_t view_x = worker->view_x;
+    uint16_t view_y = worker->view_y;
+    strlcpy(worker->path, frame->path, sizeof(worker->path));
+    furi_mutex_release(worker->mutex);
+
+    image_trace_begin("worker_view");
+    ImageConverterResult result = ImageConverterOK;
+    for(uint16_t tile_y = view_y / 2; tile_y <= (view_y + 1) / 2; tile_y++) {
+        for(uint16_t tile_x = view_x / 2; tile_x <= (view_x + 1) / 2; tile_x++) {
+            // Held keys pan faster than tiles convert; skip to the latest view
+            if(worker_view_stale(worker, view, generation)) {
+                image_trace_end("worker_view");
+                return true;
+            }
+            if(result != ImageConverterOK) continue;
+            result = image_convert_tile(worker->path, zoom, tile_x, tile_y, worker->tile);
+            if(result == ImageConverterOK) {
+                worker_view_copy(worker, view_x, view_y, tile_x, tile_y);
+            }
+        }
+    }
+    image_trace_end("worker_view");
+
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    bool on_screen = worker->view_wanted == view && worker->current >= 0 &&
+                     worker->frames[worker->current].generation == generation;
+    if(on_screen) {
+        if(result == ImageConverterOK) {
+            worker_swap(&worker->view_bitmap, &worker->scratch);
+        } else {
+            FURI_LOG_E(TAG, "Zoom %u failed: %d", zoom, result);
+        }
+        worker->view_done = view;
+        worker->view_frame = generation;
+        worker->view_ok = result == ImageConverterOK;
+    }
+    furi_mutex_release(worker->mutex);
+
+    if(on_screen && worker->callback) worker->callback(worker->context);
+    return true;
+}
+
+static void worker_anim_timer_callback(void* context) {
+    ImageWorker* worker = context;
+    furi_thread_flags_set(furi_thread_get_id(worker->thread), WorkerEventTick);
+}
+
+static void worker_anim_stop(ImageWorker* worker) {
+    furi_timer_stop(worker->anim_timer);
+    if(worker->anim) {
+        FURI_LOG_D(
+            TAG, "Animation stopped, %lu frames skipped", (unsigned long)worker->anim_skipped);
+        image_gif_close(worker->anim);
+        worker->anim = NULL;
+    }
+    worker->anim_ready = false;
+}
+
+// Generation of the frame on screen if it is a decoded GIF, 0 otherwise or
+// while zoomed in; its path is left in worker->path
+static uint32_t worker_anim_target(ImageWorker* worker) {
+    uint32_t generation = 0;
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    if(worker->current >= 0 && !worker->view_zoom) {
+        ImageFrame* frame = &worker->frames[worker->current];
+        const char* mime = extwalk_get_mime_type(frame->path);
+        if(frame->state == ImageFrameReady && mime && strcmp(mime, "image/gif") == 0) {
+            generation = frame->generation;
+            strlcpy(worker->path, frame->path, sizeof(worker->path));
+        }
+    }
+    furi_mutex_release(worker->mutex);
+    return generation;
+}
+
+// Composite frames until one is worth showing. A frame whose successor is
+// already due would never be seen, so it is only composited, up to
+// WORKER_ANIM_MAX_SKIP in a row; past that the clock is restarted instead.
+static void worker_anim_prepare(ImageWorker* worker) {
+    uint32_t delay_ms;
+    while(image_gif_next_frame(worker->anim, &delay_ms)) {
+        uint32_t delay = furi_ms_to_ticks(delay_ms);
+        bool late = (int32_t)(furi_get_tick() - (worker->anim_due + delay)) >= 0;
+        if(late && worker->anim_skip_run < WORKER_ANIM_MAX_SKIP) {
+            worker->anim_due += delay;
+            worker->anim_skip_run++;
+            worker->anim_skipped++;
+            continue;
+        }
+        if(late) worker->anim_due = furi_get_tick();
+        worker->anim_skip_run = 0;
+
+        image_gif_render(worker->anim, worker->anim_frame, image_convert_get_dither_mode());
+        worker->anim_delay = delay;
+        worker->anim_ready = true;
+        return;
+    }
+    // Played out or unreadable: the last frame shown stays up
+    worker_anim_stop(worker);
+}
+
+static void worker_anim_publish(ImageWorker* worker) {
+    furi_mutex_acquire(worker->mutex, FuriWaitForever);
+    bool on_screen = worker->current >= 0 &&
+                     worker->frames[worker->current].generation == worker->anim_generation &&
+                     worker->frames[worker->current].state == ImageFrameReady;
+    if(on_screen) {
+        worker_swap(&worker->frames[worker->current].bitmap, &worker->anim_frame);
+    }
+    furi_mutex_release(worker->mutex);
+
+    worker->anim_ready = false;
+    worker->anim_due += worker->anim_delay;
+    if(on_screen && worker->callback) worker->callback(worker->context);
+}
+
+// Start, advance or stop playback of the frame on screen
+static void worker_animate(ImageWorker* worker) {
+    uint32_t target = worker_anim_target(worker);
+    if(target != worker->anim_generation) {
+        worker_anim_stop(worker);
+        worker->anim_generation = target;
+        if(!target) return;
+
+        // The first frame is already up; it is composited again as the base
+        // of the next one. A single frame GIF ends playback right here.
+        worker->anim = image_gif_open(worker->storage, worker->path);
+        uint32_t delay_ms;
+        if(!worker->anim || !image_gif_next_frame(worker->anim, &delay_ms)) {
+            worker_anim_stop(worker);
+            return;
+        }
+        worker->anim_due = furi_get_tick() + furi_ms_to_ticks(delay_ms);
+        worker->anim_skip_run = 0;
+        worker->anim_skipped = 0;
+    }
+
+    while(worker->anim) {
+        if(!worker->anim_ready) worker_anim_prepare(worker);
+        if(!worker->anim_ready) return;
+
+        int32_t wait = worker->anim_due - furi_get_tick();
+        if(wait > 0) {
+            furi_timer_start(worker->anim_timer, wait);
+            return;
+        }
+        worker_anim_publish(worker);
+    }
+}
+
+static int32_t image_worker_thread(void* context) {
+    ImageWorker* worker = context;
+
+    while(true) {
+        uint32_t events =
+            furi_thread_flags_wait(WORKER_EVENT_ALL, FuriFlagWaitAny, FuriWaitForever);
+        if(events & FuriFlagError) continue;
+        if(events & WorkerEventStop) break;
+
+        while(!(furi_thread_flags_get() & WorkerEventStop) &&
+              (worker_run_view(worker) || worker_run_job(worker))) {
+        }
+        if(events & WorkerEventWork) {
+            FURI_LOG_D(TAG, "Cache hit rate %u%%", image_cache_get_hit_rate(worker->cache));
+        }
+        worker_animate(worker);
+    }
+
+    // The timer must not fire at a thread that is gone
+    worker_anim_stop(worker);
+    return 0;
+}
+
+ImageWorker* image_worker_alloc(ImageWorkerCallback callback, void* context) {
+    ImageWorker* worker = malloc(sizeof(ImageWorker));
+    memset(worker, 0, sizeof(ImageWorker));
+    for(size_t i = 0; i < IMAGE_WORKER_FRAMES; i++) {
+        worker->frames[i].bitmap = worker->buffers[i];
+    }
+    worker->scratch = worker->buffers[IMAGE_WORKER_FRAMES];
+    worker->view_bitmap = worker->buffers[IMAGE_WORKER_FRAMES + 1];
+    worker->anim_frame = worker->buffers[IMAGE_WORKER_FRAMES + 2];
+    worker->current = -1;
+    worker->callback = callback;
+    worker->context = context;
+    worker->mutex = furi_mutex_alloc(FuriMutexTypeNormal);
+    worker->storage = furi_record_open(RECORD_STORAGE);
+    worker->cache = image_cache_alloc();
+    worker->anim_timer = furi_timer_alloc(worker_anim_timer_callback, FuriTimerTypeOnce, worker);
+    worker->thread =
+        furi_thread_alloc_ex(TAG, IMAGE_WORKER_STACK, image_worker_thread, worker);
+    furi_thread_start(worker->thread);
+    return worker;
+}
+
+void image_worker_free(ImageWorker* worker) {
+    // A decode in progress runs to completion before the thread sees this
+    furi_thread_flags_set(furi_thread_get_id(worker->thread), WorkerEventStop);
+    furi_thread_join(worker->thread);
+    furi_thread_free(worker->thread);
+    furi_timer_free(worker->anim_timer);
+    image_cache_free(worker->cache);
+    furi_record_close(RECORD_STORAGE);
+    furi_mutex_free(worker->mutex);
+    free(worker);
+}
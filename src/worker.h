@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cache.h"
+#include "convert.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bytes of one converted 128x64 frame
+#define IMAGE_FRAME_SIZE (IMAGE_OUT_WIDTH * IMAGE_OUT_HEIGHT / 8)
+
+// Frames kept decoded: the one on screen and its two neighbours
+#define IMAGE_WORKER_FRAMES 3
+
+typedef enum {
+    ImageFrameEmpty,
+    ImageFramePending, // Waiting for the worker
+    ImageFrameDecoding,
+    ImageFrameReady,
+    ImageFrameFailed,
+} ImageFrameState;
+
+// Called on the worker thread once the frame on screen has been decoded, and
+// each time a coarse or partial preview of it lands while it is decoding
+typedef void (*ImageWorkerCallback)(void* context);
+
+// Decode thread with a small set of frame slots. Slots waiting for a decode
+// are its job queue; the one on screen goes first, then the next image, then
+// the previous one. A decode lands in a spare buffer that is swapped into
+// its slot only if the slot still wants that image, so a stale job can never
+// overwrite a frame that was reassigned meanwhile. Showing an image that is
+// already decoded only switches which slot is current. Frames that left the
+// slots stay in an ImageCache, so going back to one costs a decompress
+// rather than a decode.
+typedef struct ImageWorker ImageWorker;
+
+ImageWorker* image_worker_alloc(ImageWorkerCallback callback, void* context);
+void image_worker_free(ImageWorker* worker);
+
+// Make `path` the frame on screen. Returns true if it is already decoded;
+// otherwise it is queued first and the callback fires when it lands.
+bool image_worker_show(ImageWorker* worker, const char* path);
+
+// Queue speculative decodes of the neighbours of the frame on screen;
+// empty strings or NULL are skipped
+void image_worker_prefetch(ImageWorker* worker, const char* prev, const char* next);
+
+// State of the slot holding `path`, ImageFrameEmpty when none does. Lets the
+// slideshow check that the next image is ready before moving on to it.
+ImageFrameState image_worker_get_state(ImageWorker* worker, const char* path);
+
+// Zoom into the frame on screen: level `zoom` of the tile pyramid (0 for the
+// whole image) with the top-left of the screen on half tile (x, y). A half
+// tile is 64x32 pixels, so there are 2^(zoom+1) of them each way. The view
+// is composed from the tiles under the screen; tiles are converted on first
+// visit and read back from the SD cache after that. Until the view is ready
+// the previous one, or the whole frame, stays on screen.
+void image_worker_set_view(ImageWorker* worker, uint8_t zoom, uint16_t x, uint16_t y);
+
+// Forget every frame, e.g. after the dithering mode changed
+void image_worker_invalidate(ImageWorker* worker);
+
+// Lock the frame on screen for drawing. Returns its bitmap, or the zoomed
+// view of it, when ready, the latest preview while it is decoding and NULL
+// otherwise; `state` tells which. Always pair with image_worker_unlock.
+const uint8_t* image_worker_lock_current(ImageWorker* worker, ImageFrameState* state);
+void image_worker_unlock(ImageWorker* worker);
+
+// How the frame on screen was produced; false while it is still pending
+bool image_worker_get_current_stats(ImageWorker* worker, ImageConvertStats* stats);
+
+// Counters of the frame cache as of the last finished job
+void image_worker_get_cache_stats(ImageWorker* worker, ImageCacheStats* stats);
+
+#ifdef __cplusplus
+}
+#endif